@@ -31,8 +31,132 @@
  
 #pragma once
 #include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "sift.h"
 #include "common.h"
+#include "face_alignment.h"
+
+/** The parameters of CFAN. They are never modified once loaded, so that one model
+  * can be shared read-only by any number of CCFAN instances, e.g. one for each thread.
+  */
+class CFANModel{
+ public:
+  /** A constructor.
+   *  Initialize basic parameters.
+   */
+  CFANModel(void);
+
+  /** A destructor which should never be called explicitly.
+   *  Release all dynamically allocated resources.
+   */
+  ~CFANModel(void);
+
+  /** Load the parameters of the facial landmark detection model. The model file is
+    * mapped read-only and validated, and the parameters point into the mapped memory.
+    *  @param model_path Path of the model file, either absolute or relative to
+    *                   the working directory.
+    *  @return Whether the model was loaded, i.e. the file exists and is well formed
+    */
+  bool InitModel(const char *model_path);
+
+  /*The number of facial points*/
+  int pts_num;
+  /*The dimension of the shape indexed features*/
+  int fea_dim;
+  /*The size of the patch of one SIFT feature*/
+  int sift_patch_size;
+  /*The SIFT extractor, configured once at InitModel*/
+  SIFT sift_extractor;
+  /*The sizes of the face patches of the two networks*/
+  int lan1_resize_size;
+  int lan2_resize_size;
+  /*The mean face shape containing five landmarks*/
+  const float *mean_shape;
+
+  /*The parameters of the first local stacked autoencoder network*/
+  const float **lan1_w;
+  const float **lan1_b;
+  const int *lan1_structure;
+  int lan1_size;
+
+  /*The parameters of the second local stacked autoencoder network*/
+  const float **lan2_w;
+  const float **lan2_b;
+  const int *lan2_structure;
+  int lan2_size;
+
+  /*The largest number of units of a layer*/
+  int max_layer_dim;
+
+  /** A fully connected layer whose weights are quantized to 8 bits, with one scale for each row */
+  struct Int8Layer
+  {
+    int fea_dim;
+    int out_dim;
+    /*The length of a row of weights, the input dimension padded with zeros to a multiple of 32*/
+    int row_len;
+    std::vector<int8_t> w;
+    std::vector<float> w_scale;
+    const float *b;
+  };
+  /*The hidden layers of a network quantized to 8 bits. The output layer keeps its
+    float weights, which are few but whose error goes straight into the landmarks*/
+  typedef std::vector<Int8Layer> Int8Network;
+
+  /** Get the hidden layers of one network with their weights quantized to 8 bits. Both
+    * networks are quantized at the first call, which is safe from any thread, and kept
+    * until the model is released.
+    *  @param stage 0 for the first network, 1 for the second one
+    *  @return The quantized layers
+    */
+  const Int8Network &GetInt8Network(int stage) const;
+
+ private:
+  /** Point the parameters of one network into the model file.
+    *  @param[in,out] offset The position of the network in the model file, moved past it
+    *  @param[out] structure The number of units of each layer
+    *  @param[out] size The number of layers
+    *  @param[out] w The weights of each layer
+    *  @param[out] b The biases of each layer
+    *  @return Whether the network is well formed and fits in the file
+    */
+  bool LoadNetwork(size_t *offset, const int **structure, int *size, const float ***w, const float ***b);
+
+  /** Point at count elements of elem_size bytes in the model file.
+    *  @param[in,out] offset The position of the elements, moved past them
+    *  @return The elements, or NULL if the file is too short
+    */
+  const void *TakeData(size_t *offset, size_t count, size_t elem_size);
+
+  /** Release the parameters and unmap the model file. */
+  void Release();
+
+  /** Quantize the weights of the hidden layers of one network to 8 bits.
+    *  @param w The weights of each layer
+    *  @param b The biases of each layer
+    *  @param structure The number of units of each layer
+    *  @param size The number of layers
+    *  @param[out] network The quantized layers
+    */
+  static void QuantizeNetwork(const float *const *w, const float *const *b, const int *structure, int size,
+    Int8Network *network);
+
+  /*The model file mapped read-only*/
+  void *model_data_;
+  size_t model_data_size_;
+
+  /*The networks quantized to 8 bits, made on demand by GetInt8Network*/
+  mutable std::mutex int8_mutex_;
+  mutable bool int8_ready_;
+  mutable Int8Network lan1_int8_;
+  mutable Int8Network lan2_int8_;
+
+  CFANModel(const CFANModel &);
+  CFANModel &operator=(const CFANModel &);
+};
 
 class CCFAN{
  public:
@@ -46,22 +170,179 @@ class CCFAN{
    */
   ~CCFAN(void);
 
-  /** Initialize the facial landmark detection model.
+  /** Initialize the facial landmark detection model, loading parameters of its own.
     *  @param model_path Path of the model file, either absolute or relative to
     *                   the working directory.
+    *  @return Whether the model was loaded
+    */
+  bool InitModel(const char *model_path);
+
+  /** Initialize the facial landmark detection with loaded parameters, which are
+    * shared with other instances. Only the scratch buffers are allocated.
+    *  @param model The parameters of the model, or NULL if it failed to load
     */
-  void InitModel(const char *model_path);
+  void SetModel(std::shared_ptr<const CFANModel> model);
+
+  /** Whether a model is loaded, without which no landmark can be detected. */
+  bool IsLoaded() const { return model_ != NULL; }
 
   /** Detect five facial landmarks, i.e., two eye centers, nose tip and two mouth corners.
-    *  @param gray_im A grayscale image
-    *  @param im_width The width of the inpute image
-    *  @param im_height The height of the inpute image
+    *  @param image The view of the input image, in gray levels or colour
     *  @param face_loc The face bounding box
     *  @param[out] facial_loc The locations of detected facial points
     */
-  void FacialPointLocate(const unsigned char *gray_im, int im_width, int im_height, seeta::FaceInfo face_loc, float *facial_loc);
+  void FacialPointLocate(const seeta::ImageView &image, seeta::FaceInfo face_loc, float *facial_loc);
+
+  /** Detect five facial landmarks for each of a batch of faces. The faces are
+    * processed in parallel, and the networks run on all of them at once, with
+    * the same results as for the faces one by one.
+    *  @param image The view of the input image, in gray levels or colour
+    *  @param face_locs The face bounding boxes
+    *  @param face_num The number of faces
+    *  @param[out] facial_locs The locations of detected facial points, face by face
+    */
+  void FacialPointLocateBatch(const seeta::ImageView &image, const seeta::FaceInfo *face_locs, int face_num,
+    float *facial_locs);
+
+  /** Track five facial landmarks from those of the previous frame, which are used as
+    * the initial shape of the second network only. It falls back to FacialPointLocate
+    * when the previous landmarks do not fit the face, or when the second network moves
+    * some point too much.
+    *  @param image The view of the input image, in gray levels or colour
+    *  @param face_loc The face bounding box
+    *  @param prev_loc The locations of the facial points in the previous frame
+    *  @param[out] facial_loc The locations of detected facial points
+    *  @return Whether the landmarks were tracked, i.e. without falling back
+    */
+  bool FacialPointTrack(const seeta::ImageView &image, seeta::FaceInfo face_loc,
+    const float *prev_loc, float *facial_loc);
+
+  /** Set the number of networks run by FacialPointLocate and FacialPointLocateBatch.
+    *  @param stage_num 1 for the first, coarse network only, or 2 for both of them
+    */
+  void SetStageNum(int stage_num);
+
+  /** Set the largest move of a facial point by the second network accepted when tracking.
+    *  @param ratio The move relative to the size of the face patch of the second network
+    */
+  void SetMaxTrackUpdate(float ratio);
+
+  /** Select the precision of the weights of both networks. The 8-bit weights of the
+    * hidden layers are about a quarter of the memory traffic of the float ones, at the
+    * cost of a small error of the landmarks.
+    *  @param use_int8 Whether to run the networks with weights quantized to 8 bits
+    */
+  void SetInt8Weights(bool use_int8);
+
+  /** Set the number of threads of the detection. The faces of a batch are shared out
+    * among them, or the patches of the facial points of each face when there are fewer
+    * faces than threads, and the landmarks do not depend on the number of threads.
+    *  @param num_threads The number of threads, 1 without OpenMP
+    */
+  void SetNumThreads(int num_threads);
 
  private:
+  /*The alignment benchmark, which times the steps of FacialPointLocate one by one*/
+  friend class CCFANBenchmark;
+
+  /** Scratch buffers of the per-face work, one set for each thread */
+  struct Context
+  {
+    SIFT::Workspace sift_workspace;
+    std::vector<BYTE> resized_patch;
+    std::vector<BYTE> sub_img;
+    std::vector<float> sift_fea;
+    /*The patches whose SIFT features are extracted together, and their features*/
+    std::vector<int> window_left;
+    std::vector<int> window_top;
+    std::vector<int> window_point;
+    std::vector<float> window_fea;
+    /*Source columns and rows of the resized patch, with their fixed-point weights*/
+    std::vector<int> resize_x_ofs;
+    std::vector<int> resize_x_weight;
+    std::vector<int> resize_y_ofs;
+    std::vector<int> resize_y_weight;
+    /*The gray levels of the source pixels read on two rows of a colour image, in pairs*/
+    std::vector<int> resize_pair_ofs;
+    std::vector<BYTE> resize_top;
+    std::vector<BYTE> resize_bottom;
+  };
+
+  /** Make room for the intermediate results of a batch of faces.
+    *  @param face_num The number of faces
+    */
+  void ReserveBatch(int face_num);
+
+  /** Get the scratch buffers of the calling thread. */
+  Context *GetContext();
+
+  /** Compute the extended region of the detected face.
+    *  @param im_width The width of the inpute image
+    *  @param im_height The height of the inpute image
+    *  @param face_loc The face bounding box
+    *  @param[out] region The left, top, width and height of the extended face region
+    */
+  void GetFaceRegion(int im_width, int im_height, seeta::FaceInfo face_loc, int *region);
+
+  /** Extract the shape indexed SIFT features on the resized face region.
+    *  @param image The view of the input image
+    *  @param region The left, top, width and height of the extended face region
+    *  @param resize_w The width of the resized face patch
+    *  @param resize_h The height of the resized face patch
+    *  @param face_shape The locations of facial points in the resized face patch
+    *  @param[out] fea The features ordered by dimension then by facial point
+    *  @param context The scratch buffers to use
+    *  @param num_threads The number of threads extracting the SIFT features of the
+    *  facial points of the face
+    */
+  void ShapeIndexedFeature(const seeta::ImageView &image, const int *region,
+    int resize_w, int resize_h, float *face_shape, float *fea, Context *context, int num_threads = 1);
+
+  /** Run a local stacked autoencoder network on a batch of faces.
+    *  @param w The weights of each layer
+    *  @param b The biases of each layer
+    *  @param structure The number of units of each layer
+    *  @param size The number of layers
+    *  @param input The input features, face by face
+    *  @param face_num The number of faces
+    *  @param[out] output The outputs of the network, face by face
+    *  @param int8_layers The hidden layers quantized to 8 bits, which replace the
+    *  float ones, or NULL
+    */
+  void ForwardNetwork(const float *const *w, const float *const *b, const int *structure, int size,
+    const float *input, int face_num, float *output, const CFANModel::Int8Network *int8_layers = NULL);
+
+  /** Compute one fully connected layer, followed by the sigmoid unless it is the output layer.
+    *  @param w The weights, out_dim rows of fea_dim
+    *  @param b The biases
+    *  @param fea_dim The input dimension
+    *  @param out_dim The output dimension
+    *  @param input The input activations, face by face
+    *  @param face_num The number of faces
+    *  @param is_output Whether it is the output layer, which is linear
+    *  @param[out] output The output activations, face by face
+    */
+  void ForwardLayer(const float *w, const float *b, int fea_dim, int out_dim,
+    const float *input, int face_num, bool is_output, float *output);
+
+  /** Run the first or the second network on a batch of faces, with the float or the
+    * 8-bit weights as selected by SetInt8Weights.
+    *  @param stage 0 for the first network, 1 for the second one
+    *  @param input The input features, face by face
+    *  @param face_num The number of faces
+    *  @param[out] output The outputs of the network, face by face
+    */
+  void RunNetwork(int stage, const float *input, int face_num, float *output);
+
+  /** Compute one hidden layer with 8-bit weights, followed by the sigmoid. The input
+    * activations are quantized to 7 bits.
+    *  @param layer The quantized layer
+    *  @param input The input activations, face by face, which are not negative
+    *  @param face_num The number of faces
+    *  @param[out] output The output activations, face by face
+    */
+  void ForwardLayerInt8(const CFANModel::Int8Layer &layer, const float *input, int face_num, float *output);
+
   /** Extract shape indexed SIFT features.
     *  @param gray_im A grayscale image
     *  @param im_width The width of the inpute image
@@ -69,8 +350,12 @@ class CCFAN{
     *  @param face_shape The locations of facial points
     *  @param patch_size The size of the patch used for extracting SIFT feature
     *  @param[out] sift_fea the extracted shape indexed SIFT features which are concatenated into a vector
+    *  @param context The scratch buffers to use
+    *  @param num_threads The number of threads extracting the features of the patches
+    *  near the face, which use the SIFT workspaces of all the contexts if more than one
     */
-  void TtSift(const unsigned char *gray_im, int im_width, int im_height, float *face_shape, int patch_size, double *sift_fea);
+  void TtSift(const unsigned char *gray_im, int im_width, int im_height, float *face_shape, int patch_size, float *sift_fea,
+    Context *context, int num_threads = 1);
 
   /** Extract a image patch which is centered at point(point_x, point_y) with a given patch size.
   *  @param gray_im A grayscale image
@@ -83,36 +368,48 @@ class CCFAN{
   */
   void GetSubImg(const unsigned char *gray_im, int im_width, int im_height, float point_x, float point_y, int patch_size, BYTE *sub_img);
 
-  /** Resize the image by bilinear interpolation.
-    *  @param src_im A source image in grayscale
-    *  @param src_width The width of the source image
-    *  @param src_height The height of the source image
+  /** Resize the image by bilinear interpolation in fixed point, reading the source
+    * image in place through tables of source coordinates. Colour pixels are converted
+    * to gray levels where they are read.
+    *  @param src The view of the source image, in gray levels or colour
     *  @param[out] dst_im The target image in grayscale
     *  @param dst_width The width of the target image
     *  @param dst_height The height of the target image
+    *  @param context The scratch buffers holding the coordinate tables
     */
-  bool ResizeImage(const unsigned char *src_im, int src_width, int src_height,
-    unsigned char* dst_im, int dst_width, int dst_height);
+  bool ResizeImage(const seeta::ImageView &src, unsigned char* dst_im, int dst_width, int dst_height,
+    Context *context);
 
  private:
-  /*The number of facial points*/
-  int pts_num_;
-  /*The dimension of the shape indexed features*/
-  int fea_dim_;
-  /*The mean face shape containing five landmarks*/
-  float *mean_shape_;
+  /*The parameters of the model, possibly shared with other instances*/
+  std::shared_ptr<const CFANModel> model_;
+  /*The number of networks run when locating the facial points*/
+  int stage_num_;
+  /*The largest shift of the centroid of the previous landmarks from the mean shape,
+    distance of one of them from the shifted mean shape, and move by the second network,
+    accepted when tracking, relative to the face patch size*/
+  float max_track_shift_;
+  float max_track_distance_;
+  float max_track_update_;
+  /*Whether the networks run with 8-bit weights, and the quantized networks if so*/
+  bool use_int8_;
+  const CFANModel::Int8Network *lan_int8_[2];
+  /*The number of threads, each with a context of its own*/
+  int num_threads_;
 
-  /*The parameters of the first local stacked autoencoder network*/
-  float **lan1_w_;
-  float **lan1_b_;
-  int *lan1_structure_;
-  int lan1_size_;
-
-  /*The parameters of the second local stacked autoencoder network*/
-  float **lan2_w_;
-  float **lan2_b_;
-  int *lan2_structure_;
-  int lan2_size_;
+  /*Scratch buffers allocated at InitModel or SetModel, which makes the instance
+    unsafe to be used by multiple threads at the same time: threads should rather
+    use instances of their own sharing the model*/
+  std::vector<Context> contexts_;
+  std::vector<SIFT::Workspace *> sift_workspaces_;
+  std::vector<int> face_region_;
+  std::vector<float> fea_;
+  std::vector<float> shape_inc_;
+  std::vector<float> lan_a_;
+  std::vector<float> lan_a_next_;
+  /*The activations quantized to 7 bits and their scales, face by face*/
+  std::vector<uint8_t> lan_q_;
+  std::vector<float> lan_q_scale_;
 
 };
 
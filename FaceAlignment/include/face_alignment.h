@@ -33,33 +33,207 @@
 #define SEETA_FACE_ALIGNMENT_H_
 
 #include <cstdlib>
+#include <memory>
+#include <vector>
 #include "common.h"
 class CCFAN;
+class CFANModel;
 
 namespace seeta {
+
+/** Quality levels of the landmark detection */
+enum AlignmentQuality {
+  ALIGNMENT_FAST,  /*The first, coarse stage only, on a 80x80 face patch*/
+  ALIGNMENT_FULL   /*Both stages, the fine one on a 140x140 face patch*/
+};
+
+/** Pixel formats of the images read by the landmark detection */
+enum PixelFormat {
+  PIXEL_FORMAT_GRAY,  /*One byte of gray level per pixel, e.g. the Y plane of a YUV frame*/
+  PIXEL_FORMAT_BGR,   /*Three bytes per pixel, blue, green then red, as the images of OpenCV*/
+  PIXEL_FORMAT_RGB    /*Three bytes per pixel, red, green then blue*/
+};
+
+/** A view of an image in memory, which is neither copied nor converted as a whole.
+*  Its rows are stride bytes apart, so that it may be a region of a larger buffer
+*  or a plane of a video frame. Only the pixels around the faces are read, colour
+*  pixels being converted to gray levels there with the weights of ITU-R BT.601.
+*/
+typedef struct ImageView {
+  ImageView() {
+    data = NULL;
+    width = 0;
+    height = 0;
+    stride = 0;
+    format = PIXEL_FORMAT_GRAY;
+  }
+
+  ImageView(const uint8_t* img_data, int32_t img_width, int32_t img_height,
+    int32_t img_stride, PixelFormat img_format = PIXEL_FORMAT_GRAY) {
+    data = img_data;
+    width = img_width;
+    height = img_height;
+    stride = img_stride;
+    format = img_format;
+  }
+
+  const uint8_t* data;
+  int32_t width;
+  int32_t height;
+  int32_t stride;  /*The number of bytes from the start of a row to the start of the next one*/
+  PixelFormat format;
+} ImageView;
+
+/** Precisions of the weights of the networks */
+enum AlignmentPrecision {
+  ALIGNMENT_FLOAT32,  /*The weights of the model file*/
+  ALIGNMENT_INT8      /*The weights quantized to 8 bits, a quarter of the memory traffic*/
+};
+
+/** The parameters of the landmark detection. They are loaded once and never
+*  modified, so that a model can be shared by any number of FaceAlignment
+*  instances, e.g. one for each worker thread, without loading it again.
+*  Copies of a FaceAlignmentModel share the same parameters.
+*/
+class FaceAlignmentModel{
+ public:
+  /** A constructor loading the model file.
+  *  @param model_path Path of the model file, either absolute or relative to
+  *  the working directory. If NULL, it is "seeta_fa_v1.1.bin" in the working
+  *  directory.
+  */
+  SEETA_API explicit FaceAlignmentModel(const char* model_path = NULL);
+
+  SEETA_API ~FaceAlignmentModel();
+
+  /** Whether the model file was found and well formed. */
+  SEETA_API bool IsLoaded() const;
+
+ private:
+  friend class FaceAlignment;
+  std::shared_ptr<const CFANModel> model_;
+};
+
 class FaceAlignment{
  public:
   /** A constructor with an optional argument specifying path of the model file.
   *  If called with no argument, the model file is assumed to be stored in the
   *  the working directory as "seeta_fa_v1.1.bin".
   *
+  *  Buffers for the detection are allocated here and reused by every call, so
+  *  an instance should not be used by multiple threads at the same time. Threads
+  *  rather use instances of their own, which can share one FaceAlignmentModel.
+  *
+  *  A missing or corrupt model file is reported by IsLoaded(), and the detection
+  *  of landmarks then fails.
+  *
   *  @param model_path Path of the model file, either absolute or relative to
   *  the working directory.
+  *  @param precision The precision of the weights of the networks. ALIGNMENT_INT8
+  *  quantizes them to 8 bits with a scale for each output unit. On the synthetic
+  *  faces of fa_align_benchmark, this moves the landmarks by 0.9% of the
+  *  inter-ocular distance on average (0.23 pixels) and by up to 6.8% (1.75 pixels).
   */
-  SEETA_API FaceAlignment(const char* model_path = NULL);
+  SEETA_API FaceAlignment(const char* model_path = NULL, AlignmentPrecision precision = ALIGNMENT_FLOAT32);
+
+  /** A constructor sharing the parameters of a loaded model, which only allocates
+  *  the buffers for the detection. Instances of each thread can be created this
+  *  way, the memory of the parameters and the time to load them being paid once.
+  *
+  *  @param model The loaded model, which may be destroyed before the instance
+  *  @param precision The precision of the weights of the networks. The 8-bit weights
+  *  are made once for all the instances sharing the model.
+  */
+  SEETA_API explicit FaceAlignment(const FaceAlignmentModel &model, AlignmentPrecision precision = ALIGNMENT_FLOAT32);
 
   /** A Destructor which should never be called explicitly.
   *  Release all dynamically allocated resources.
   */
   SEETA_API ~FaceAlignment();
 
+  /** Whether the model is loaded, without which no landmark is detected. */
+  SEETA_API bool IsLoaded() const;
+
   /** Detect five facial landmarks, i.e., two eye centers, nose tip and two mouth corners.
-  *  @param gray_im A grayscale image
+  *  @param gray_im A grayscale image, or a BGR one if it has 3 channels
   *  @param face_info The face bounding box
   *  @param[out] points The locations of detected facial points
+  *  @return false if the image has neither 1 nor 3 channels or the model is not loaded
   */
   SEETA_API bool PointDetectLandmarks(ImageData gray_im, FaceInfo face_info, FacialLandmark *points);
 
+  /** Detect five facial landmarks on a view of an image, e.g. a video frame in place.
+  *  @param image The view of a grayscale, BGR or RGB image
+  *  @param face_info The face bounding box
+  *  @param[out] points The locations of detected facial points
+  *  @return false if the view is invalid or the model is not loaded
+  */
+  SEETA_API bool PointDetectLandmarks(const ImageView &image, FaceInfo face_info, FacialLandmark *points);
+
+  /** Detect five facial landmarks for each of a batch of faces on one image.
+  *  The faces are processed in parallel and the networks run on all of them
+  *  at once, which gives the same results as PointDetectLandmarks() face by face.
+  *  @param gray_im A grayscale image, or a BGR one if it has 3 channels
+  *  @param face_infos The face bounding boxes
+  *  @param[out] points The locations of detected facial points, five per face
+  *  in the order of the faces, i.e., 5 * face_infos.size() in total
+  */
+  SEETA_API bool PointDetectLandmarksBatch(ImageData gray_im, const std::vector<FaceInfo> &face_infos, FacialLandmark *points);
+
+  /** Detect five facial landmarks for each of a batch of faces on a view of an image.
+  *  @param image The view of a grayscale, BGR or RGB image
+  *  @param face_infos The face bounding boxes
+  *  @param[out] points The locations of detected facial points, five per face
+  */
+  SEETA_API bool PointDetectLandmarksBatch(const ImageView &image, const std::vector<FaceInfo> &face_infos, FacialLandmark *points);
+
+  /** Set the quality level of PointDetectLandmarks() and PointDetectLandmarksBatch().
+  *  ALIGNMENT_FAST skips the second stage, which roughly halves the cost per face
+  *  for rough landmarks, e.g. the eye centers for cropping. ALIGNMENT_FULL by default.
+  *  PointTrackLandmarks() always runs the fine stage.
+  *  @param quality The quality level
+  */
+  SEETA_API void SetQualityLevel(AlignmentQuality quality);
+
+  /** Track five facial landmarks of a face in a video from those of the previous frame.
+  *  The previous landmarks are the initial shape of the second, fine stage, and
+  *  the first stage is skipped. It falls back to PointDetectLandmarks() when the
+  *  previous landmarks do not fit the face bounding box, i.e. the track is lost,
+  *  or when the fine stage moves some point too much.
+  *  @param gray_im A grayscale image, or a BGR one if it has 3 channels
+  *  @param face_info The face bounding box in this frame, or the one of the track
+  *  @param prev_points The five facial points of the face in the previous frame
+  *  @param[out] points The locations of detected facial points
+  *  @param[out] tracked Optional, whether the points were tracked rather than detected from scratch
+  */
+  SEETA_API bool PointTrackLandmarks(ImageData gray_im, FaceInfo face_info, const FacialLandmark *prev_points,
+    FacialLandmark *points, bool *tracked = NULL);
+
+  /** Track five facial landmarks of a face on a view of a video frame.
+  *  @param image The view of a grayscale, BGR or RGB frame
+  *  @param face_info The face bounding box in this frame, or the one of the track
+  *  @param prev_points The five facial points of the face in the previous frame
+  *  @param[out] points The locations of detected facial points
+  *  @param[out] tracked Optional, whether the points were tracked rather than detected from scratch
+  */
+  SEETA_API bool PointTrackLandmarks(const ImageView &image, FaceInfo face_info, const FacialLandmark *prev_points,
+    FacialLandmark *points, bool *tracked = NULL);
+
+  /** Set the largest move of a facial point by the fine stage accepted when tracking.
+  *  @param ratio The move relative to the size of the face patch of the fine stage,
+  *  140 pixels, 0.08 by default
+  */
+  SEETA_API void SetMaxTrackUpdate(float ratio);
+
+  /** Set the number of threads of the detection, SEETA_NUM_THREADS by default when
+  *  built with OpenMP, otherwise always 1. The faces of PointDetectLandmarksBatch()
+  *  are shared out among the threads, or, when there are fewer faces than threads,
+  *  the SIFT features of the five facial points of each face, as for a single face.
+  *  The landmarks are the same, bit for bit, on any number of threads.
+  *  @param num_threads The number of threads
+  */
+  SEETA_API void SetNumThreads(int num_threads);
+
  private:
   CCFAN *facial_detector;
 };
@@ -35,6 +35,7 @@
 #include "stdio.h"
 #include <string>
 #include <cmath>
+#include <vector>
 
 typedef unsigned char BYTE;
 
@@ -51,40 +52,128 @@ class SIFT{
 	  */
   void InitSIFT(int im_width, int im_height, int patch_size, int grid_spacing);
 
+  /** Scratch buffers of CalcSIFT. The extractor itself is not modified after
+  *  InitSIFT, so that it can be shared by threads having their own workspaces.
+  */
+  struct Workspace
+  {
+	  std::vector<float> gray_img_ex;
+	  std::vector<float> deriv_row;
+	  std::vector<float> smooth_row;
+	  std::vector<float> grad_x;
+	  std::vector<float> grad_y;
+	  std::vector<float> orientation_row;
+	  std::vector<float> row_sum;
+	  std::vector<float> pooled;
+
+	  /* The maps shared by the windows of CalcSIFTWindows, and the borders of a window */
+	  std::vector<float> map_image;
+	  std::vector<float> map_deriv;
+	  std::vector<float> map_smooth;
+	  std::vector<float> map_grad_x;
+	  std::vector<float> map_grad_y;
+	  std::vector<float> map_orientation;
+	  std::vector<int> intervals;
+	  std::vector<float> side_deriv;
+	  std::vector<float> side_smooth;
+	  std::vector<float> edge_deriv;
+	  std::vector<float> edge_smooth;
+	  std::vector<float> ring_grad_x;
+	  std::vector<float> ring_grad_y;
+	  std::vector<float> ring_orientation;
+	  std::vector<float> block_sum;
+  };
+
+  /** Allocate the scratch buffers of CalcSIFT and CalcSIFTWindows
+  *  @param[out] workspace The workspace to allocate
+  */
+  void InitWorkspace(Workspace* workspace) const;
+
   /** Compute SIFT feature
   *  @param gray_im A grayscale image
   *  @param[out] sift_feature The output SIFT feature
+  *  @param workspace The scratch buffers allocated by InitWorkspace
   */
-  void CalcSIFT(BYTE* gray_im, double* sift_feature);
+  void CalcSIFT(const BYTE* gray_im, float* sift_feature, Workspace* workspace) const;
 
- private:
-  /** Implement convolutional function "filter2" same in Matlab.
+  /** Compute the SIFT features of several windows of an image, of the size given to
+  *  InitSIFT, as CalcSIFT on each window cut out of the image. The gradients and the
+  *  orientations are computed once where the windows overlap.
   *  @param gray_im A grayscale image
-  *  @param kernel A convolutional kernel
-  *  @param kernel_size The size of convolutional kernel
-  *  @param[out] filter_im The output image map after convolution
+  *  @param im_width The width of the image
+  *  @param im_height The height of the image
+  *  @param window_left The left of each window, which may be outside of the image
+  *  @param window_top The top of each window, which may be outside of the image
+  *  @param window_num The number of windows
+  *  @param pad_value The value of the pixels of the windows outside of the image
+  *  @param[out] sift_features The SIFT features of the windows, one after another
+  *  @param workspace The scratch buffers allocated by InitWorkspace
   */
-  void filter2(double* gray_im, double* kernel, int kernel_size, double* filter_im);
+  void CalcSIFTWindows(const BYTE* gray_im, int im_width, int im_height, const int* window_left,
+	  const int* window_top, int window_num, BYTE pad_value, float* sift_features, Workspace* workspace) const;
 
-  /** Sparse convolution for speed-up
+  /** Compute the SIFT features of several windows of an image on several threads, with
+  *  the same features as on one thread.
   *  @param gray_im A grayscale image
-  *  @param kernel A convolutional kernel
-  *  @param kernel_size The size of convolutional kernel
-  *  @param[out] filter_im The output image map after sparse convolution
+  *  @param im_width The width of the image
+  *  @param im_height The height of the image
+  *  @param window_left The left of each window, which may be outside of the image
+  *  @param window_top The top of each window, which may be outside of the image
+  *  @param window_num The number of windows
+  *  @param pad_value The value of the pixels of the windows outside of the image
+  *  @param[out] sift_features The SIFT features of the windows, one after another
+  *  @param workspaces The scratch buffers of each thread, allocated by InitWorkspace
+  *  @param num_threads The number of threads
   */
-  void SparseFilter2(double* gray_im, double* kernel, int kernel_size, double* filter_im);
+  void CalcSIFTWindows(const BYTE* gray_im, int im_width, int im_height, const int* window_left,
+	  const int* window_top, int window_num, BYTE pad_value, float* sift_features, Workspace* const* workspaces,
+	  int num_threads) const;
 
-  /** Calculate image orientation
-  *  @param gray_im A grayscale image
-  *  @param[out] image_orientation The output image orientation
+ private:
+  /** Filter one row by the derivative and the smoothing factors of the separable filters.
+  *  @param src The row, with pad_size extra pixels on both sides
+  *  @param count The number of output pixels
+  *  @param[out] deriv The row filtered by the derivative factor
+  *  @param[out] smooth The row filtered by the smoothing factor
   */
-  void ImageOrientation(double* gray_im, double* image_orientation);
+  void FilterRow(const float* src, int count, float* deriv, float* smooth) const;
+
+  /** Filter the columns of the rows filtered by FilterRow into the gradients.
+  *  @param deriv The first of the filter_size rows filtered by the derivative factor
+  *  @param smooth The first of the filter_size rows filtered by the smoothing factor
+  *  @param stride The distance between the rows
+  *  @param count The number of output pixels
+  *  @param[out] grad_x The horizontal gradients
+  *  @param[out] grad_y The vertical gradients
+  */
+  void FilterColumns(const float* deriv, const float* smooth, int stride, int count, float* grad_x, float* grad_y) const;
+
+  /** Compute the image gradients by the separable derivative of Gaussian filters,
+  *  with zero padding as "filter2" in Matlab.
+  *  @param workspace The workspace holding the image normalized by its maximum, with a zero border of 2 pixels
+  */
+  void ImageGradient(Workspace* workspace) const;
+
+  /** Bin the gradients of some pixels into the orientations
+  *  @param grad_x The horizontal gradients
+  *  @param grad_y The vertical gradients
+  *  @param count The number of pixels
+  *  @param[out] orientation The orientation maps, pixel by pixel
+  */
+  void Orientation(const float* grad_x, const float* grad_y, int count, float* orientation) const;
 
-  /** Calculate image orientation
-  *  @param image_orientation A image orientation map
-  *  @param[out] conv_im The output convolutional image
+  /** Accumulate the weighted sums of one row of orientations into the sample locations
+  *  @param row The index of the image row
+  *  @param workspace The workspace holding the orientation map of the row
   */
-  void ConvImage(double* image_orientation, double* conv_im);
+  void PoolRow(int row, Workspace* workspace) const;
+
+  /** Normalize the pooled orientations at the sample locations into the SIFT feature
+  *  @param pooled The pooled orientations, to be multiplied by scale
+  *  @param scale The normalization of the image by its maximum
+  *  @param[out] sift_feature The output SIFT feature
+  */
+  void Describe(const float* pooled, float scale, float* sift_feature) const;
 
   private:
   struct SIFTParam
@@ -112,6 +201,27 @@ class SIFT{
 
   SIFTParam param;
 
+  /* Separable factors of the derivative of Gaussian filters */
+  float deriv_[5];
+  float smooth_[5];
+
+  /* The triangular weights of the sample cells, and the range of the non-zero ones */
+  std::vector<float> cell_weight_;
+  int weight_begin_;
+  int weight_end_;
+
+  /* The sample rows and columns read by CalcSIFT, and the index of a pixel among them (-1 if none) */
+  std::vector<int> sample_rows_;
+  std::vector<int> sample_cols_;
+  std::vector<int> row_index_;
+  std::vector<int> col_index_;
+
+  /* The block of each row, the rows being split at the borders of the cells, and the blocks of each sample row */
+  std::vector<int> row_block_;
+  std::vector<int> block_begin_;
+  std::vector<int> block_end_;
+  int block_num_;
+
   static double delta_gauss_x[25];
   static double delta_gauss_y[25];
 
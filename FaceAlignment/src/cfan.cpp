@@ -33,131 +33,658 @@
 #include "cfan.h"
 #include <string.h>
 #include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(USE_AVX2)
+#include <immintrin.h>
+#elif defined(USE_SSE)
+#include <smmintrin.h>
+#endif
 using std::isnan;
 
+/** Map a file read-only into memory.
+  *  @param path Path of the file
+  *  @param[out] data The mapped file
+  *  @param[out] size The size of the file
+  *  @return Whether the file was mapped
+  */
+static bool MapFile(const char *path, void **data, size_t *size)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER file_size;
+  void *mapped = NULL;
+  if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+  {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL)
+    {
+      mapped = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+  if (mapped == NULL)
+    return false;
+  *data = mapped;
+  *size = size_t(file_size.QuadPart);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat file_stat;
+  void *mapped = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+    mapped = mmap(NULL, size_t(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    return false;
+  *data = mapped;
+  *size = size_t(file_stat.st_size);
+#endif
+  return true;
+}
+
+/** Unmap a file mapped by MapFile.
+  *  @param data The mapped file
+  *  @param size The size of the file
+  */
+static void UnmapFile(void *data, size_t size)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(data, size);
+#endif
+}
+
 /** A constructor.
   *  Initialize basic parameters.
   */
-CCFAN::CCFAN(void)
+CFANModel::CFANModel(void)
 {
-  pts_num_ = 5;
-  fea_dim_ = pts_num_ * 128;
+  pts_num = 5;
+  fea_dim = pts_num * 128;
+  sift_patch_size = 32;
+  lan1_resize_size = 80;
+  lan2_resize_size = 140;
+  max_layer_dim = 0;
+
+  lan1_w = NULL;
+  lan1_b = NULL;
+  lan1_structure = NULL;
+  lan1_size = 0;
 
-  lan1_w_ = NULL;
-  lan1_b_ = NULL;
-  lan1_structure_ = NULL;
+  lan2_w = NULL;
+  lan2_b = NULL;
+  lan2_structure = NULL;
+  lan2_size = 0;
 
-  lan2_w_ = NULL;
-  lan2_b_ = NULL;
-  lan2_structure_ = NULL;
+  mean_shape = NULL;
 
-  mean_shape_ = NULL;
+  model_data_ = NULL;
+  model_data_size_ = 0;
+  int8_ready_ = false;
 }
 
 /** A destructor which should never be called explicitly.
   *  Release all dynamically allocated resources.
   */
-CCFAN::~CCFAN(void)
+CFANModel::~CFANModel(void)
+{
+  Release();
+}
+
+/** Release the parameters and unmap the model file. Only the arrays of pointers
+  * to the layers are allocated, the parameters themselves are in the mapped file.
+  */
+void CFANModel::Release()
 {
-  if (lan1_structure_ != NULL)
+  delete[]lan1_w;
+  delete[]lan1_b;
+  lan1_w = NULL;
+  lan1_b = NULL;
+  lan1_structure = NULL;
+  lan1_size = 0;
+
+  delete[]lan2_w;
+  delete[]lan2_b;
+  lan2_w = NULL;
+  lan2_b = NULL;
+  lan2_structure = NULL;
+  lan2_size = 0;
+
+  mean_shape = NULL;
+  max_layer_dim = 0;
+
+  lan1_int8_.clear();
+  lan2_int8_.clear();
+  int8_ready_ = false;
+
+  if (model_data_ != NULL)
   {
-    delete[]lan1_structure_;
-    lan1_structure_ = NULL;
+    UnmapFile(model_data_, model_data_size_);
+    model_data_ = NULL;
+    model_data_size_ = 0;
   }
-  if (lan1_w_ != NULL)
+}
+
+/** Point at count elements of elem_size bytes in the model file. All the fields
+  * of the file are multiples of 4 bytes, so that the floats are aligned in the
+  * page-aligned mapping.
+  *  @param[in,out] offset The position of the elements, moved past them
+  *  @param count The number of elements
+  *  @param elem_size The size of one element
+  *  @return The elements, or NULL if the file is too short
+  */
+const void *CFANModel::TakeData(size_t *offset, size_t count, size_t elem_size)
+{
+  if (*offset > model_data_size_ || count > (model_data_size_ - *offset) / elem_size)
+    return NULL;
+  const void *data = static_cast<const char *>(model_data_) + *offset;
+  *offset += count * elem_size;
+  return data;
+}
+
+/** Point the parameters of one network into the model file. The network takes the
+  * shape indexed features and outputs the shape increments, and its layers are
+  * no larger than kMaxLayerDim units, so that a corrupt file fails here rather
+  * than when detecting the landmarks.
+  *  @param[in,out] offset The position of the network in the model file, moved past it
+  *  @param[out] structure The number of units of each layer
+  *  @param[out] size The number of layers
+  *  @param[out] w The weights of each layer
+  *  @param[out] b The biases of each layer
+  *  @return Whether the network is well formed and fits in the file
+  */
+bool CFANModel::LoadNetwork(size_t *offset, const int **structure, int *size, const float ***w, const float ***b)
+{
+  const int kMaxLayerNum = 64;
+  const int kMaxLayerDim = 1 << 16;
+
+  const int *layer_num = static_cast<const int *>(TakeData(offset, 1, sizeof(int)));
+  if (layer_num == NULL || *layer_num < 2 || *layer_num > kMaxLayerNum)
+    return false;
+  *structure = static_cast<const int *>(TakeData(offset, *layer_num, sizeof(int)));
+  if (*structure == NULL)
+    return false;
+  *size = *layer_num;
+  for (int i = 0; i < *size; i++)
   {
-    for (int i = 0; i < lan1_size_ - 1; i++)
-    {
-      delete[](lan1_w_[i]);
-      delete[](lan1_b_[i]);
-    }
-    delete[]lan1_w_;
-    delete[]lan1_b_;
-    lan1_w_ = NULL;
-    lan1_b_ = NULL;
+    if ((*structure)[i] <= 0 || (*structure)[i] > kMaxLayerDim)
+      return false;
   }
+  if ((*structure)[0] != fea_dim || (*structure)[*size - 1] != pts_num * 2)
+    return false;
 
-  if (lan2_structure_ != NULL)
+  *w = new const float *[*size - 1];
+  *b = new const float *[*size - 1];
+  for (int i = 0; i < *size - 1; i++)
   {
-    delete[]lan2_structure_;
+    (*w)[i] = static_cast<const float *>(TakeData(offset, size_t((*structure)[i]) * (*structure)[i + 1], sizeof(float)));
+    (*b)[i] = static_cast<const float *>(TakeData(offset, (*structure)[i + 1], sizeof(float)));
+    if ((*w)[i] == NULL || (*b)[i] == NULL)
+      return false;
   }
-  if (lan2_w_ != NULL)
+  return true;
+}
+
+/** Load the parameters of the facial landmark detection model. The model file is
+  * mapped read-only and validated, and the parameters point into the mapped memory.
+  *  @param model_path Path of the model file, either absolute or relative to
+  *                   the working directory.
+  *  @return Whether the model was loaded, i.e. the file exists and is well formed
+  */
+bool CFANModel::InitModel(const char *model_path)
+{
+  Release();
+  if (model_path == NULL || !MapFile(model_path, &model_data_, &model_data_size_))
+    return false;
+
+  /*The mean shape, then the first and the second local stacked autoencoder networks,
+    which must fill the whole file*/
+  size_t offset = 0;
+  mean_shape = static_cast<const float *>(TakeData(&offset, pts_num * 2, sizeof(float)));
+  bool is_loaded = mean_shape != NULL &&
+    LoadNetwork(&offset, &lan1_structure, &lan1_size, &lan1_w, &lan1_b) &&
+    LoadNetwork(&offset, &lan2_structure, &lan2_size, &lan2_w, &lan2_b) &&
+    offset == model_data_size_;
+  if (!is_loaded)
+  {
+    Release();
+    return false;
+  }
+
+  max_layer_dim = *std::max_element(lan1_structure, lan1_structure + lan1_size);
+  max_layer_dim = std::max(max_layer_dim, *std::max_element(lan2_structure, lan2_structure + lan2_size));
+  sift_extractor.InitSIFT(sift_patch_size, sift_patch_size, 32, 16);
+  return true;
+}
+
+/*The rows of 8-bit weights are padded to a multiple of this length, the number of
+  bytes of an AVX2 vector, so that the dot products need no remainder loop*/
+static const int kInt8RowAlign = 32;
+
+/** Quantize the weights of the hidden layers of one network to 8 bits. Each row of
+  * weights, i.e. each output unit, has a scale of its own, mapping its largest
+  * magnitude to 127. The output layer is left out: its 8-bit weights would move the
+  * landmarks by about a pixel, for a few percent of the weights of the network.
+  *  @param w The weights of each layer
+  *  @param b The biases of each layer
+  *  @param structure The number of units of each layer
+  *  @param size The number of layers
+  *  @param[out] network The quantized layers
+  */
+void CFANModel::QuantizeNetwork(const float *const *w, const float *const *b, const int *structure, int size,
+  Int8Network *network)
+{
+  network->resize(size - 2);
+  for (int i = 0; i < size - 2; i++)
   {
-    for (int i = 0; i < lan2_size_ - 1; i++)
+    Int8Layer &layer = (*network)[i];
+    layer.fea_dim = structure[i];
+    layer.out_dim = structure[i + 1];
+    layer.row_len = (layer.fea_dim + kInt8RowAlign - 1) / kInt8RowAlign * kInt8RowAlign;
+    layer.w.assign(size_t(layer.row_len) * layer.out_dim, 0);
+    layer.w_scale.resize(layer.out_dim);
+    layer.b = b[i];
+    for (int j = 0; j < layer.out_dim; j++)
     {
-      delete[](lan2_w_[i]);
-      delete[](lan2_b_[i]);
+      const float *row = w[i] + size_t(j) * layer.fea_dim;
+      float max_abs = 0;
+      for (int k = 0; k < layer.fea_dim; k++)
+      {
+        max_abs = std::max(max_abs, float(fabs(row[k])));
+      }
+      layer.w_scale[j] = max_abs / 127;
+      if (max_abs == 0)
+        continue;
+      int8_t *q = &layer.w[size_t(j) * layer.row_len];
+      float inv_scale = 127 / max_abs;
+      for (int k = 0; k < layer.fea_dim; k++)
+      {
+        int v = int(floor(row[k] * inv_scale + 0.5f));
+        q[k] = int8_t(std::max(-127, std::min(127, v)));
+      }
     }
-    delete[]lan2_w_;
-    delete[]lan2_b_;
-    lan2_w_ = NULL;
-    lan2_b_ = NULL;
   }
+}
 
-  if (mean_shape_)
+/** Get the hidden layers of one network with their weights quantized to 8 bits. Both
+  * networks are quantized at the first call, which is safe from any thread, and kept
+  * until the model is released.
+  *  @param stage 0 for the first network, 1 for the second one
+  *  @return The quantized layers
+  */
+const CFANModel::Int8Network &CFANModel::GetInt8Network(int stage) const
+{
+  std::lock_guard<std::mutex> lock(int8_mutex_);
+  if (!int8_ready_)
   {
-    delete[]mean_shape_;
-    mean_shape_ = NULL;
+    QuantizeNetwork(lan1_w, lan1_b, lan1_structure, lan1_size, &lan1_int8_);
+    QuantizeNetwork(lan2_w, lan2_b, lan2_structure, lan2_size, &lan2_int8_);
+    int8_ready_ = true;
   }
+  return (stage == 0 ? lan1_int8_ : lan2_int8_);
+}
+
+/** A constructor.
+  *  Initialize basic parameters.
+  */
+CCFAN::CCFAN(void)
+{
+  stage_num_ = 2;
+  max_track_shift_ = 0.12f;
+  max_track_distance_ = 0.2f;
+  max_track_update_ = 0.08f;
+  use_int8_ = false;
+  lan_int8_[0] = NULL;
+  lan_int8_[1] = NULL;
+#ifdef USE_OPENMP
+  num_threads_ = SEETA_NUM_THREADS;
+#else
+  num_threads_ = 1;
+#endif
 }
 
-/** Initialize the facial landmark detection model.
+/** A destructor which should never be called explicitly.
+  *  Release all dynamically allocated resources.
+  */
+CCFAN::~CCFAN(void)
+{
+}
+
+/** Initialize the facial landmark detection model, loading parameters of its own.
   *  @param model_path Path of the model file, either absolute or relative to
   *                   the working directory.
+  *  @return Whether the model was loaded
   */
-void CCFAN::InitModel(const char *model_path)
+bool CCFAN::InitModel(const char *model_path)
 {
-  /*Open the model file*/
-  FILE *fp = fopen(model_path, "rb+");
-  mean_shape_ = new float[pts_num_ * 2];
-  fread(mean_shape_, sizeof(float), pts_num_ * 2, fp);
+  std::shared_ptr<CFANModel> model = std::make_shared<CFANModel>();
+  if (!model->InitModel(model_path))
+  {
+    SetModel(NULL);
+    return false;
+  }
+  SetModel(model);
+  return true;
+}
 
-  /*Load the parameters of the first local stacked autoencoder network*/
-  fread(&lan1_size_, sizeof(int), 1, fp);
-  lan1_structure_ = new int[lan1_size_];
-  fread(lan1_structure_, sizeof(int), lan1_size_, fp);
+/** Initialize the facial landmark detection with loaded parameters, which are
+  * shared with other instances. Only the scratch buffers are allocated, so that
+  * no allocation is needed for detecting the landmarks of a face.
+  *  @param model The parameters of the model, or NULL if it failed to load
+  */
+void CCFAN::SetModel(std::shared_ptr<const CFANModel> model)
+{
+  model_ = model;
+  SetInt8Weights(use_int8_);
+  if (model_ == NULL)
+  {
+    contexts_.clear();
+    sift_workspaces_.clear();
+    return;
+  }
+  contexts_.resize(num_threads_);
+  sift_workspaces_.resize(num_threads_);
+  int max_resize_size = std::max(model_->lan1_resize_size, model_->lan2_resize_size);
+  for (size_t i = 0; i < contexts_.size(); i++)
+  {
+    model_->sift_extractor.InitWorkspace(&contexts_[i].sift_workspace);
+    contexts_[i].resized_patch.resize(max_resize_size * max_resize_size);
+    contexts_[i].sub_img.resize(model_->sift_patch_size * model_->sift_patch_size);
+    contexts_[i].sift_fea.resize(model_->fea_dim);
+    contexts_[i].window_left.resize(model_->pts_num);
+    contexts_[i].window_top.resize(model_->pts_num);
+    contexts_[i].window_point.resize(model_->pts_num);
+    contexts_[i].window_fea.resize(model_->fea_dim);
+    contexts_[i].resize_x_ofs.resize(max_resize_size);
+    contexts_[i].resize_x_weight.resize(max_resize_size);
+    contexts_[i].resize_y_ofs.resize(max_resize_size);
+    contexts_[i].resize_y_weight.resize(max_resize_size);
+    contexts_[i].resize_pair_ofs.resize(max_resize_size);
+    contexts_[i].resize_top.resize(max_resize_size * 2);
+    contexts_[i].resize_bottom.resize(max_resize_size * 2);
+    sift_workspaces_[i] = &contexts_[i].sift_workspace;
+  }
+  ReserveBatch(1);
+}
+
+/** Make room for the intermediate results of a batch of faces. Buffers only
+  * grow, so that batches no larger than before need no allocation.
+  *  @param face_num The number of faces
+  */
+void CCFAN::ReserveBatch(int face_num)
+{
+  face_region_.reserve(face_num * 4);
+  fea_.reserve(face_num * model_->fea_dim);
+  shape_inc_.reserve(face_num * model_->pts_num * 2);
+  lan_a_.reserve(face_num * model_->max_layer_dim);
+  lan_a_next_.reserve(face_num * model_->max_layer_dim);
+  if (use_int8_)
+  {
+    lan_q_.reserve(face_num * (model_->max_layer_dim + kInt8RowAlign));
+    lan_q_scale_.reserve(face_num);
+  }
+}
+
+/** Get the scratch buffers of the calling thread. */
+CCFAN::Context *CCFAN::GetContext()
+{
+#ifdef USE_OPENMP
+  return &contexts_[omp_get_thread_num() % contexts_.size()];
+#else
+  return &contexts_[0];
+#endif
+}
+
+/** Detect five facial landmarks, i.e., two eye centers, nose tip and two mouth corners.
+  *  @param image The view of the input image, in gray levels or colour
+  *  @param face_loc The face bounding box
+  *  @param[out] facial_loc The locations of detected facial points
+  */
+void CCFAN::FacialPointLocate(const seeta::ImageView &image, seeta::FaceInfo face_loc, float *facial_loc)
+{
+  FacialPointLocateBatch(image, &face_loc, 1, facial_loc);
+}
+
+/** Detect five facial landmarks for each of a batch of faces.
+  *  @param image The view of the input image, in gray levels or colour
+  *  @param face_locs The face bounding boxes
+  *  @param face_num The number of faces
+  *  @param[out] facial_locs The locations of detected facial points, face by face
+  */
+void CCFAN::FacialPointLocateBatch(const seeta::ImageView &image, const seeta::FaceInfo *face_locs, int face_num,
+  float *facial_locs)
+{
+  int shape_dim = model_->pts_num * 2;
+
+  /*Extended face regions, each given by its left, top, width and height*/
+  ReserveBatch(face_num);
+  face_region_.resize(face_num * 4);
+  fea_.resize(face_num * model_->fea_dim);
+  shape_inc_.resize(face_num * shape_dim);
+
+  /*The faces are shared out among the threads when there are enough of them, otherwise
+    the patches of the facial points of each face are*/
+  int face_threads = (face_num >= num_threads_ ? num_threads_ : 1);
+  int point_threads = (face_threads > 1 ? 1 : num_threads_);
+
+  /*The first local stacked autoencoder network, starting from the mean shape*/
+#pragma omp parallel num_threads(face_threads) if (face_threads > 1)
+  {
+#pragma omp for nowait
+    for (int n = 0; n < face_num; n++)
+    {
+      int *region = &face_region_[n * 4];
+      float *facial_loc = facial_locs + n * shape_dim;
+      GetFaceRegion(image.width, image.height, face_locs[n], region);
+
+      for (int i = 0; i < model_->pts_num; i++)
+      {
+        facial_loc[i * 2] = model_->mean_shape[i * 2] - 1;
+        facial_loc[i * 2 + 1] = model_->mean_shape[i * 2 + 1] - 1;
+      }
+      ShapeIndexedFeature(image, region, model_->lan1_resize_size, model_->lan1_resize_size,
+        facial_loc, &fea_[n * model_->fea_dim], GetContext(), point_threads);
+    }
+  }
+  RunNetwork(0, fea_.data(), face_num, shape_inc_.data());
+
+  int resize_size = model_->lan1_resize_size;
+  if (stage_num_ > 1)
+  {
+    /*The second local stacked autoencoder network*/
+    float x_scale = float(model_->lan1_resize_size) / model_->lan2_resize_size;
+    float y_scale = float(model_->lan1_resize_size) / model_->lan2_resize_size;
+
+#pragma omp parallel num_threads(face_threads) if (face_threads > 1)
+    {
+#pragma omp for nowait
+      for (int n = 0; n < face_num; n++)
+      {
+        const int *region = &face_region_[n * 4];
+        float *facial_loc = facial_locs + n * shape_dim;
+        for (int i = 0; i < shape_dim; i++)
+        {
+          facial_loc[i] = facial_loc[i] + shape_inc_[n * shape_dim + i];
+        }
+        for (int i = 0; i < model_->pts_num; i++)
+        {
+          facial_loc[i * 2] = (facial_loc[i * 2]) / x_scale;
+          facial_loc[i * 2 + 1] = (facial_loc[i * 2 + 1]) / y_scale;
+        }
+        ShapeIndexedFeature(image, region, model_->lan2_resize_size, model_->lan2_resize_size,
+          facial_loc, &fea_[n * model_->fea_dim], GetContext(), point_threads);
+      }
+    }
+    RunNetwork(1, fea_.data(), face_num, shape_inc_.data());
+    resize_size = model_->lan2_resize_size;
+  }
 
-  lan1_w_ = new float *[lan1_size_ - 1];
-  lan1_b_ = new float *[lan1_size_ - 1];
-  for (int i = 0; i < lan1_size_ - 1; i++)
+  /*Map the facial points back to the input image*/
+  for (int n = 0; n < face_num; n++)
   {
-    int layer_size = lan1_structure_[i] * lan1_structure_[i + 1];
-    lan1_w_[i] = new float[layer_size];
-    fread(lan1_w_[i], sizeof(float), layer_size, fp);
+    const int *region = &face_region_[n * 4];
+    float *facial_loc = facial_locs + n * shape_dim;
+    for (int i = 0; i < shape_dim; i++)
+    {
+      facial_loc[i] = facial_loc[i] + shape_inc_[n * shape_dim + i];
+    }
 
-    lan1_b_[i] = new float[lan1_structure_[i + 1]];
-    fread(lan1_b_[i], sizeof(float), lan1_structure_[i + 1], fp);
+    float x_scale = float(resize_size) / region[2];
+    float y_scale = float(resize_size) / region[3];
+    for (int i = 0; i < model_->pts_num; i++)
+    {
+      facial_loc[i * 2] = (facial_loc[i * 2]) / x_scale + region[0];
+      facial_loc[i * 2 + 1] = (facial_loc[i * 2 + 1]) / y_scale + region[1];
+    }
   }
+}
 
-  /*Load the parameters of the second local stacked autoencoder network*/
-  fread(&lan2_size_, sizeof(int), 1, fp);
-  lan2_structure_ = new int[lan2_size_];
-  fread(lan2_structure_, sizeof(int), lan2_size_, fp);
+/** Track five facial landmarks from those of the previous frame, running the second
+  * network only.
+  *  @param image The view of the input image, in gray levels or colour
+  *  @param face_loc The face bounding box
+  *  @param prev_loc The locations of the facial points in the previous frame
+  *  @param[out] facial_loc The locations of detected facial points
+  *  @return Whether the landmarks were tracked, i.e. without falling back
+  */
+bool CCFAN::FacialPointTrack(const seeta::ImageView &image, seeta::FaceInfo face_loc,
+  const float *prev_loc, float *facial_loc)
+{
+  int shape_dim = model_->pts_num * 2;
+  int region[4];
+  GetFaceRegion(image.width, image.height, face_loc, region);
 
-  lan2_w_ = new float *[lan2_size_ - 1];
-  lan2_b_ = new float *[lan2_size_ - 1];
-  for (int i = 0; i < lan2_size_ - 1; i++)
+  /*The previous landmarks in the face patch of the second network, which must lie
+    near the mean shape for the network to refine them: both their centroid and
+    their shape around it are checked*/
+  float x_scale = float(model_->lan2_resize_size) / region[2];
+  float y_scale = float(model_->lan2_resize_size) / region[3];
+  float mean_scale = float(model_->lan2_resize_size) / model_->lan1_resize_size;
+  float shift_x = 0;
+  float shift_y = 0;
+  for (int i = 0; i < model_->pts_num; i++)
+  {
+    facial_loc[i * 2] = (prev_loc[i * 2] - region[0]) * x_scale;
+    facial_loc[i * 2 + 1] = (prev_loc[i * 2 + 1] - region[1]) * y_scale;
+    shift_x += facial_loc[i * 2] - (model_->mean_shape[i * 2] - 1) * mean_scale;
+    shift_y += facial_loc[i * 2 + 1] - (model_->mean_shape[i * 2 + 1] - 1) * mean_scale;
+  }
+  shift_x /= model_->pts_num;
+  shift_y /= model_->pts_num;
+  bool is_lost = (fabs(shift_x) > max_track_shift_ * model_->lan2_resize_size ||
+    fabs(shift_y) > max_track_shift_ * model_->lan2_resize_size);
+  for (int i = 0; i < model_->pts_num; i++)
+  {
+    if (fabs(facial_loc[i * 2] - (model_->mean_shape[i * 2] - 1) * mean_scale - shift_x) > max_track_distance_ * model_->lan2_resize_size ||
+      fabs(facial_loc[i * 2 + 1] - (model_->mean_shape[i * 2 + 1] - 1) * mean_scale - shift_y) > max_track_distance_ * model_->lan2_resize_size)
+    {
+      is_lost = true;
+    }
+  }
+  if (is_lost)
   {
-    int layer_size = lan2_structure_[i] * lan2_structure_[i + 1];
-    lan2_w_[i] = new float[layer_size];
-    fread(lan2_w_[i], sizeof(float), layer_size, fp);
+    FacialPointLocate(image, face_loc, facial_loc);
+    return false;
+  }
+
+  ReserveBatch(1);
+  fea_.resize(model_->fea_dim);
+  shape_inc_.resize(shape_dim);
+  ShapeIndexedFeature(image, region, model_->lan2_resize_size, model_->lan2_resize_size,
+    facial_loc, fea_.data(), GetContext(), num_threads_);
+  RunNetwork(1, fea_.data(), 1, shape_inc_.data());
+
+  float max_update = max_track_update_ * model_->lan2_resize_size;
+  for (int i = 0; i < shape_dim; i++)
+  {
+    if (fabs(shape_inc_[i]) > max_update)
+    {
+      FacialPointLocate(image, face_loc, facial_loc);
+      return false;
+    }
+  }
 
-    lan2_b_[i] = new float[lan2_structure_[i + 1]];
-    fread(lan2_b_[i], sizeof(float), lan2_structure_[i + 1], fp);
+  /*Map the facial points back to the input image*/
+  for (int i = 0; i < model_->pts_num; i++)
+  {
+    facial_loc[i * 2] = (facial_loc[i * 2] + shape_inc_[i * 2]) / x_scale + region[0];
+    facial_loc[i * 2 + 1] = (facial_loc[i * 2 + 1] + shape_inc_[i * 2 + 1]) / y_scale + region[1];
   }
-  fclose(fp);
+  return true;
 }
 
-/** Detect five facial landmarks, i.e., two eye centers, nose tip and two mouth corners.
-  *  @param gray_im A grayscale image
+/** Set the number of networks run by FacialPointLocate and FacialPointLocateBatch.
+  *  @param stage_num 1 for the first, coarse network only, or 2 for both of them
+  */
+void CCFAN::SetStageNum(int stage_num)
+{
+  stage_num_ = (stage_num < 2 ? 1 : 2);
+}
+
+/** Set the largest move of a facial point by the second network accepted when tracking.
+  *  @param ratio The move relative to the size of the face patch of the second network
+  */
+void CCFAN::SetMaxTrackUpdate(float ratio)
+{
+  max_track_update_ = ratio;
+}
+
+/** Select the precision of the weights of both networks. The networks of a shared
+  * model are quantized once, by the first instance selecting the 8-bit weights.
+  *  @param use_int8 Whether to run the networks with weights quantized to 8 bits
+  */
+void CCFAN::SetInt8Weights(bool use_int8)
+{
+  use_int8_ = use_int8;
+  lan_int8_[0] = NULL;
+  lan_int8_[1] = NULL;
+  if (use_int8_ && model_ != NULL)
+  {
+    lan_int8_[0] = &model_->GetInt8Network(0);
+    lan_int8_[1] = &model_->GetInt8Network(1);
+    ReserveBatch(1);
+  }
+}
+
+/** Set the number of threads of the detection, each of which gets scratch buffers of
+  * its own. Both the features and the networks are computed the same way on any number
+  * of threads, only shared out differently, so that the landmarks do not change.
+  *  @param num_threads The number of threads, 1 without OpenMP
+  */
+void CCFAN::SetNumThreads(int num_threads)
+{
+#ifdef USE_OPENMP
+  num_threads_ = std::max(num_threads, 1);
+#else
+  num_threads_ = 1;
+#endif
+  SetModel(model_);
+}
+
+/** Compute the extended region of the detected face.
   *  @param im_width The width of the inpute image
   *  @param im_height The height of the inpute image
   *  @param face_loc The face bounding box
-  *  @param[out] facial_loc The locations of detected facial points
+  *  @param[out] region The left, top, width and height of the extended face region
   */
-void CCFAN::FacialPointLocate(const unsigned char *gray_im, int im_width, int im_height, seeta::FaceInfo face_loc, float *facial_loc)
+void CCFAN::GetFaceRegion(int im_width, int im_height, seeta::FaceInfo face_loc, int *region)
 {
-  int sift_patch_size = 32;
   int left_x = face_loc.bbox.x;
   int left_y = face_loc.bbox.y;
   int bbox_w = face_loc.bbox.width;
@@ -168,188 +695,494 @@ void CCFAN::FacialPointLocate(const unsigned char *gray_im, int im_width, int im
   float extend_factor = 0.05;
   float extend_revised_y = 0.05;
 
-  /*Compute the extended region of the detected face*/
   int extend_lx = std::max(int(floor(left_x - extend_factor*bbox_w)), int(0));
   int extend_rx = std::min(int(floor(right_x + extend_factor*bbox_w)), int(im_width - 1));
   int extend_ly = std::max(int(floor(left_y - (extend_factor - extend_revised_y)*bbox_h)), int(0));
   int extend_ry = std::min(int(floor(right_y + (extend_factor + extend_revised_y)*bbox_h)), int(im_height - 1));
 
-  int face_w = extend_rx - extend_lx + 1;
-  int face_h = extend_ry - extend_ly + 1;
-
-  /*Get the face image based on the extended face region*/
-  unsigned char *face_patch = new unsigned char[face_w*face_h];
-  for (int h = 0; h < face_h; h++)
-  {
-    const unsigned char *p_origin = gray_im + (h + extend_ly)*im_width + extend_lx;
-    unsigned char *p_dest = face_patch + h*face_w;
-    memcpy(p_dest, p_origin, face_w);
-  }
-
-  /*The first local stacked autoencoder network*/
-  double *fea = new double[fea_dim_];
-  int lan1_resize_w = 80;
-  int lan1_resize_h = 80;
-  BYTE *lan1_patch = new BYTE[lan1_resize_w*lan1_resize_h];
-  ResizeImage(face_patch, face_w, face_h, lan1_patch, lan1_resize_w, lan1_resize_h);
+  region[0] = extend_lx;
+  region[1] = extend_ly;
+  region[2] = extend_rx - extend_lx + 1;
+  region[3] = extend_ry - extend_ly + 1;
+}
 
-  for (int i = 0; i < pts_num_; i++)
-  {
-    facial_loc[i * 2] = mean_shape_[i * 2] - 1;
-    facial_loc[i * 2 + 1] = mean_shape_[i * 2 + 1] - 1;
-  }
+/** Extract the shape indexed SIFT features on the resized face region, as the
+  * input of a local stacked autoencoder network.
+  *  @param image The view of the input image
+  *  @param region The left, top, width and height of the extended face region
+  *  @param resize_w The width of the resized face patch
+  *  @param resize_h The height of the resized face patch
+  *  @param face_shape The locations of facial points in the resized face patch
+  *  @param[out] fea The features ordered by dimension then by facial point
+  *  @param context The scratch buffers to use
+  *  @param num_threads The number of threads extracting the SIFT features of the
+  *  facial points of the face
+  */
+void CCFAN::ShapeIndexedFeature(const seeta::ImageView &image, const int *region,
+  int resize_w, int resize_h, float *face_shape, float *fea, Context *context, int num_threads)
+{
+  BYTE *resized_patch = context->resized_patch.data();
+  float *sift_fea = context->sift_fea.data();
+  /*The face patch is resized directly from the input image*/
+  int pixel_size = (image.format == seeta::PIXEL_FORMAT_GRAY ? 1 : 3);
+  seeta::ImageView face_region(image.data + region[1] * image.stride + region[0] * pixel_size,
+    region[2], region[3], image.stride, image.format);
+  ResizeImage(face_region, resized_patch, resize_w, resize_h, context);
 
   /*Extract the shape indexed SIFT features*/
-  TtSift(lan1_patch, lan1_resize_w, lan1_resize_h, facial_loc, 32, fea);
+  TtSift(resized_patch, resize_w, resize_h, face_shape, model_->sift_patch_size, sift_fea, context, num_threads);
 
-  float *re_fea = new float[fea_dim_];
   for (int i = 0; i < 128; i++)
   {
-    for (int j = 0; j < pts_num_; j++)
+    for (int j = 0; j < model_->pts_num; j++)
     {
-      if (std::isnan(fea[j * 128 + i]))
+      if (std::isnan(sift_fea[j * 128 + i]))
       {
-        re_fea[i*pts_num_ + j] = 0;
+        fea[i*model_->pts_num + j] = 0;
       }
       else
       {
-        re_fea[i*pts_num_ + j] = fea[j * 128 + i];
+        fea[i*model_->pts_num + j] = sift_fea[j * 128 + i];
       }
     }
   }
+}
 
-  float ** lan1_a = new float *[lan1_size_];
-
-  for (int i = 0; i < lan1_size_; i++)
-  {
-    lan1_a[i] = new float[lan1_structure_[i]];
-  }
+#if defined(USE_AVX2)
+/*8-lane vectors of AVX2 and FMA*/
+typedef __m256 VecF;
+typedef __m256i VecI;
+static const int kVecLen = 8;
+static inline VecF VecZero() { return _mm256_setzero_ps(); }
+static inline VecF VecSet(float x) { return _mm256_set1_ps(x); }
+static inline VecF VecLoad(const float *p) { return _mm256_loadu_ps(p); }
+static inline void VecStore(float *p, VecF x) { _mm256_storeu_ps(p, x); }
+static inline VecF VecAdd(VecF x, VecF y) { return _mm256_add_ps(x, y); }
+static inline VecF VecMul(VecF x, VecF y) { return _mm256_mul_ps(x, y); }
+static inline VecF VecDiv(VecF x, VecF y) { return _mm256_div_ps(x, y); }
+static inline VecF VecMulAdd(VecF x, VecF y, VecF z) { return _mm256_fmadd_ps(x, y, z); }
+static inline VecF VecMin(VecF x, VecF y) { return _mm256_min_ps(x, y); }
+static inline VecF VecMax(VecF x, VecF y) { return _mm256_max_ps(x, y); }
+static inline VecF VecRound(VecF x) { return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline VecF VecPow2(VecF n)
+{
+  VecI e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+}
+static inline float VecSum(VecF x)
+{
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+#define CFAN_USE_VEC
+#elif defined(USE_SSE)
+/*4-lane vectors of SSE4.1*/
+typedef __m128 VecF;
+typedef __m128i VecI;
+static const int kVecLen = 4;
+static inline VecF VecZero() { return _mm_setzero_ps(); }
+static inline VecF VecSet(float x) { return _mm_set1_ps(x); }
+static inline VecF VecLoad(const float *p) { return _mm_loadu_ps(p); }
+static inline void VecStore(float *p, VecF x) { _mm_storeu_ps(p, x); }
+static inline VecF VecAdd(VecF x, VecF y) { return _mm_add_ps(x, y); }
+static inline VecF VecMul(VecF x, VecF y) { return _mm_mul_ps(x, y); }
+static inline VecF VecDiv(VecF x, VecF y) { return _mm_div_ps(x, y); }
+static inline VecF VecMulAdd(VecF x, VecF y, VecF z) { return _mm_add_ps(_mm_mul_ps(x, y), z); }
+static inline VecF VecMin(VecF x, VecF y) { return _mm_min_ps(x, y); }
+static inline VecF VecMax(VecF x, VecF y) { return _mm_max_ps(x, y); }
+static inline VecF VecRound(VecF x) { return _mm_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline VecF VecPow2(VecF n)
+{
+  VecI e = _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+  return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+}
+static inline float VecSum(VecF x)
+{
+  __m128 s = _mm_add_ps(x, _mm_movehl_ps(x, x));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+#define CFAN_USE_VEC
+#endif
 
-  for (int i = 0; i < fea_dim_; i++)
+/** Dot products of kRows rows of weights with the activations of kFaceNum faces,
+  * vectorized along the input dimension. Each of them is reduced in the same order
+  * whatever the blocking, so that a face gets the same result alone or in a batch.
+  *  @param w The rows of weights, one after another
+  *  @param a The activations of the faces, one after another
+  *  @param fea_dim The input dimension
+  *  @param[out] dot The dot products, row by row then face by face
+  */
+template <int kRows, int kFaceNum>
+static void DotProducts(const float *w, const float *a, int fea_dim, float *dot)
+{
+  int k = 0;
+#ifdef CFAN_USE_VEC
+  VecF sum[kRows][kFaceNum];
+  for (int r = 0; r < kRows; r++)
   {
-    lan1_a[0][i] = re_fea[i];
+    for (int f = 0; f < kFaceNum; f++)
+    {
+      sum[r][f] = VecZero();
+    }
   }
-
-  for (int i = 0; i < lan1_size_ - 1; i++)
+  for (; k + kVecLen <= fea_dim; k += kVecLen)
   {
-    for (int j = 0; j < lan1_structure_[i + 1]; j++)
+    for (int f = 0; f < kFaceNum; f++)
     {
-      float inner_product = 0;
-      int fea_dim = lan1_structure_[i];
-      for (int k = 0; k < fea_dim; k++)
-      {
-        inner_product = inner_product + lan1_a[i][k] * lan1_w_[i][j*fea_dim + k];
-      }
-      if (i == lan1_size_ - 2)
+      VecF x = VecLoad(a + f*fea_dim + k);
+      for (int r = 0; r < kRows; r++)
       {
-        lan1_a[i + 1][j] = inner_product + lan1_b_[i][j];
+        sum[r][f] = VecMulAdd(VecLoad(w + r*fea_dim + k), x, sum[r][f]);
       }
-      else
-      {
-        lan1_a[i + 1][j] = 1.0 / (1 + exp(-inner_product - lan1_b_[i][j]));
-      }
-
     }
   }
-  for (int i = 0; i < pts_num_ * 2; i++)
+  for (int r = 0; r < kRows; r++)
   {
-    facial_loc[i] = facial_loc[i] + lan1_a[lan1_size_ - 1][i];
+    for (int f = 0; f < kFaceNum; f++)
+    {
+      dot[r*kFaceNum + f] = VecSum(sum[r][f]);
+    }
   }
-  for (int i = 0; i < lan1_size_; i++)
+#else
+  for (int i = 0; i < kRows * kFaceNum; i++)
   {
-    delete[](lan1_a[i]);
+    dot[i] = 0;
   }
-  delete[]lan1_a;
-  delete[]lan1_patch;
-
-  /*The second local stacked autoencoder network*/
-  int lan2_resize_w = 140;
-  int lan2_resize_h = 140;
-  BYTE *lan2_patch = new BYTE[lan2_resize_w*lan2_resize_h];
-  ResizeImage(face_patch, face_w, face_h, lan2_patch, lan2_resize_w, lan2_resize_h);
+#endif
+  for (; k < fea_dim; k++)
+  {
+    for (int r = 0; r < kRows; r++)
+    {
+      for (int f = 0; f < kFaceNum; f++)
+      {
+        dot[r*kFaceNum + f] += w[r*fea_dim + k] * a[f*fea_dim + k];
+      }
+    }
+  }
+}
 
-  float x_scale = float(lan1_resize_w) / lan2_resize_w;
-  float y_scale = float(lan1_resize_h) / lan2_resize_h;
+#ifdef CFAN_USE_VEC
+/** Compute the sigmoid function 1 / (1 + exp(-x)). The exp is the polynomial
+  * approximation of the Cephes library on the clamped range [-87, 88], which keeps
+  * the sigmoid within 2e-7 relative error for x > -87 and below 1e-38 otherwise.
+  *  @param x The values
+  */
+static inline VecF VecSigmoid(VecF x)
+{
+  const VecF one = VecSet(1.0f);
+  VecF t = VecMax(VecMin(VecMul(x, VecSet(-1.0f)), VecSet(88.0f)), VecSet(-87.0f));
+  /*exp(t) = 2^n * exp(r), with n = round(t / ln2) and |r| <= ln2 / 2*/
+  VecF n = VecRound(VecMul(t, VecSet(1.44269504088896341f)));
+  VecF r = VecMulAdd(n, VecSet(-0.693359375f), t);
+  r = VecMulAdd(n, VecSet(2.12194440e-4f), r);
+  VecF y = VecSet(1.9875691500e-4f);
+  y = VecMulAdd(y, r, VecSet(1.3981999507e-3f));
+  y = VecMulAdd(y, r, VecSet(8.3334519073e-3f));
+  y = VecMulAdd(y, r, VecSet(4.1665795894e-2f));
+  y = VecMulAdd(y, r, VecSet(1.6666665459e-1f));
+  y = VecMulAdd(y, r, VecSet(5.0000001201e-1f));
+  y = VecAdd(VecMulAdd(y, VecMul(r, r), r), one);
+  y = VecMul(y, VecPow2(n));
+  return VecDiv(one, VecAdd(one, y));
+}
+#endif
 
-  for (int i = 0; i < pts_num_; i++)
+/** Apply the sigmoid function 1 / (1 + exp(-x)) in place. With vectorization, the
+  * values left over by the vectors go through VecSigmoid() too, padded to a full
+  * vector, so that every value gets the same result whatever its position.
+  *  @param x The values
+  *  @param len The number of values
+  */
+static void Sigmoid(float *x, int len)
+{
+  int i = 0;
+#ifdef CFAN_USE_VEC
+  for (; i + kVecLen <= len; i += kVecLen)
   {
-    facial_loc[i * 2] = (facial_loc[i * 2]) / x_scale;
-    facial_loc[i * 2 + 1] = (facial_loc[i * 2 + 1]) / y_scale;
+    VecStore(x + i, VecSigmoid(VecLoad(x + i)));
   }
-  /*Extract the shape indexed SIFT features*/
-  TtSift(lan2_patch, lan2_resize_w, lan2_resize_h, facial_loc, 32, fea);
+  if (i < len)
+  {
+    float tail[kVecLen] = {0};
+    memcpy(tail, x + i, (len - i) * sizeof(float));
+    VecStore(tail, VecSigmoid(VecLoad(tail)));
+    memcpy(x + i, tail, (len - i) * sizeof(float));
+  }
+#else
+  for (; i < len; i++)
+  {
+    x[i] = 1.0 / (1 + exp(-x[i]));
+  }
+#endif
+}
 
-  for (int i = 0; i < 128; i++)
+/** Compute one fully connected layer, y = w * x + b, on a batch of faces. The output
+  * units are split over the threads, in blocks of kRowBlock rows of weights whose
+  * loads are shared by kFaceBlock faces, or by the kRowBlock rows for a single face.
+  *  @param w The weights, out_dim rows of fea_dim
+  *  @param b The biases
+  *  @param fea_dim The input dimension
+  *  @param out_dim The output dimension
+  *  @param input The input activations, face by face
+  *  @param face_num The number of faces
+  *  @param is_output Whether it is the output layer, which is linear
+  *  @param[out] output The output activations, face by face
+  */
+void CCFAN::ForwardLayer(const float *w, const float *b, int fea_dim, int out_dim,
+  const float *input, int face_num, bool is_output, float *output)
+{
+  const int kRowBlock = 4;
+  const int kFaceBlock = 8;
+  int row_blocks = (out_dim + kRowBlock - 1) / kRowBlock;
+
+#pragma omp parallel num_threads(num_threads_)
   {
-    for (int j = 0; j < pts_num_; j++)
+    float dot[kRowBlock * kFaceBlock];
+#pragma omp for nowait
+    for (int jb = 0; jb < row_blocks; jb++)
     {
-      if (isnan(fea[j * 128 + i]))
+      int j_begin = jb * kRowBlock;
+      int j_end = std::min(j_begin + kRowBlock, out_dim);
+      int f = 0;
+      for (; f + kFaceBlock <= face_num; f += kFaceBlock)
       {
-        re_fea[i*pts_num_ + j] = 0;
+        for (int j = j_begin; j < j_end; j++)
+        {
+          DotProducts<1, kFaceBlock>(w + j*fea_dim, input + f*fea_dim, fea_dim, dot);
+          for (int n = 0; n < kFaceBlock; n++)
+          {
+            output[(f + n)*out_dim + j] = dot[n] + b[j];
+          }
+        }
       }
-      else
+      for (; f < face_num; f++)
       {
-        re_fea[i*pts_num_ + j] = fea[j * 128 + i];
+        if (j_end - j_begin == kRowBlock)
+        {
+          DotProducts<kRowBlock, 1>(w + j_begin*fea_dim, input + f*fea_dim, fea_dim, dot);
+        }
+        else
+        {
+          for (int j = j_begin; j < j_end; j++)
+          {
+            DotProducts<1, 1>(w + j*fea_dim, input + f*fea_dim, fea_dim, dot + j - j_begin);
+          }
+        }
+        for (int j = j_begin; j < j_end; j++)
+        {
+          output[f*out_dim + j] = dot[j - j_begin] + b[j];
+        }
       }
     }
   }
 
-  float ** lan2_a = new float *[lan2_size_];
+  if (!is_output)
+  {
+    Sigmoid(output, face_num * out_dim);
+  }
+}
 
-  for (int i = 0; i < lan2_size_; i++)
+/** Run a local stacked autoencoder network on a batch of faces.
+  *  @param w The weights of each layer
+  *  @param b The biases of each layer
+  *  @param structure The number of units of each layer
+  *  @param size The number of layers
+  *  @param input The input features, face by face
+  *  @param face_num The number of faces
+  *  @param[out] output The outputs of the network, face by face
+  *  @param int8_layers The hidden layers quantized to 8 bits, which replace the
+  *  float ones, or NULL
+  */
+void CCFAN::ForwardNetwork(const float *const *w, const float *const *b, const int *structure, int size,
+  const float *input, int face_num, float *output, const CFANModel::Int8Network *int8_layers)
+{
+  std::vector<float> &a = lan_a_;
+  std::vector<float> &a_next = lan_a_next_;
+  a.assign(input, input + face_num * structure[0]);
+
+  for (int i = 0; i < size - 1; i++)
   {
-    lan2_a[i] = new float[lan2_structure_[i]];
+    a_next.resize(face_num * structure[i + 1]);
+    if (int8_layers != NULL && i < int(int8_layers->size()))
+    {
+      ForwardLayerInt8((*int8_layers)[i], a.data(), face_num, a_next.data());
+    }
+    else
+    {
+      ForwardLayer(w[i], b[i], structure[i], structure[i + 1], a.data(), face_num,
+        i == size - 2, a_next.data());
+    }
+    a.swap(a_next);
   }
+  memcpy(output, a.data(), face_num * structure[size - 1] * sizeof(float));
+}
 
-  for (int i = 0; i < fea_dim_; i++)
+/** Run the first or the second network on a batch of faces, with the float or the
+  * 8-bit weights as selected by SetInt8Weights.
+  *  @param stage 0 for the first network, 1 for the second one
+  *  @param input The input features, face by face
+  *  @param face_num The number of faces
+  *  @param[out] output The outputs of the network, face by face
+  */
+void CCFAN::RunNetwork(int stage, const float *input, int face_num, float *output)
+{
+  if (stage == 0)
+  {
+    ForwardNetwork(model_->lan1_w, model_->lan1_b, model_->lan1_structure, model_->lan1_size, input, face_num, output,
+      lan_int8_[0]);
+  }
+  else
   {
-    lan2_a[0][i] = re_fea[i];
+    ForwardNetwork(model_->lan2_w, model_->lan2_b, model_->lan2_structure, model_->lan2_size, input, face_num, output,
+      lan_int8_[1]);
   }
+}
 
-  for (int i = 0; i < lan2_size_ - 1; i++)
+/** Dot products of kRows rows of 8-bit weights with the 7-bit activations of one face.
+  * The SIMD instructions multiply the unsigned activations by the signed weights and
+  * add the products in pairs with saturation to 16 bits, which never saturates as
+  * 2 * 127 * 127 < 32768, then sum the pairs in 32 bits. The scalar code does the same,
+  * so that every build gets the same integers.
+  *  @param w The rows of weights, one after another
+  *  @param a The activations
+  *  @param row_len The length of a row, a multiple of kInt8RowAlign
+  *  @param[out] dot The dot products, row by row
+  */
+template <int kRows>
+static void DotProductsInt8(const int8_t *w, const uint8_t *a, int row_len, int *dot)
+{
+#if defined(USE_AVX2)
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i sum[kRows];
+  for (int r = 0; r < kRows; r++)
+  {
+    sum[r] = _mm256_setzero_si256();
+  }
+  for (int k = 0; k < row_len; k += 32)
   {
-    for (int j = 0; j < lan2_structure_[i + 1]; j++)
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + k));
+    for (int r = 0; r < kRows; r++)
     {
-      float inner_product = 0;
-      int fea_dim = lan2_structure_[i];
-      for (int k = 0; k < fea_dim; k++)
-      {
-        inner_product = inner_product + lan2_a[i][k] * lan2_w_[i][j*fea_dim + k];
-      }
-      if (i == lan2_size_ - 2)
-      {
-        lan2_a[i + 1][j] = inner_product + lan2_b_[i][j];
-      }
-      else
-      {
-        lan2_a[i + 1][j] = 1.0 / (1 + exp(-inner_product - lan2_b_[i][j]));
-      }
-
+      __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + r*row_len + k));
+      sum[r] = _mm256_add_epi32(sum[r], _mm256_madd_epi16(_mm256_maddubs_epi16(x, y), ones));
     }
   }
-  for (int i = 0; i < pts_num_ * 2; i++)
+  for (int r = 0; r < kRows; r++)
   {
-    facial_loc[i] = facial_loc[i] + lan2_a[lan2_size_ - 1][i];
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum[r]), _mm256_extracti128_si256(sum[r], 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    dot[r] = _mm_cvtsi128_si32(s);
   }
-  for (int i = 0; i < lan2_size_; i++)
+#elif defined(USE_SSE)
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i sum[kRows];
+  for (int r = 0; r < kRows; r++)
   {
-    delete[](lan2_a[i]);
+    sum[r] = _mm_setzero_si128();
   }
-  delete[]lan2_a;
-  delete[]lan2_patch;
-
-  delete[]fea;
-  delete[]re_fea;
-  delete[]face_patch;
+  for (int k = 0; k < row_len; k += 16)
+  {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + k));
+    for (int r = 0; r < kRows; r++)
+    {
+      __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + r*row_len + k));
+      sum[r] = _mm_add_epi32(sum[r], _mm_madd_epi16(_mm_maddubs_epi16(x, y), ones));
+    }
+  }
+  for (int r = 0; r < kRows; r++)
+  {
+    __m128i s = _mm_add_epi32(sum[r], _mm_shuffle_epi32(sum[r], _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    dot[r] = _mm_cvtsi128_si32(s);
+  }
+#else
+  for (int r = 0; r < kRows; r++)
+  {
+    int sum = 0;
+    for (int k = 0; k < row_len; k += 2)
+    {
+      int pair = a[k] * w[r*row_len + k] + a[k + 1] * w[r*row_len + k + 1];
+      sum += std::max(-32768, std::min(32767, pair));
+    }
+    dot[r] = sum;
+  }
+#endif
+}
 
-  x_scale = float(lan2_resize_w) / face_w;
-  y_scale = float(lan2_resize_h) / face_h;
+/** Compute one hidden layer with 8-bit weights, followed by the sigmoid. The
+  * activations of each face are quantized to 7 bits with a scale of their own,
+  * mapping the largest of them to 127, and y = w_scale * a_scale * (q_w * q_a) + b.
+  * The activations are the SIFT features or the outputs of a sigmoid, hence never
+  * negative.
+  *  @param layer The quantized layer
+  *  @param input The input activations, face by face, which are not negative
+  *  @param face_num The number of faces
+  *  @param[out] output The output activations, face by face
+  */
+void CCFAN::ForwardLayerInt8(const CFANModel::Int8Layer &layer, const float *input, int face_num, float *output)
+{
+  const int kRowBlock = 4;
+  int fea_dim = layer.fea_dim;
+  int out_dim = layer.out_dim;
+  int row_len = layer.row_len;
+  lan_q_.assign(face_num * row_len, 0);
+  lan_q_scale_.resize(face_num);
+  for (int f = 0; f < face_num; f++)
+  {
+    const float *a = input + f*fea_dim;
+    uint8_t *q = &lan_q_[f*row_len];
+    float max_a = 0;
+    for (int k = 0; k < fea_dim; k++)
+    {
+      max_a = std::max(max_a, a[k]);
+    }
+    lan_q_scale_[f] = max_a / 127;
+    if (max_a == 0)
+      continue;
+    float inv_scale = 127 / max_a;
+    for (int k = 0; k < fea_dim; k++)
+    {
+      q[k] = uint8_t(std::min(127, std::max(0, int(a[k] * inv_scale + 0.5f))));
+    }
+  }
 
-  for (int i = 0; i < pts_num_; i++)
+  int row_blocks = (out_dim + kRowBlock - 1) / kRowBlock;
+#pragma omp parallel num_threads(num_threads_)
   {
-    facial_loc[i * 2] = (facial_loc[i * 2]) / x_scale + extend_lx;
-    facial_loc[i * 2 + 1] = (facial_loc[i * 2 + 1]) / y_scale + extend_ly;
+    int dot[kRowBlock];
+#pragma omp for nowait
+    for (int jb = 0; jb < row_blocks; jb++)
+    {
+      int j_begin = jb * kRowBlock;
+      int j_end = std::min(j_begin + kRowBlock, out_dim);
+      const int8_t *w = &layer.w[size_t(j_begin) * row_len];
+      for (int f = 0; f < face_num; f++)
+      {
+        const uint8_t *q = &lan_q_[f*row_len];
+        if (j_end - j_begin == kRowBlock)
+        {
+          DotProductsInt8<kRowBlock>(w, q, row_len, dot);
+        }
+        else
+        {
+          for (int j = j_begin; j < j_end; j++)
+          {
+            DotProductsInt8<1>(w + (j - j_begin)*row_len, q, row_len, dot + j - j_begin);
+          }
+        }
+        for (int j = j_begin; j < j_end; j++)
+        {
+          output[f*out_dim + j] = dot[j - j_begin] * (layer.w_scale[j] * lan_q_scale_[f]) + layer.b[j];
+        }
+      }
+    }
   }
+
+  Sigmoid(output, face_num * out_dim);
 }
 
 /** Extract shape indexed SIFT features.
@@ -359,26 +1192,51 @@ void CCFAN::FacialPointLocate(const unsigned char *gray_im, int im_width, int im
   *  @param face_shape The locations of facial points
   *  @param patch_size The size of the patch used for extracting SIFT feature
   *  @param[out] sift_fea the extracted shape indexed SIFT features which are concatenated into a vector
+  *  @param context The scratch buffers to use
+  *  @param num_threads The number of threads extracting the features of the patches
+  *  near the face, which use the SIFT workspaces of all the contexts if more than one
   */
-void CCFAN::TtSift(const unsigned char *gray_im, int im_width, int im_height, float *face_shape, int patch_size, double *sift_fea)
+void CCFAN::TtSift(const unsigned char *gray_im, int im_width, int im_height, float *face_shape, int patch_size, float *sift_fea,
+  Context *context, int num_threads)
 {
-  unsigned char *sub_img = new unsigned char[patch_size*patch_size];
-  SIFT* sift_extractor = new SIFT();
-  sift_extractor->InitSIFT(patch_size, patch_size, 32, 16);
-  double *one_sift_fea = new double[128];
-  double *fea_header = sift_fea;
+  unsigned char *sub_img = context->sub_img.data();
+  float *fea_header = sift_fea;
+  int *window_left = context->window_left.data();
+  int *window_top = context->window_top.data();
+  int *window_point = context->window_point.data();
+  int window_num = 0;
 
-  for (int i = 0; i < pts_num_; i++)
+  for (int i = 0; i < model_->pts_num; i++)
   {
-    /*Get one image patch*/
-    GetSubImg(gray_im, im_width, im_height, face_shape[i * 2], face_shape[i * 2 + 1], patch_size, sub_img);
+    float point_x = face_shape[i * 2];
+    float point_y = face_shape[i * 2 + 1];
+    if (point_x >= -patch_size && point_x < im_width + patch_size &&
+      point_y >= -patch_size && point_y < im_height + patch_size)
+    {
+      /*The patch of GetSubImg, whose SIFT feature is extracted with the others below*/
+      window_left[window_num] = int(floor(point_x + 0.5)) + 1 - patch_size / 2;
+      window_top[window_num] = int(floor(point_y + 0.5)) + 1 - patch_size / 2;
+      window_point[window_num] = i;
+      window_num++;
+      continue;
+    }
+    /*Get one image patch far from the face*/
+    GetSubImg(gray_im, im_width, im_height, point_x, point_y, patch_size, sub_img);
     /*Extract  one SIFT feature of one image patch*/
-    sift_extractor->CalcSIFT(sub_img, one_sift_fea);
-    memcpy(fea_header + i * 128, one_sift_fea, 128 * 8);
+    model_->sift_extractor.CalcSIFT(sub_img, fea_header + i * 128, &context->sift_workspace);
+  }
+
+  /*The patches near the face share the gradients and the orientations where they overlap,
+    the pixels outside of the face patch being 128 as in GetSubImg. On several threads,
+    the workspace of the first context holds the shared maps*/
+  float *window_fea = context->window_fea.data();
+  SIFT::Workspace *sift_workspace = &context->sift_workspace;
+  model_->sift_extractor.CalcSIFTWindows(gray_im, im_width, im_height, window_left, window_top, window_num, 128,
+    window_fea, (num_threads > 1 ? sift_workspaces_.data() : &sift_workspace), num_threads);
+  for (int k = 0; k < window_num; k++)
+  {
+    memcpy(fea_header + window_point[k] * 128, window_fea + k * 128, 128 * sizeof(float));
   }
-  delete[]one_sift_fea;
-  delete[]sub_img;
-  delete sift_extractor;
 }
 
 /** Extract a image patch which is centered at point(point_x, point_y) with a given patch size.
@@ -414,49 +1272,142 @@ void CCFAN::GetSubImg(const unsigned char *gray_im, int im_width, int im_height,
   }
 }
 
-/** Resize the image by bilinear interpolation.
-  *  @param src_im A source image in grayscale
-  *  @param src_width The width of the source image
-  *  @param src_height The height of the source image
+/*The number of fractional bits of the interpolation weights of ResizeImage*/
+static const int kResizeBits = 11;
+
+/** Compute the source coordinates and the fixed-point weights of bilinear resizing along
+  * one axis. The coordinate is clamped so that its right neighbor exists, which extrapolates
+  * the last source pixels when enlarging, as the former floating-point resizing did.
+  *  @param src_len The source length
+  *  @param dst_len The target length
+  *  @param[out] ofs The source coordinates
+  *  @param[out] weight The weights of the right neighbors
+  */
+static void ResizeTable(int src_len, int dst_len, int *ofs, int *weight)
+{
+  double scale = double(src_len + 0.0) / dst_len;
+  for (int d = 0; d < dst_len; d++)
+  {
+    double s = scale * d;
+    int n = int(s);
+    n = (n <= (src_len - 2) ? n : (src_len - 2));
+    n = (n >= 0 ? n : 0);
+    ofs[d] = n;
+    weight[d] = int(floor((s - n) * (1 << kResizeBits) + 0.5));
+  }
+}
+
+/** Convert a colour pixel to its gray level with the weights of ITU-R BT.601 in 14-bit
+  * fixed point, which are those of cvtColor of OpenCV, so that the landmarks are the
+  * same as on an image converted by the caller.
+  *  @param p The pixel, three bytes
+  *  @param is_rgb Whether the bytes are red, green and blue rather than blue, green and red
+  *  @return The gray level
+  */
+static inline unsigned char ColorToGray(const unsigned char *p, bool is_rgb)
+{
+  const int kWeightR = 4899;
+  const int kWeightG = 9617;
+  const int kWeightB = 1868;
+  int r = (is_rgb ? p[0] : p[2]);
+  int b = (is_rgb ? p[2] : p[0]);
+  return (unsigned char)((r * kWeightR + p[1] * kWeightG + b * kWeightB + (1 << 13)) >> 14);
+}
+
+/** Convert the pairs of neighbor pixels read by ResizeImage on one row of a colour image.
+  *  @param src The row of pixels, three bytes each
+  *  @param x_ofs The left pixel of each pair
+  *  @param num The number of pairs
+  *  @param is_rgb Whether the bytes are red, green and blue rather than blue, green and red
+  *  @param[out] gray The gray levels of the pairs, one after another
+  */
+static void ColorPairsToGray(const unsigned char *src, const int *x_ofs, int num, bool is_rgb, unsigned char *gray)
+{
+  for (int i = 0; i < num; i++)
+  {
+    gray[i * 2] = ColorToGray(src + x_ofs[i] * 3, is_rgb);
+    gray[i * 2 + 1] = ColorToGray(src + x_ofs[i] * 3 + 3, is_rgb);
+  }
+}
+
+/** Resize the image by bilinear interpolation in fixed point, reading the source
+  * image in place through tables of source coordinates. Colour pixels are converted
+  * to gray levels where they are read, i.e. only the neighbors of the resized pixels,
+  * which are copied in pairs for each row.
+  *  @param src The view of the source image, in gray levels or colour
   *  @param[out] dst_im The target image in grayscale
   *  @param dst_width The width of the target image
   *  @param dst_height The height of the target image
+  *  @param context The scratch buffers holding the coordinate tables
   */
-bool CCFAN::ResizeImage(const unsigned char *src_im, int src_width, int src_height,
-  unsigned char* dst_im, int dst_width, int dst_height)
+bool CCFAN::ResizeImage(const seeta::ImageView &src, unsigned char* dst_im, int dst_width, int dst_height,
+  Context *context)
 {
+  const unsigned char *src_im = src.data;
+  int src_width = src.width;
+  int src_height = src.height;
+  int src_stride = src.stride;
+  bool is_color = (src.format != seeta::PIXEL_FORMAT_GRAY);
+  bool is_rgb = (src.format == seeta::PIXEL_FORMAT_RGB);
 
-  double	lfx_scl, lfy_scl;
   if (src_width == dst_width && src_height == dst_height) {
-    memcpy(dst_im, src_im, src_width * src_height * sizeof(unsigned char));
+    for (int h = 0; h < src_height; h++) {
+      const unsigned char *src_row = src_im + h * src_stride;
+      unsigned char *dst_row = dst_im + h * dst_width;
+      if (!is_color) {
+        memcpy(dst_row, src_row, src_width * sizeof(unsigned char));
+        continue;
+      }
+      for (int w = 0; w < src_width; w++)
+        dst_row[w] = ColorToGray(src_row + w * 3, is_rgb);
+    }
     return true;
   }
 
-  lfx_scl = double(src_width + 0.0) / dst_width;
-  lfy_scl = double(src_height + 0.0) / dst_height;
+  int *x_ofs = context->resize_x_ofs.data();
+  int *x_weight = context->resize_x_weight.data();
+  int *y_ofs = context->resize_y_ofs.data();
+  int *y_weight = context->resize_y_weight.data();
+  ResizeTable(src_width, dst_width, x_ofs, x_weight);
+  ResizeTable(src_height, dst_height, y_ofs, y_weight);
 
-  for (int n_y_d = 0; n_y_d < dst_height; n_y_d++) {
-    for (int n_x_d = 0; n_x_d < dst_width; n_x_d++) {
-      double lf_x_s = lfx_scl * n_x_d;
-      double lf_y_s = lfy_scl * n_y_d;
-
-      int n_x_s = int(lf_x_s);
-      n_x_s = (n_x_s <= (src_width - 2) ? n_x_s : (src_width - 2));
-      int n_y_s = int(lf_y_s);
-      n_y_s = (n_y_s <= (src_height - 2) ? n_y_s : (src_height - 2));
+  /*The gray levels of a colour image are read from the pairs converted for each
+    source row, the left pixel of the n-th pair being at 2 * n*/
+  const int *col_ofs = x_ofs;
+  int converted_row = -1;
+  if (is_color) {
+    int *pair_ofs = context->resize_pair_ofs.data();
+    for (int n_x_d = 0; n_x_d < dst_width; n_x_d++)
+      pair_ofs[n_x_d] = n_x_d * 2;
+    col_ofs = pair_ofs;
+  }
 
-      double lf_weight_x = lf_x_s - n_x_s;
-      double lf_weight_y = lf_y_s - n_y_s;
+  const int one = 1 << kResizeBits;
+  for (int n_y_d = 0; n_y_d < dst_height; n_y_d++) {
+    const unsigned char *top = src_im + y_ofs[n_y_d] * src_stride;
+    const unsigned char *bottom = top + src_stride;
+    if (is_color) {
+      if (y_ofs[n_y_d] != converted_row) {
+        ColorPairsToGray(top, x_ofs, dst_width, is_rgb, context->resize_top.data());
+        ColorPairsToGray(bottom, x_ofs, dst_width, is_rgb, context->resize_bottom.data());
+        converted_row = y_ofs[n_y_d];
+      }
+      top = context->resize_top.data();
+      bottom = context->resize_bottom.data();
+    }
+    int weight_y = y_weight[n_y_d];
+    unsigned char *dst = dst_im + n_y_d * dst_width;
 
-      double lf_new_gray = (1 - lf_weight_y) * ((1 - lf_weight_x) * src_im[n_y_s * src_width + n_x_s] +
-        lf_weight_x * src_im[n_y_s * src_width + n_x_s + 1]) +
-        lf_weight_y * ((1 - lf_weight_x) * src_im[(n_y_s + 1) * src_width + n_x_s] +
-        lf_weight_x * src_im[(n_y_s + 1) * src_width + n_x_s + 1]);
+    for (int n_x_d = 0; n_x_d < dst_width; n_x_d++) {
+      int n_x_s = col_ofs[n_x_d];
+      int weight_x = x_weight[n_x_d];
+      int top_val = (one - weight_x) * top[n_x_s] + weight_x * top[n_x_s + 1];
+      int bottom_val = (one - weight_x) * bottom[n_x_s] + weight_x * bottom[n_x_s + 1];
 
-      dst_im[n_y_d * dst_width + n_x_d] = (unsigned char)(lf_new_gray);
+      /*64 bits, as the weights exceed one when extrapolating*/
+      long long new_gray = ((long long)(one - weight_y) * top_val + (long long)weight_y * bottom_val) >> (2 * kResizeBits);
+      dst[n_x_d] = (unsigned char)(new_gray < 0 ? 0 : (new_gray > 255 ? 255 : new_gray));
     }
   }
   return true;
 }
-
-
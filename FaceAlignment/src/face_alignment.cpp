@@ -36,43 +36,215 @@
 #include "cfan.h"
 
 namespace seeta {
+  /** Get the view of an image given as ImageData, whose rows are packed.
+   *  @param im A grayscale image, or a BGR one if it has 3 channels
+   *  @param[out] view The view of the image
+   *  @return false if the image has neither 1 nor 3 channels
+   */
+  static bool ToImageView(const ImageData &im, ImageView *view) {
+    if (im.num_channels != 1 && im.num_channels != 3)
+      return false;
+    *view = ImageView(im.data, im.width, im.height, im.width * im.num_channels,
+      im.num_channels == 3 ? PIXEL_FORMAT_BGR : PIXEL_FORMAT_GRAY);
+    return true;
+  }
+
+  /** Whether a view points to an image whose rows hold its pixels. */
+  static bool IsValidView(const ImageView &image) {
+    int pixel_size = (image.format == PIXEL_FORMAT_GRAY ? 1 : 3);
+    return image.data != NULL && image.width > 0 && image.height > 0 &&
+      image.stride >= image.width * pixel_size;
+  }
+  /** A constructor loading the model file.
+   *  @param model_path Path of the model file, either absolute or relative to
+   *  the working directory.
+   */
+  FaceAlignmentModel::FaceAlignmentModel(const char * model_path) {
+    if (model_path == NULL)
+      model_path = "seeta_fa_v1.1.bin";
+    std::shared_ptr<CFANModel> model = std::make_shared<CFANModel>();
+    if (model->InitModel(model_path))
+      model_ = model;
+  }
+
+  FaceAlignmentModel::~FaceAlignmentModel() {
+  }
+
+  /** Whether the model file was found and well formed. */
+  bool FaceAlignmentModel::IsLoaded() const {
+    return model_ != NULL;
+  }
+
   /** A constructor with an optional argument specifying path of the model file.
    *  If called with no argument, the model file is assumed to be stored in the
    *  the working directory as "seeta_fa_v1.1.bin".
    *
    *  @param model_path Path of the model file, either absolute or relative to
    *  the working directory.
+   *  @param precision The precision of the weights of the networks
    */
-  FaceAlignment::FaceAlignment(const char * model_path){
+  FaceAlignment::FaceAlignment(const char * model_path, AlignmentPrecision precision){
     facial_detector = new CCFAN();
+    facial_detector->SetInt8Weights(precision == ALIGNMENT_INT8);
     if (model_path == NULL)
       model_path = "seeta_fa_v1.1.bin";
     facial_detector->InitModel(model_path);
   }
 
+  /** A constructor sharing the parameters of a loaded model.
+   *  @param model The loaded model
+   *  @param precision The precision of the weights of the networks
+   */
+  FaceAlignment::FaceAlignment(const FaceAlignmentModel &model, AlignmentPrecision precision) {
+    facial_detector = new CCFAN();
+    facial_detector->SetInt8Weights(precision == ALIGNMENT_INT8);
+    facial_detector->SetModel(model.model_);
+  }
+
+  /** Whether the model is loaded, without which no landmark is detected. */
+  bool FaceAlignment::IsLoaded() const {
+    return facial_detector->IsLoaded();
+  }
+
   /** Detect five facial landmarks, i.e., two eye centers, nose tip and two mouth corners.
-   *  @param gray_im A grayscale image
+   *  @param gray_im A grayscale image, or a BGR one if it has 3 channels
    *  @param face_info The face bounding box
    *  @param[out] points The locations of detected facial points
    */
   bool FaceAlignment::PointDetectLandmarks(ImageData gray_im, FaceInfo face_info, FacialLandmark *points)
   {
-    if (gray_im.num_channels != 1) {
+    ImageView image;
+    return ToImageView(gray_im, &image) && PointDetectLandmarks(image, face_info, points);
+  }
+
+  /** Detect five facial landmarks on a view of an image.
+   *  @param image The view of a grayscale, BGR or RGB image
+   *  @param face_info The face bounding box
+   *  @param[out] points The locations of detected facial points
+   */
+  bool FaceAlignment::PointDetectLandmarks(const ImageView &image, FaceInfo face_info, FacialLandmark *points)
+  {
+    if (!IsValidView(image) || !facial_detector->IsLoaded()) {
       return false;
     }
-    int pts_num = 5;
-    float *facial_loc = new float[pts_num * 2];
-    facial_detector->FacialPointLocate(gray_im.data, gray_im.width, gray_im.height, face_info, facial_loc);
+    const int pts_num = 5;
+    float facial_loc[pts_num * 2];
+    facial_detector->FacialPointLocate(image, face_info, facial_loc);
 
     for (int i = 0; i < pts_num; i++) {
       points[i].x = facial_loc[i * 2];
       points[i].y = facial_loc[i * 2 + 1];
     }
+    return true;
+  }
+
+  /** Detect five facial landmarks for each of a batch of faces on one image.
+   *  @param gray_im A grayscale image, or a BGR one if it has 3 channels
+   *  @param face_infos The face bounding boxes
+   *  @param[out] points The locations of detected facial points, five per face
+   */
+  bool FaceAlignment::PointDetectLandmarksBatch(ImageData gray_im, const std::vector<FaceInfo> &face_infos, FacialLandmark *points)
+  {
+    ImageView image;
+    return ToImageView(gray_im, &image) && PointDetectLandmarksBatch(image, face_infos, points);
+  }
+
+  /** Detect five facial landmarks for each of a batch of faces on a view of an image.
+   *  @param image The view of a grayscale, BGR or RGB image
+   *  @param face_infos The face bounding boxes
+   *  @param[out] points The locations of detected facial points, five per face
+   */
+  bool FaceAlignment::PointDetectLandmarksBatch(const ImageView &image, const std::vector<FaceInfo> &face_infos, FacialLandmark *points)
+  {
+    if (!IsValidView(image) || !facial_detector->IsLoaded()) {
+      return false;
+    }
+    /*Faces are processed in chunks, with the locations kept on the stack*/
+    const int pts_num = 5;
+    const int chunk_size = 64;
+    float facial_locs[chunk_size * pts_num * 2];
+    int face_num = int(face_infos.size());
+
+    for (int begin = 0; begin < face_num; begin += chunk_size) {
+      int num = (face_num - begin < chunk_size ? face_num - begin : chunk_size);
+      facial_detector->FacialPointLocateBatch(image, &face_infos[begin], num, facial_locs);
+
+      FacialLandmark *chunk_points = points + begin * pts_num;
+      for (int i = 0; i < num * pts_num; i++) {
+        chunk_points[i].x = facial_locs[i * 2];
+        chunk_points[i].y = facial_locs[i * 2 + 1];
+      }
+    }
+    return true;
+  }
+
+  /** Set the quality level of PointDetectLandmarks() and PointDetectLandmarksBatch().
+   *  @param quality The quality level
+   */
+  void FaceAlignment::SetQualityLevel(AlignmentQuality quality) {
+    facial_detector->SetStageNum(quality == ALIGNMENT_FAST ? 1 : 2);
+  }
+
+  /** Track five facial landmarks of a face in a video from those of the previous frame.
+   *  @param gray_im A grayscale image, or a BGR one if it has 3 channels
+   *  @param face_info The face bounding box in this frame, or the one of the track
+   *  @param prev_points The five facial points of the face in the previous frame
+   *  @param[out] points The locations of detected facial points
+   *  @param[out] tracked Optional, whether the points were tracked rather than detected from scratch
+   */
+  bool FaceAlignment::PointTrackLandmarks(ImageData gray_im, FaceInfo face_info, const FacialLandmark *prev_points,
+    FacialLandmark *points, bool *tracked)
+  {
+    ImageView image;
+    return ToImageView(gray_im, &image) && PointTrackLandmarks(image, face_info, prev_points, points, tracked);
+  }
+
+  /** Track five facial landmarks of a face on a view of a video frame.
+   *  @param image The view of a grayscale, BGR or RGB frame
+   *  @param face_info The face bounding box in this frame, or the one of the track
+   *  @param prev_points The five facial points of the face in the previous frame
+   *  @param[out] points The locations of detected facial points
+   *  @param[out] tracked Optional, whether the points were tracked rather than detected from scratch
+   */
+  bool FaceAlignment::PointTrackLandmarks(const ImageView &image, FaceInfo face_info, const FacialLandmark *prev_points,
+    FacialLandmark *points, bool *tracked)
+  {
+    if (!IsValidView(image) || !facial_detector->IsLoaded()) {
+      return false;
+    }
+    const int pts_num = 5;
+    float prev_loc[pts_num * 2];
+    float facial_loc[pts_num * 2];
+    for (int i = 0; i < pts_num; i++) {
+      prev_loc[i * 2] = float(prev_points[i].x);
+      prev_loc[i * 2 + 1] = float(prev_points[i].y);
+    }
+    bool is_tracked = facial_detector->FacialPointTrack(image, face_info, prev_loc, facial_loc);
 
-    delete[]facial_loc;
+    for (int i = 0; i < pts_num; i++) {
+      points[i].x = facial_loc[i * 2];
+      points[i].y = facial_loc[i * 2 + 1];
+    }
+    if (tracked != NULL) {
+      *tracked = is_tracked;
+    }
     return true;
   }
 
+  /** Set the largest move of a facial point by the fine stage accepted when tracking.
+   *  @param ratio The move relative to the size of the face patch of the fine stage
+   */
+  void FaceAlignment::SetMaxTrackUpdate(float ratio) {
+    facial_detector->SetMaxTrackUpdate(ratio);
+  }
+
+  /** Set the number of threads sharing out the faces of a batch, or the facial points of a face.
+   *  @param num_threads The number of threads
+   */
+  void FaceAlignment::SetNumThreads(int num_threads) {
+    facial_detector->SetNumThreads(num_threads);
+  }
+
   /** A Destructor which should never be called explicitly.
    *  Release all dynamically allocated resources.
    */
@@ -31,9 +31,18 @@
  */
 
 #include "sift.h"
+#include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+
+#ifdef USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
 
-#define pi 3.1415926
 double SIFT::delta_gauss_x[25] = 
 {0.0284161904936934,0.0260724940559495,0,-0.0260724940559495,-0.0284161904936934,
 0.127352530356230,0.116848811647003,0,-0.116848811647003,-0.127352530356230,
@@ -57,6 +66,10 @@ SIFT::~SIFT(void)
 {
 }
 
+/* Directions of the orientation bins, 8 angles */
+static const float kCosArray[8] = {1.0f, 0.7071f, 0.0f, -0.7071f, -1.0f, -0.7071f, 0.0f, 0.7071f};
+static const float kSinArray[8] = {0.0f, 0.7071f, 1.0f, 0.7071f, 0.0f, -0.7071f, -1.0f, -0.7071f};
+
 /** Initialize the SIFT extractor.
  *  @param im_width The width of the input image
  *  @param im_height The height of the input image
@@ -83,211 +96,365 @@ void SIFT::InitSIFT(int im_width, int im_height, int patch_size, int grid_spacin
   param.filter_size = 5;
   param.sigma = 1;
   param.alpha = 3;	
-}
 
-/** Implement convolutional function "filter2" same in Matlab.
- *  @param gray_im A grayscale image
- *  @param kernel A convolutional kernel
- *  @param kernel_size The size of convolutional kernel
- *  @param[out] filter_im The output image map after convolution
- */
-void SIFT::filter2(double* gray_im, double* kernel, int kernel_size, double* filter_im)
-{
-  // Padding the image
-  int pad_size = (kernel_size - 1) / 2;
-  double* gray_img_ex = new double[(param.image_width + (kernel_size - 1)) * (param.image_height + (kernel_size - 1))];
-	
-  for(int i = 0; i < pad_size; i++)
+  // delta_gauss_x is the outer product of a smoothing column and a derivative row,
+  // and delta_gauss_y its transpose
+  for (int k = 0; k < param.filter_size; k++)
   {
-	  for (int j = 0; j < param.image_width + (kernel_size - 1); j++)
-	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size - 1)) + j] = 0;
-	  }
+	  deriv_[k] = float(delta_gauss_x[2 * param.filter_size + k]);
+	  smooth_[k] = float(delta_gauss_x[k * param.filter_size] / delta_gauss_x[2 * param.filter_size]);
   }
 
-  for (int i = param.image_height + pad_size; i < param.image_height + (kernel_size - 1); i++)
+  // Weights of the sample cells. The distance to the center has always been taken by
+  // the integer abs, so the triangular weights are in fact a box of 2 * sample_pixel ones
+  cell_weight_.resize(param.patch_size);
+  weight_begin_ = param.patch_size;
+  weight_end_ = 0;
+  for (int k = 0; k < param.patch_size; k++)
   {
-	  for (int j = 0; j < param.image_width + (kernel_size - 1); j++)
+	  double weight = abs(int(k - double(param.patch_size - 1) / 2)) / (param.sample_pixel);
+
+	  if (weight <= 1)
+		  weight = 1 - weight;
+	  else
+		  weight = 0;
+	  cell_weight_[k] = float(weight);
+
+	  if (weight > 0)
 	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size - 1)) + j] = 0;
+		  weight_begin_ = std::min(weight_begin_, k);
+		  weight_end_ = k + 1;
 	  }
   }
 
-  for(int i = pad_size; i < param.image_height + pad_size; i++)
+  // The sample locations read by CalcSIFT, (i, j) being the column and the row
+  row_index_.assign(param.image_height, -1);
+  col_index_.assign(param.image_width, -1);
+  for (int location_x = param.patch_size / 2; location_x <= param.image_height - (param.patch_size / 2); location_x += param.grid_spacing)
   {
-	  for(int j = 0; j < pad_size; j++)
+	  for (int location_y = param.patch_size / 2; location_y <= param.image_width - (param.patch_size / 2); location_y += param.grid_spacing)
 	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size - 1)) + j] = 0;
+		  for (int p = -param.patch_size / 2; p <= param.patch_size / 2 - param.sample_pixel; p += param.sample_pixel)
+		  {
+			  col_index_[location_x + p] = 0;
+			  row_index_[location_y + p] = 0;
+		  }
 	  }
-	  for (int j = param.image_width + pad_size; j < param.image_width + (kernel_size - 1); j++)
+  }
+  sample_rows_.clear();
+  sample_cols_.clear();
+  for (int j = 0; j < param.image_height; j++)
+  {
+	  if (row_index_[j] == 0)
 	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size - 1)) + j] = 0;
+		  row_index_[j] = sample_rows_.size();
+		  sample_rows_.push_back(j);
 	  }
-	  for(int j = pad_size; j < param.image_width + pad_size; j++)
+  }
+  for (int i = 0; i < param.image_width; i++)
+  {
+	  if (col_index_[i] == 0)
 	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size - 1)) + j] = gray_im[(i - pad_size) * param.image_width + (j - pad_size)];
+		  col_index_[i] = sample_cols_.size();
+		  sample_cols_.push_back(i);
 	  }
   }
 
-  // Sliding filter on padding image
-  for(int i = 0; i < param.image_height; i++)
+  // The rows split at the borders of the cells, so that the rows of a cell are whole blocks
+  int cell_pad = (param.patch_size - 1) / 2;
+  std::vector<int> bounds(1, 0);
+  bounds.push_back(param.image_height);
+  for (size_t r = 0; r < sample_rows_.size(); r++)
   {
-	  for(int j = 0; j < param.image_width; j++)
-	  {
-		  double tmp = 0.000000;
-
-		  for (int ki = 0; ki < kernel_size; ki++)
-		  {
-			  for (int kj = 0; kj < kernel_size; kj++)
-			  {
-				  double tmp1 = gray_img_ex[(i + ki) * (param.image_width + (kernel_size - 1)) + (j + kj)];
-				  tmp += tmp1 * kernel[ki * kernel_size + kj];
-			  }
-		  }
-		  filter_im[i * param.image_width + j] = tmp;
-	  }
+	  bounds.push_back(std::min(std::max(sample_rows_[r] - cell_pad + weight_begin_, 0), param.image_height));
+	  bounds.push_back(std::min(std::max(sample_rows_[r] - cell_pad + weight_end_, 0), param.image_height));
   }
-  delete [] gray_img_ex;
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+  row_block_.resize(param.image_height);
+  for (size_t k = 0; k + 1 < bounds.size(); k++)
+  {
+	  for (int j = bounds[k]; j < bounds[k + 1]; j++)
+		  row_block_[j] = k;
+  }
+  block_begin_.resize(sample_rows_.size());
+  block_end_.resize(sample_rows_.size());
+  for (size_t r = 0; r < sample_rows_.size(); r++)
+  {
+	  int row_begin = std::min(std::max(sample_rows_[r] - cell_pad + weight_begin_, 0), param.image_height);
+	  int row_end = std::min(std::max(sample_rows_[r] - cell_pad + weight_end_, 0), param.image_height);
+	  block_begin_[r] = std::lower_bound(bounds.begin(), bounds.end(), row_begin) - bounds.begin();
+	  block_end_[r] = std::lower_bound(bounds.begin(), bounds.end(), row_end) - bounds.begin();
+  }
+  block_num_ = bounds.size() - 1;
 }
 
-/** Sparse convolution for speed-up
- *  @param gray_im A grayscale image
- *  @param kernel A convolutional kernel
- *  @param kernel_size The size of convolutional kernel
- *  @param[out] filter_im The output image map after sparse convolution
+/** Allocate the scratch buffers of CalcSIFT and CalcSIFTWindows. Those of the maps
+ *  shared by the windows grow with the area covered by the windows.
+ *  @param[out] workspace The workspace to allocate
+ */
+void SIFT::InitWorkspace(Workspace* workspace) const
+{
+  // The borders of the padded buffers stay zero
+  int pad_size = (param.filter_size - 1) / 2;
+  workspace->gray_img_ex.assign((param.image_width + 2 * pad_size) * (param.image_height + 2 * pad_size), 0);
+  workspace->deriv_row.assign(param.image_width * (param.image_height + 2 * pad_size), 0);
+  workspace->smooth_row.assign(param.image_width * (param.image_height + 2 * pad_size), 0);
+  workspace->grad_x.resize(param.image_pixel);
+  workspace->grad_y.resize(param.image_pixel);
+  workspace->orientation_row.resize(param.image_width * param.angle_nums);
+  workspace->row_sum.resize(sample_cols_.size() * param.angle_nums);
+  workspace->pooled.resize(sample_rows_.size() * sample_cols_.size() * param.angle_nums);
+
+  int inner_width = std::max(param.image_width - 2 * pad_size, 0);
+  int inner_height = std::max(param.image_height - 2 * pad_size, 0);
+  int ring_pixel = param.image_pixel - inner_width * inner_height;
+  workspace->side_deriv.assign((param.image_height + 2 * pad_size) * 2 * pad_size, 0);
+  workspace->side_smooth.assign((param.image_height + 2 * pad_size) * 2 * pad_size, 0);
+  workspace->edge_deriv.resize(3 * pad_size * param.image_width);
+  workspace->edge_smooth.resize(3 * pad_size * param.image_width);
+  workspace->ring_grad_x.resize(ring_pixel);
+  workspace->ring_grad_y.resize(ring_pixel);
+  workspace->ring_orientation.resize(ring_pixel * param.angle_nums);
+  workspace->block_sum.resize(block_num_ * param.image_width * param.angle_nums);
+}
+
+/** Filter one row by the derivative and the smoothing factors of the separable filters.
+ *  @param src The row, with pad_size extra pixels on both sides
+ *  @param count The number of output pixels
+ *  @param[out] deriv The row filtered by the derivative factor
+ *  @param[out] smooth The row filtered by the smoothing factor
  */
-void SIFT::SparseFilter2(double* gray_im, double* kernel, int kernel_size, double* filter_im)
+void SIFT::FilterRow(const float* src, int count, float* deriv, float* smooth) const
 {
-  // Padding the image
-  int pad_size = (kernel_size-1)/2;
-  double* gray_img_ex = new double[(param.image_width + (kernel_size-1)) * (param.image_height + (kernel_size-1))];
-	
-  for(int i = 0; i < pad_size; i++)
+  int j = 0;
+#ifdef USE_SSE
+  for (; j + 4 <= count; j += 4)
   {
-	  for(int j = 0; j < param.image_width + (kernel_size-1); j++)
+	  __m128 d = _mm_setzero_ps();
+	  __m128 s = _mm_setzero_ps();
+	  for (int k = 0; k < param.filter_size; k++)
 	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size-1)) + j] = 0;
+		  __m128 x = _mm_loadu_ps(src + j + k);
+		  d = _mm_add_ps(d, _mm_mul_ps(x, _mm_set1_ps(deriv_[k])));
+		  s = _mm_add_ps(s, _mm_mul_ps(x, _mm_set1_ps(smooth_[k])));
 	  }
+	  _mm_storeu_ps(deriv + j, d);
+	  _mm_storeu_ps(smooth + j, s);
   }
-
-  for(int i = param.image_height + pad_size; i < param.image_height + (kernel_size-1); i++)
+#endif
+  for (; j < count; j++)
   {
-	  for(int j = 0; j < param.image_width + (kernel_size-1); j++)
+	  float d = 0;
+	  float s = 0;
+	  for (int k = 0; k < param.filter_size; k++)
 	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size-1)) + j] = 0;
+		  d += src[j + k] * deriv_[k];
+		  s += src[j + k] * smooth_[k];
 	  }
+	  deriv[j] = d;
+	  smooth[j] = s;
   }
+}
 
-  for(int i = pad_size; i < param.image_height + pad_size; i++)
+/** Filter the columns of the rows filtered by FilterRow into the gradients.
+ *  @param deriv The first of the filter_size rows filtered by the derivative factor
+ *  @param smooth The first of the filter_size rows filtered by the smoothing factor
+ *  @param stride The distance between the rows
+ *  @param count The number of output pixels
+ *  @param[out] grad_x The horizontal gradients
+ *  @param[out] grad_y The vertical gradients
+ */
+void SIFT::FilterColumns(const float* deriv, const float* smooth, int stride, int count,
+	float* grad_x, float* grad_y) const
+{
+  int j = 0;
+#ifdef USE_SSE
+  for (; j + 4 <= count; j += 4)
   {
-	  for(int j = 0; j < pad_size; j++)
-	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size-1)) + j] = 0;
-	  }
-	  for(int j = param.image_width + pad_size; j < param.image_width + (kernel_size-1); j++) 
-	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size-1)) + j] = 0;
-	  }
-	  for(int j = pad_size; j < param.image_width + pad_size; j++)
+	  __m128 gx = _mm_setzero_ps();
+	  __m128 gy = _mm_setzero_ps();
+	  for (int k = 0; k < param.filter_size; k++)
 	  {
-		  gray_img_ex[i * (param.image_width + (kernel_size - 1)) + j] = gray_im[(i - pad_size) * param.image_width + (j - pad_size)];
+		  gx = _mm_add_ps(gx, _mm_mul_ps(_mm_loadu_ps(deriv + k * stride + j), _mm_set1_ps(smooth_[k])));
+		  gy = _mm_add_ps(gy, _mm_mul_ps(_mm_loadu_ps(smooth + k * stride + j), _mm_set1_ps(deriv_[k])));
 	  }
+	  _mm_storeu_ps(grad_x + j, gx);
+	  _mm_storeu_ps(grad_y + j, gy);
   }
-
-  // Sliding filter on padding image
-  for(int i = 0; i < param.image_height; i += param.sample_pixel)
+#endif
+  for (; j < count; j++)
   {
-	  for(int j = 0; j < param.image_width; j += param.sample_pixel)
+	  float gx = 0;
+	  float gy = 0;
+	  for (int k = 0; k < param.filter_size; k++)
 	  {
-		  double tmp = 0.000000;
-
-		  for(int ki = 0; ki < kernel_size; ki++)
-		  {
-			  for(int kj = 0; kj < kernel_size; kj++)
-			  {
-				  double tmp1 = gray_img_ex[(i + ki) * (param.image_width + (kernel_size - 1)) + (j + kj)];
-				  tmp += tmp1 * kernel[ki * kernel_size + kj];
-			  }
-		  }
-		  filter_im[i * param.image_width + j] = tmp;
+		  gx += deriv[k * stride + j] * smooth_[k];
+		  gy += smooth[k * stride + j] * deriv_[k];
 	  }
+	  grad_x[j] = gx;
+	  grad_y[j] = gy;
   }
-  delete [] gray_img_ex;
 }
 
-/** Calculate image orientation
- *  @param image_orientation A image orientation map
- *  @param[out] conv_im The output convolutional image
+/** Compute the image gradients by the separable derivative of Gaussian filters,
+ *  with zero padding as "filter2" in Matlab.
+ *  @param workspace The workspace holding the image normalized by its maximum, with a zero border of 2 pixels
  */
-void SIFT::ConvImage(double* image_orientation, double* conv_im)
+void SIFT::ImageGradient(Workspace* workspace) const
 {
-  double* weight = new double[param.patch_size];
-  double* kernel = new double[param.patch_size * param.patch_size];
+  int pad_size = (param.filter_size - 1) / 2;
+  int width = param.image_width;
+  int width_ex = param.image_width + 2 * pad_size;
 
-  for(int k = 0; k < param.patch_size; k++)
+  // Filter the rows: derivative for the vertical edges, smoothing for the horizontal ones
+  for (int i = 0; i < param.image_height; i++)
   {
-	  weight[k] = abs(k - double(param.patch_size - 1)/2)/(param.sample_pixel);
+	  FilterRow(workspace->gray_img_ex.data() + (i + pad_size) * width_ex, width,
+		  workspace->deriv_row.data() + (i + pad_size) * width, workspace->smooth_row.data() + (i + pad_size) * width);
+  }
 
-	  if(weight[k] <= 1)
-		  weight[k] = 1 - weight[k];
-	  else
-		  weight[k] = 0;
+  // Filter the columns, the padding rows being zero
+  for (int i = 0; i < param.image_height; i++)
+  {
+	  FilterColumns(workspace->deriv_row.data() + i * width, workspace->smooth_row.data() + i * width, width, width,
+		  workspace->grad_x.data() + i * width, workspace->grad_y.data() + i * width);
   }
+}
 
-  for(int i = 0; i < param.patch_size; i++)
+/** Bin the gradients of some pixels into the orientations. The response of an angle
+ *  is max(cos(theta - angle), 0)^3 * magnitude, computed as max(p, 0)^3 / magnitude^2
+ *  with p the projection of the gradient on the angle.
+ *  @param grad_x The horizontal gradients
+ *  @param grad_y The vertical gradients
+ *  @param count The number of pixels
+ *  @param[out] orientation The orientation maps, pixel by pixel
+ */
+void SIFT::Orientation(const float* grad_x, const float* grad_y, int count, float* orientation) const
+{
+  int j = 0;
+#ifdef USE_SSE
+  // Four pixels at once, the responses of four angles being transposed into the pixels
+  if (param.angle_nums == 8)
   {
-	  for(int j = 0; j < param.patch_size; j++)
+	  for (; j + 4 <= count; j += 4)
 	  {
-		  kernel[i * param.patch_size + j] = weight[i] * weight[j];
+		  __m128 gx = _mm_loadu_ps(grad_x + j);
+		  __m128 gy = _mm_loadu_ps(grad_y + j);
+		  __m128 magnitude2 = _mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy));
+		  __m128 scale = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), magnitude2), _mm_cmpgt_ps(magnitude2, _mm_setzero_ps()));
+		  float* dest = orientation + j * 8;
+		  for (int index = 0; index < 8; index += 4)
+		  {
+			  __m128 response[4];
+			  for (int k = 0; k < 4; k++)
+			  {
+				  __m128 p = _mm_add_ps(_mm_mul_ps(gx, _mm_set1_ps(kCosArray[index + k])),
+					  _mm_mul_ps(gy, _mm_set1_ps(kSinArray[index + k])));
+				  p = _mm_max_ps(p, _mm_setzero_ps());
+				  response[k] = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(p, p), p), scale);
+			  }
+			  _MM_TRANSPOSE4_PS(response[0], response[1], response[2], response[3]);
+			  for (int k = 0; k < 4; k++)
+				  _mm_storeu_ps(dest + k * 8 + index, response[k]);
+		  }
 	  }
   }
-
-  double* angle_im = new double[param.image_pixel];
-  double* angle_conv_im = new double[param.image_pixel];
-
-  for(int index = 0; index < param.angle_nums; index++)
+#endif
+  for (; j < count; j++)
   {
-	  memset(angle_im, 0, param.image_pixel * sizeof(double));
-	  memcpy(angle_im, &image_orientation[index * param.image_pixel], param.image_pixel * sizeof(double));
-	  SparseFilter2(angle_im, kernel, param.patch_size, angle_conv_im);
-	  memcpy(&conv_im[index * param.image_pixel], angle_conv_im, param.image_pixel * sizeof(double));
+	  float gx = grad_x[j];
+	  float gy = grad_y[j];
+	  float magnitude2 = gx * gx + gy * gy;
+	  float inv_magnitude2 = magnitude2 > 0 ? 1.0f / magnitude2 : 0.0f;
+	  float* dest = orientation + j * param.angle_nums;
+	  for (int index = 0; index < param.angle_nums; index++)
+	  {
+		  float p = gx * kCosArray[index] + gy * kSinArray[index];
+		  p = p > 0 ? p : 0;
+		  dest[index] = p * p * p * inv_magnitude2;
+	  }
   }
-	
-  delete [] weight;
-  delete [] kernel;
-  delete [] angle_im;
-  delete [] angle_conv_im;
 }
 
-/** Compute SIFT feature
- *  @param gray_im A grayscale image
- *  @param[out] sift_feature The output SIFT feature
+/** Accumulate the weighted sums of one row of orientations into the sample locations,
+ *  i.e. the triangular-kernel convolution of the orientation maps evaluated only where
+ *  CalcSIFT reads it.
+ *  @param row The index of the image row
+ *  @param workspace The workspace holding the orientation map of the row
  */
-void SIFT::CalcSIFT(BYTE* gray_im, double* sift_feature)
+void SIFT::PoolRow(int row, Workspace* workspace) const
 {
-  double* lf_gray_im = new double[param.image_pixel];
-  double max = 0.000001;
-  for (int pt = 0; pt < param.image_pixel; pt++)
+  const float* orientation = workspace->orientation_row.data();
+  int pad_size = (param.patch_size - 1) / 2;
+  int sample_cols = sample_cols_.size();
+  int angle_nums = param.angle_nums;
+  float* row_sum = workspace->row_sum.data();
+  bool summed = false;
+
+  for (size_t r = 0; r < sample_rows_.size(); r++)
   {
-	  lf_gray_im[pt] = gray_im[pt];
-	  if (lf_gray_im[pt] > max)
-		  max = lf_gray_im[pt];
-  }
+	  int k = row - sample_rows_[r] + pad_size;
+	  if (k < weight_begin_ || k >= weight_end_)
+		  continue;
 
-  for (int pt = 0; pt < param.image_pixel; pt++)
-  {
-	  lf_gray_im[pt] = lf_gray_im[pt] / max;
-  }
+	  // Weighted sums along the row, shared by the sample rows
+	  if (!summed)
+	  {
+		  for (int c = 0; c < sample_cols; c++)
+		  {
+			  int col_begin = std::max(sample_cols_[c] - pad_size + weight_begin_, 0);
+			  int col_end = std::min(sample_cols_[c] - pad_size + weight_end_, param.image_width);
+			  const float* weight = cell_weight_.data() + pad_size - sample_cols_[c];
+			  float* dest = row_sum + c * angle_nums;
+			  memset(dest, 0, angle_nums * sizeof(float));
+			  for (int col = col_begin; col < col_end; col++)
+			  {
+				  const float* src = orientation + col * angle_nums;
+#ifdef USE_SSE
+				  __m128 w = _mm_set1_ps(weight[col]);
+				  for (int index = 0; index < angle_nums; index += 4)
+					  _mm_storeu_ps(dest + index, _mm_add_ps(_mm_loadu_ps(dest + index), _mm_mul_ps(w, _mm_loadu_ps(src + index))));
+#else
+				  for (int index = 0; index < angle_nums; index++)
+					  dest[index] += weight[col] * src[index];
+#endif
+			  }
+		  }
+		  summed = true;
+	  }
 
-  double* im_orientation = new double[param.image_pixel * param.angle_nums];
-  double* conv_im = new double[param.image_pixel * param.angle_nums];
-  memset(conv_im, 0, param.image_pixel * param.angle_nums * sizeof(double));
+	  float weight = cell_weight_[k];
+	  float* dest = workspace->pooled.data() + r * sample_cols * angle_nums;
+	  for (int pt = 0; pt < sample_cols * angle_nums; pt++)
+		  dest[pt] += weight * row_sum[pt];
+  }
+}
 
-  ImageOrientation(lf_gray_im, im_orientation);
-  ConvImage(im_orientation, conv_im);
+/** Add an array to another
+ *  @param src The array to add
+ *  @param count The number of elements
+ *  @param[in,out] dest The array added to
+ */
+static inline void AddTo(const float* src, int count, float* dest)
+{
+  int pt = 0;
+#ifdef USE_SSE
+  for (; pt + 4 <= count; pt += 4)
+	  _mm_storeu_ps(dest + pt, _mm_add_ps(_mm_loadu_ps(dest + pt), _mm_loadu_ps(src + pt)));
+#endif
+  for (; pt < count; pt++)
+	  dest[pt] += src[pt];
+}
 
-  // Generate denseSIFT feature vector
-  double* patch_feature = new double[param.patch_dims];
+/** Normalize the pooled orientations at the sample locations into the SIFT feature
+ *  @param pooled The pooled orientations, to be multiplied by scale
+ *  @param scale The normalization of the image by its maximum
+ *  @param[out] sift_feature The output SIFT feature
+ */
+void SIFT::Describe(const float* pooled, float scale, float* sift_feature) const
+{
+  int sample_cols = sample_cols_.size();
   int patch_cnt = 0;
 
   // Sliding windows on overlapping patches. (px,py) are centroids
@@ -295,9 +462,8 @@ void SIFT::CalcSIFT(BYTE* gray_im, double* sift_feature)
   {
 	  for (int location_y = param.patch_size / 2; location_y <= param.image_width - (param.patch_size / 2); location_y += param.grid_spacing)
 	  {
-		  memset(patch_feature, 0, param.patch_dims * sizeof(double));
-
-		  double l2_norm = 0.000001;
+		  float* patch_feature = sift_feature + patch_cnt * param.patch_dims;
+		  float l2_norm = 0.000001f;
 		  int Point_cnt = 0;
 
 		  for (int p_x = -param.patch_size / 2; p_x <= param.patch_size / 2 - param.sample_pixel; p_x += param.sample_pixel)
@@ -306,101 +472,385 @@ void SIFT::CalcSIFT(BYTE* gray_im, double* sift_feature)
 			  {
 				  int i = location_x + p_x;
 				  int j = location_y + p_y;
+				  const float* src = pooled + (row_index_[j] * sample_cols + col_index_[i]) * param.angle_nums;
 
 				  for (int index = 0; index < param.angle_nums; index++)
 				  {
-					  patch_feature[Point_cnt] = conv_im[index * param.image_pixel + j * param.image_height + i];
-					  l2_norm += pow(patch_feature[Point_cnt], 2);
+					  float value = src[index] * scale;
+					  patch_feature[Point_cnt] = value;
+					  l2_norm += value * value;
 					  Point_cnt += 1;
 				  }
 			  }
 		  }
 		  // Patch-wise L2-norm
-		  double norm = 1.0 / sqrt(l2_norm);
+		  float norm = 1.0f / sqrt(l2_norm);
 		  for (int pt = 0; pt < param.patch_dims; pt++)
 		  {
 			  patch_feature[pt] = patch_feature[pt] * norm;
 		  }
-
-		  memcpy(&sift_feature[patch_cnt * param.patch_dims], patch_feature, param.patch_dims * sizeof(double));
 		  patch_cnt += 1;
 	  }
   }
-
-  delete[] lf_gray_im;
-  delete[] im_orientation;
-  delete[] conv_im;
-  delete[] patch_feature;
 }
 
-
-/** Calculate image orientation
- *  @param image_orientation A image orientation map
- *  @param[out] conv_im The output convolutional image
+/** Compute SIFT feature
+ *  @param gray_im A grayscale image
+ *  @param[out] sift_feature The output SIFT feature
+ *  @param workspace The scratch buffers allocated by InitWorkspace
  */
-void SIFT::ImageOrientation(double* gray_im, double* image_orientation)
+void SIFT::CalcSIFT(const BYTE* gray_im, float* sift_feature, Workspace* workspace) const
 {
-  double* im_vert_edge = new double[param.image_pixel];
-  double* im_hori_edge = new double[param.image_pixel];
+  int pad_size = (param.filter_size - 1) / 2;
+  int width_ex = param.image_width + 2 * pad_size;
 
-  filter2(gray_im, delta_gauss_x, param.filter_size, im_vert_edge);
-  filter2(gray_im, delta_gauss_y, param.filter_size, im_hori_edge);
-
-  double* im_magnitude = new double[param.image_pixel];
-  double* im_cos_theta = new double[param.image_pixel];
-  double* im_sin_theta = new double[param.image_pixel];
+  int max = 0;
+  for (int pt = 0; pt < param.image_pixel; pt++)
+  {
+	  if (gray_im[pt] > max)
+		  max = gray_im[pt];
+  }
+  float scale = 1.0f / std::max(float(max), 0.000001f);
 
+  float* gray_img_ex = workspace->gray_img_ex.data();
   for (int i = 0; i < param.image_height; i++)
   {
+	  const BYTE* src = gray_im + i * param.image_width;
+	  float* dest = gray_img_ex + (i + pad_size) * width_ex + pad_size;
 	  for (int j = 0; j < param.image_width; j++)
-	  {
-		  double tmpV = im_vert_edge[i * param.image_width + j];
-		  double tmpH = im_hori_edge[i * param.image_width + j];
-		  double tmpMagnitude = sqrt(pow(tmpV, 2) + pow(tmpH, 2));
-		  im_magnitude[i * param.image_width + j] = tmpMagnitude;
-		  im_cos_theta[i * param.image_width + j] = tmpV / tmpMagnitude;
-		  im_sin_theta[i * param.image_width + j] = tmpH / tmpMagnitude;
-	  }
+		  dest[j] = src[j] * scale;
   }
 
-  delete[] im_vert_edge;
-  delete[] im_hori_edge;
-
-  double cos_array[8];
-  double sin_array[8];
-  cos_array[0] = 1.0;
-  cos_array[1] = 0.7071;
-  cos_array[2] = 0.0;
-  cos_array[3] = -0.7071;
-  cos_array[4] = -1.0;
-  cos_array[5] = -0.7071;
-  cos_array[6] = 0.0;
-  cos_array[7] = 0.7071;
-
-  sin_array[0] = 0.0;
-  sin_array[1] = 0.7071;
-  sin_array[2] = 1.0;
-  sin_array[3] = 0.7071;
-  sin_array[4] = 0.0;
-  sin_array[5] = -0.7071;
-  sin_array[6] = -1.0;
-  sin_array[7] = -0.7071;
-  for (int index = 0; index < param.angle_nums; index++)
+  ImageGradient(workspace);
+
+  // The orientation maps are binned and pooled row by row
+  memset(workspace->pooled.data(), 0, workspace->pooled.size() * sizeof(float));
+  for (int i = 0; i < param.image_height; i++)
+  {
+	  Orientation(workspace->grad_x.data() + i * param.image_width, workspace->grad_y.data() + i * param.image_width,
+		  param.image_width, workspace->orientation_row.data());
+	  PoolRow(i, workspace);
+  }
+
+  // Generate denseSIFT feature vector
+  Describe(workspace->pooled.data(), 1.0f, sift_feature);
+}
+
+/** Compute the SIFT features of several windows of an image, with the same results as
+ *  CalcSIFT on each window cut out of the image, up to the rounding.
+ *
+ *  The gradients and the orientation maps are computed once where the windows cover the
+ *  image, and each window pools its cells from them. As CalcSIFT pads each window with
+ *  zeros, the gradients of the pixels of a window closer to its border than pad_size
+ *  differ from the shared ones: they are computed again for each window, from the rows
+ *  filtered with the same padding. The normalization by the maximum of the window is
+ *  applied to the pooled orientations, which are proportional to it.
+ *
+ *  @param gray_im A grayscale image
+ *  @param im_width The width of the image
+ *  @param im_height The height of the image
+ *  @param window_left The left of each window, which may be outside of the image
+ *  @param window_top The top of each window, which may be outside of the image
+ *  @param window_num The number of windows
+ *  @param pad_value The value of the pixels of the windows outside of the image
+ *  @param[out] sift_features The SIFT features of the windows, one after another
+ *  @param workspace The scratch buffers allocated by InitWorkspace
+ */
+void SIFT::CalcSIFTWindows(const BYTE* gray_im, int im_width, int im_height, const int* window_left,
+	const int* window_top, int window_num, BYTE pad_value, float* sift_features, Workspace* workspace) const
+{
+  CalcSIFTWindows(gray_im, im_width, im_height, window_left, window_top, window_num, pad_value, sift_features,
+	  &workspace, 1);
+}
+
+/** Compute the SIFT features of several windows of an image on several threads. The
+ *  rows of the maps, then the windows, are shared out among the threads, and each of
+ *  them is computed as by a single thread, so that the features do not depend on the
+ *  number of threads, bit for bit.
+ *  @param gray_im A grayscale image
+ *  @param im_width The width of the image
+ *  @param im_height The height of the image
+ *  @param window_left The left of each window, which may be outside of the image
+ *  @param window_top The top of each window, which may be outside of the image
+ *  @param window_num The number of windows
+ *  @param pad_value The value of the pixels of the windows outside of the image
+ *  @param[out] sift_features The SIFT features of the windows, one after another
+ *  @param workspaces The scratch buffers of each thread, allocated by InitWorkspace.
+ *  The maps shared by the windows are held by the first one.
+ *  @param num_threads The number of threads
+ */
+void SIFT::CalcSIFTWindows(const BYTE* gray_im, int im_width, int im_height, const int* window_left,
+	const int* window_top, int window_num, BYTE pad_value, float* sift_features, Workspace* const* workspaces,
+	int num_threads) const
+{
+  if (window_num <= 0)
+	  return;
+  Workspace* workspace = workspaces[0];
+  int pad_size = (param.filter_size - 1) / 2;
+  int angle_nums = param.angle_nums;
+  int window_width = param.image_width;
+  int window_height = param.image_height;
+
+  // The maps cover the bounding box of the windows
+  int map_left = window_left[0];
+  int map_top = window_top[0];
+  int map_right = window_left[0] + window_width;
+  int map_bottom = window_top[0] + window_height;
+  for (int w = 1; w < window_num; w++)
   {
-	  for (int pt = 0; pt < param.image_pixel; pt++)
+	  map_left = std::min(map_left, window_left[w]);
+	  map_top = std::min(map_top, window_top[w]);
+	  map_right = std::max(map_right, window_left[w] + window_width);
+	  map_bottom = std::max(map_bottom, window_top[w] + window_height);
+  }
+  int map_width = map_right - map_left;
+  int map_height = map_bottom - map_top;
+  int width_ex = map_width + 2 * pad_size;
+  int height_ex = map_height + 2 * pad_size;
+
+  // The maps cover the windows with a border of pad_size pixels, and are shared by the
+  // threads, while the gradients of a row and the borders of a window are their own
+  workspace->map_image.resize(width_ex * height_ex);
+  workspace->map_deriv.resize(map_width * height_ex);
+  workspace->map_smooth.resize(map_width * height_ex);
+  workspace->map_orientation.resize(map_height * map_width * angle_nums);
+  for (int t = 0; t < num_threads; t++)
+  {
+	  workspaces[t]->map_grad_x.resize(map_width);
+	  workspaces[t]->map_grad_y.resize(map_width);
+	  workspaces[t]->intervals.resize(2 * window_num);
+  }
+  float* map_image = workspace->map_image.data();
+  float* map_deriv = workspace->map_deriv.data();
+  float* map_smooth = workspace->map_smooth.data();
+  float* map_orientation = workspace->map_orientation.data();
+
+  int cell_pad = (param.patch_size - 1) / 2;
+  int sample_rows = sample_rows_.size();
+  int sample_cols = sample_cols_.size();
+  int feature_dims = param.patch_cnt_width * param.patch_cnt_height * param.patch_dims;
+  int side_width = 2 * pad_size;
+  int row_size = window_width * angle_nums;
+
+#pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+  {
+#ifdef USE_OPENMP
+	  Workspace* local = workspaces[omp_get_thread_num()];
+#else
+	  Workspace* local = workspaces[0];
+#endif
+
+	  // The image on the maps, not normalized
+#pragma omp for
+	  for (int i = 0; i < height_ex; i++)
 	  {
-		  double tmp1 = im_cos_theta[pt] * cos_array[index] + im_sin_theta[pt] * sin_array[index];
-		  double tmp = pow(tmp1,3);
-
-		  if (tmp > 0)
-			  tmp = tmp;
-		  else
-			  tmp = 0;
-		  image_orientation[index * param.image_pixel + pt] = tmp * im_magnitude[pt];
+		  int y = map_top - pad_size + i;
+		  int x0 = map_left - pad_size;
+		  int begin = 0;
+		  int end = 0;
+		  if (y >= 0 && y < im_height)
+		  {
+			  begin = std::min(std::max(-x0, 0), width_ex);
+			  end = std::max(std::min(im_width - x0, width_ex), begin);
+		  }
+		  float* dest = map_image + i * width_ex;
+		  for (int j = 0; j < begin; j++)
+			  dest[j] = pad_value;
+		  for (int j = begin; j < end; j++)
+			  dest[j] = gray_im[y * im_width + x0 + j];
+		  for (int j = end; j < width_ex; j++)
+			  dest[j] = pad_value;
 	  }
-  }
 
-  delete[] im_magnitude;
-  delete[] im_cos_theta;
-  delete[] im_sin_theta;
+	  // Filter the rows of the whole maps
+#pragma omp for
+	  for (int i = 0; i < height_ex; i++)
+		  FilterRow(map_image + i * width_ex, map_width, map_deriv + i * map_width, map_smooth + i * map_width);
+
+	  // Filter the columns and bin the orientations where some window covers the maps
+	  int* intervals = local->intervals.data();
+#pragma omp for
+	  for (int i = 0; i < map_height; i++)
+	  {
+		  // The columns covered by the windows on the row, sorted by their left
+		  int interval_num = 0;
+		  for (int w = 0; w < window_num; w++)
+		  {
+			  int top = window_top[w] - map_top;
+			  if (i < top || i >= top + window_height)
+				  continue;
+			  int left = window_left[w] - map_left;
+			  int k = interval_num++;
+			  for (; k > 0 && intervals[2 * (k - 1)] > left; k--)
+			  {
+				  intervals[2 * k] = intervals[2 * (k - 1)];
+				  intervals[2 * k + 1] = intervals[2 * (k - 1) + 1];
+			  }
+			  intervals[2 * k] = left;
+			  intervals[2 * k + 1] = left + window_width;
+		  }
+
+		  int col = 0;
+		  for (int k = 0; k < interval_num; k++)
+		  {
+			  int begin = std::max(intervals[2 * k], col);
+			  int end = intervals[2 * k + 1];
+			  if (end <= begin)
+				  continue;
+			  FilterColumns(map_deriv + i * map_width + begin, map_smooth + i * map_width + begin, map_width, end - begin,
+				  local->map_grad_x.data(), local->map_grad_y.data());
+			  Orientation(local->map_grad_x.data(), local->map_grad_y.data(), end - begin,
+				  map_orientation + (i * map_width + begin) * angle_nums);
+			  col = end;
+		  }
+	  }
+
+	  float* side_deriv = local->side_deriv.data();
+	  float* side_smooth = local->side_smooth.data();
+	  float* edge_deriv = local->edge_deriv.data();
+	  float* edge_smooth = local->edge_smooth.data();
+	  float* ring_grad_x = local->ring_grad_x.data();
+	  float* ring_grad_y = local->ring_grad_y.data();
+	  float* block_sum = local->block_sum.data();
+	  float* col_sum = local->orientation_row.data();
+	  float* pooled = local->pooled.data();
+#pragma omp for
+	  for (int w = 0; w < window_num; w++)
+	  {
+		  int left = window_left[w] - map_left;
+		  int top = window_top[w] - map_top;
+		  const float* window_image = map_image + (top + pad_size) * width_ex + left + pad_size;
+		  const float* window_deriv = map_deriv + (top + pad_size) * map_width + left;
+		  const float* window_smooth = map_smooth + (top + pad_size) * map_width + left;
+
+		  float max = 0;
+		  for (int i = 0; i < window_height; i++)
+		  {
+			  const float* src = window_image + i * width_ex;
+			  int j = 0;
+	#ifdef USE_SSE
+			  __m128 row_max = _mm_setzero_ps();
+			  for (; j + 4 <= window_width; j += 4)
+				  row_max = _mm_max_ps(row_max, _mm_loadu_ps(src + j));
+			  row_max = _mm_max_ps(row_max, _mm_shuffle_ps(row_max, row_max, _MM_SHUFFLE(1, 0, 3, 2)));
+			  row_max = _mm_max_ps(row_max, _mm_shuffle_ps(row_max, row_max, _MM_SHUFFLE(2, 3, 0, 1)));
+			  max = std::max(max, _mm_cvtss_f32(row_max));
+	#endif
+			  for (; j < window_width; j++)
+				  max = std::max(max, src[j]);
+		  }
+		  float scale = 1.0f / std::max(max, 0.000001f);
+
+		  // The pixels of the border: rows of pad_size pixels at the top and the bottom, then
+		  // pad_size pixels at the left and the right of the other rows
+		  for (int side = 0; side < 2; side++)
+		  {
+			  // The rows filtered around the edge, with zeros outside of the window
+			  int zero_row = (side == 0 ? 0 : 2 * pad_size);
+			  int first_row = (side == 0 ? -pad_size : window_height - 2 * pad_size);
+			  memset(edge_deriv + zero_row * window_width, 0, pad_size * window_width * sizeof(float));
+			  memset(edge_smooth + zero_row * window_width, 0, pad_size * window_width * sizeof(float));
+			  for (int k = 0; k < 3 * pad_size; k++)
+			  {
+				  if (k >= zero_row && k < zero_row + pad_size)
+					  continue;
+				  memcpy(edge_deriv + k * window_width, window_deriv + (first_row + k) * map_width, window_width * sizeof(float));
+				  memcpy(edge_smooth + k * window_width, window_smooth + (first_row + k) * map_width, window_width * sizeof(float));
+			  }
+			  for (int i = 0; i < pad_size; i++)
+			  {
+				  int ring_row = side * pad_size + i;
+				  FilterColumns(edge_deriv + i * window_width, edge_smooth + i * window_width,
+					  window_width, window_width, ring_grad_x + ring_row * window_width, ring_grad_y + ring_row * window_width);
+			  }
+		  }
+
+		  // The columns of the sides filtered along the rows with zeros outside of the window
+		  for (int i = 0; i < window_height; i++)
+		  {
+			  const float* src = window_image + i * width_ex - pad_size;
+			  for (int c = 0; c < side_width; c++)
+			  {
+				  int j = (c < pad_size ? c : window_width - side_width + c);
+				  int k_begin = std::max(pad_size - j, 0);
+				  int k_end = std::min(window_width + pad_size - j, param.filter_size);
+				  float d = 0;
+				  float s = 0;
+				  for (int k = k_begin; k < k_end; k++)
+				  {
+					  d += src[j + k] * deriv_[k];
+					  s += src[j + k] * smooth_[k];
+				  }
+				  side_deriv[(i + pad_size) * side_width + c] = d;
+				  side_smooth[(i + pad_size) * side_width + c] = s;
+			  }
+		  }
+		  for (int i = 0; i < window_height; i++)
+		  {
+			  float grad_x[8];
+			  float grad_y[8];
+			  FilterColumns(side_deriv + i * side_width, side_smooth + i * side_width, side_width, side_width, grad_x, grad_y);
+			  int ring_row = (i < pad_size ? i : (i >= window_height - pad_size ? i - (window_height - 2 * pad_size) : -1));
+			  float* dest_x;
+			  float* dest_y;
+			  if (ring_row >= 0)
+			  {
+				  // The corners, in the rows of the border
+				  for (int c = 0; c < side_width; c++)
+				  {
+					  int j = (c < pad_size ? c : window_width - side_width + c);
+					  ring_grad_x[ring_row * window_width + j] = grad_x[c];
+					  ring_grad_y[ring_row * window_width + j] = grad_y[c];
+				  }
+				  continue;
+			  }
+			  dest_x = ring_grad_x + 2 * pad_size * window_width + (i - pad_size) * side_width;
+			  dest_y = ring_grad_y + 2 * pad_size * window_width + (i - pad_size) * side_width;
+			  memcpy(dest_x, grad_x, side_width * sizeof(float));
+			  memcpy(dest_y, grad_y, side_width * sizeof(float));
+		  }
+		  int ring_pixel = 2 * pad_size * window_width + (window_height - 2 * pad_size) * side_width;
+		  Orientation(ring_grad_x, ring_grad_y, ring_pixel, local->ring_orientation.data());
+
+		  // Sum the orientations of the window over the blocks of rows
+		  const float* ring_orientation = local->ring_orientation.data();
+		  const float* side_orientation = ring_orientation + 2 * pad_size * row_size;
+		  memset(block_sum, 0, block_num_ * row_size * sizeof(float));
+		  for (int i = 0; i < window_height; i++)
+		  {
+			  float* dest = block_sum + row_block_[i] * row_size;
+			  int ring_row = (i < pad_size ? i : (i >= window_height - pad_size ? i - (window_height - 2 * pad_size) : -1));
+			  if (ring_row >= 0)
+			  {
+				  AddTo(ring_orientation + ring_row * row_size, row_size, dest);
+				  continue;
+			  }
+			  const float* side = side_orientation + (i - pad_size) * side_width * angle_nums;
+			  AddTo(side, pad_size * angle_nums, dest);
+			  AddTo(map_orientation + ((top + i) * map_width + left + pad_size) * angle_nums,
+				  (window_width - side_width) * angle_nums, dest + pad_size * angle_nums);
+			  AddTo(side + pad_size * angle_nums, pad_size * angle_nums, dest + (window_width - pad_size) * angle_nums);
+		  }
+
+		  // Pool the cells from the blocks
+		  for (int r = 0; r < sample_rows; r++)
+		  {
+			  memset(col_sum, 0, row_size * sizeof(float));
+			  for (int k = block_begin_[r]; k < block_end_[r]; k++)
+				  AddTo(block_sum + k * row_size, row_size, col_sum);
+
+			  for (int c = 0; c < sample_cols; c++)
+			  {
+				  int col_begin = std::max(sample_cols_[c] - cell_pad + weight_begin_, 0);
+				  int col_end = std::min(sample_cols_[c] - cell_pad + weight_end_, window_width);
+				  float* dest = pooled + (r * sample_cols + c) * angle_nums;
+				  memset(dest, 0, angle_nums * sizeof(float));
+				  for (int col = col_begin; col < col_end; col++)
+					  AddTo(col_sum + col * angle_nums, angle_nums, dest);
+			  }
+		  }
+
+		  Describe(pooled, scale, sift_features + w * feature_dims);
+	  }
+  }
 }
@@ -0,0 +1,436 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Alignment module, containing codes implementing the
+ * facial landmarks location method described in the following paper:
+ *
+ *
+ *   Coarse-to-Fine Auto-Encoder Networks (CFAN) for Real-Time Face Alignment, 
+ *   Jie Zhang, Shiguang Shan, Meina Kan, Xilin Chen. In Proceeding of the
+ *   European Conference on Computer Vision (ECCV), 2014
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Jie Zhang (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cfan.h"
+
+using namespace std;
+
+static const int kPointNum = 5;
+
+// Landmarks farther than this from the reference, in pixels, fail the check
+static const double kDefaultTolerance = 0.05;
+
+// The landmarks on this many threads must be identical to those on a single thread
+static const int kCheckThreads = 3;
+
+// Each step is timed over kTimingRounds rounds of kTimingCalls calls, keeping the fastest round
+static const int kTimingRounds = 5;
+static const int kTimingCalls = 20;
+
+// A synthetic scene with faces of various sizes, one of them crossing the image border
+static const int kSceneWidth = 640;
+static const int kSceneHeight = 480;
+
+struct SyntheticFace {
+  int x;
+  int y;
+  int size;
+  int skin;
+};
+
+static const SyntheticFace kFaces[] = {
+  {24, 24, 48, 170},
+  {100, 30, 64, 150},
+  {200, 20, 96, 185},
+  {330, 16, 140, 160},
+  {500, 40, 80, 140},
+  {30, 200, 200, 175},
+  {270, 230, 120, 155},
+  {420, 250, 110, 180},
+  {580, 380, 100, 165},
+};
+static const int kFaceNum = sizeof(kFaces) / sizeof(kFaces[0]);
+
+// Deterministic noise, so that the scene is the same on every platform
+static uint32_t NextRandom(uint32_t* state) {
+  *state = *state * 1664525u + 1013904223u;
+  return *state >> 16;
+}
+
+static bool InEllipse(double u, double v, double cu, double cv, double ru, double rv) {
+  double du = (u - cu) / ru;
+  double dv = (v - cv) / rv;
+  return du * du + dv * dv <= 1.0;
+}
+
+// Gray level of a face at (u, v), relative to its box, or -1 outside of the face
+static int FaceLevel(const SyntheticFace & face, double u, double v) {
+  if (!InEllipse(u, v, 0.5, 0.52, 0.44, 0.6))
+    return -1;
+  if (InEllipse(u, v, 0.3, 0.4, 0.07, 0.04) || InEllipse(u, v, 0.7, 0.4, 0.07, 0.04))
+    return 40;
+  if (v > 0.29 && v < 0.33 && ((u > 0.18 && u < 0.42) || (u > 0.58 && u < 0.82)))
+    return 70;
+  if (InEllipse(u, v, 0.45, 0.64, 0.03, 0.02) || InEllipse(u, v, 0.55, 0.64, 0.03, 0.02))
+    return 80;
+  if (InEllipse(u, v, 0.5, 0.79, 0.16, 0.035))
+    return 60;
+  int level = face.skin - static_cast<int>(60 * fabs(u - 0.5));
+  if (u > 0.47 && u < 0.53 && v > 0.42 && v < 0.62)
+    level -= 30;
+  return level;
+}
+
+static void DrawScene(vector<unsigned char>* image, vector<seeta::FaceInfo>* faces) {
+  image->resize(kSceneWidth * kSceneHeight);
+  uint32_t state = 12345u;
+  for (int y = 0; y < kSceneHeight; y++) {
+    for (int x = 0; x < kSceneWidth; x++) {
+      int level = 90 + (x + 2 * y) / 16 + static_cast<int>(NextRandom(&state) % 17) - 8;
+      (*image)[y * kSceneWidth + x] = static_cast<unsigned char>(level);
+    }
+  }
+
+  for (int n = 0; n < kFaceNum; n++) {
+    const SyntheticFace & face = kFaces[n];
+    int right = min(face.x + face.size, kSceneWidth);
+    int bottom = min(face.y + face.size, kSceneHeight);
+    for (int y = face.y; y < bottom; y++) {
+      for (int x = face.x; x < right; x++) {
+        int level = FaceLevel(face, (x - face.x + 0.5) / face.size,
+          (y - face.y + 0.5) / face.size);
+        if (level < 0)
+          continue;
+        level += static_cast<int>(NextRandom(&state) % 9) - 4;
+        (*image)[y * kSceneWidth + x] =
+          static_cast<unsigned char>(max(0, min(255, level)));
+      }
+    }
+
+    seeta::FaceInfo info;
+    info.bbox.x = face.x;
+    info.bbox.y = face.y;
+    info.bbox.width = face.size;
+    info.bbox.height = face.size;
+    info.roll = info.pitch = info.yaw = 0;
+    info.score = 0;
+    faces->push_back(info);
+  }
+}
+
+// Minimum over the rounds of the mean time of one call, in microseconds
+template <typename Func>
+static double MinMicroseconds(Func func) {
+  double best = 0;
+  for (int r = 0; r < kTimingRounds; r++) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int c = 0; c < kTimingCalls; c++)
+      func();
+    double us = chrono::duration<double, micro>(
+      chrono::steady_clock::now() - start).count() / kTimingCalls;
+    if (r == 0 || us < best)
+      best = us;
+  }
+  return best;
+}
+
+// Runs and times the steps of CCFAN::FacialPointLocate, which are private
+class CCFANBenchmark {
+ public:
+  explicit CCFANBenchmark(CCFAN* cfan) : cfan_(cfan) {}
+
+  void Locate(const vector<unsigned char> & image, const vector<seeta::FaceInfo> & faces,
+      vector<float>* points) {
+    seeta::ImageView view(image.data(), kSceneWidth, kSceneHeight, kSceneWidth);
+    points->resize(faces.size() * kPointNum * 2);
+    for (size_t n = 0; n < faces.size(); n++)
+      cfan_->FacialPointLocate(view, faces[n], &(*points)[n * kPointNum * 2]);
+  }
+
+  void LocateBatch(const vector<unsigned char> & image, const vector<seeta::FaceInfo> & faces,
+      vector<float>* points) {
+    seeta::ImageView view(image.data(), kSceneWidth, kSceneHeight, kSceneWidth);
+    points->resize(faces.size() * kPointNum * 2);
+    cfan_->FacialPointLocateBatch(view, faces.data(), static_cast<int>(faces.size()),
+      points->data());
+  }
+
+  // Prints whether the landmarks on 1 and kCheckThreads threads, face by face and as one
+  // batch, are identical bit for bit to the given ones
+  bool CheckDeterminism(const vector<unsigned char> & image,
+      const vector<seeta::FaceInfo> & faces, const vector<float> & points) {
+    int threads[2] = {1, kCheckThreads};
+    int diff_num = 0;
+    for (int t = 0; t < 2; t++) {
+      cfan_->SetNumThreads(threads[t]);
+      vector<float> single_points;
+      vector<float> batch_points;
+      Locate(image, faces, &single_points);
+      LocateBatch(image, faces, &batch_points);
+      for (size_t k = 0; k < points.size(); k++) {
+        diff_num += (memcmp(&single_points[k], &points[k], sizeof(float)) != 0);
+        diff_num += (memcmp(&batch_points[k], &points[k], sizeof(float)) != 0);
+      }
+    }
+    bool passed = (diff_num == 0);
+    cout << "Landmarks with " << (cfan_->use_int8_ ? "int8" : "float32") << " weights on 1 and "
+         << kCheckThreads << " threads, face by face and as one batch: " << diff_num
+         << " coordinates differ: " << (passed ? "PASSED" : "FAILED") << endl;
+    return passed;
+  }
+
+  // Prints the time per face of each step, averaged over the faces
+  void Time(const vector<unsigned char> & image, const vector<seeta::FaceInfo> & faces) {
+    const CFANModel & model = *cfan_->model_;
+    CCFAN::Context* context = cfan_->GetContext();
+    seeta::ImageView view(image.data(), kSceneWidth, kSceneHeight, kSceneWidth);
+    int sizes[2] = {model.lan1_resize_size, model.lan2_resize_size};
+
+    double locate_us = 0;
+    double resize_us[2] = {0, 0};
+    double sift_us[2] = {0, 0};
+    double network_us[2] = {0, 0};
+    double patch_us = 0;
+    vector<float> shape(kPointNum * 2);
+    vector<float> fea(model.fea_dim);
+    vector<float> shape_inc(kPointNum * 2);
+    vector<float> patch_fea(128);
+    vector<float> points(kPointNum * 2);
+
+    for (size_t n = 0; n < faces.size(); n++) {
+      seeta::FaceInfo face = faces[n];
+      locate_us += MinMicroseconds([&]() {
+        cfan_->FacialPointLocate(view, face, points.data());
+      });
+
+      int region[4];
+      cfan_->GetFaceRegion(kSceneWidth, kSceneHeight, face, region);
+      seeta::ImageView face_view(image.data() + region[1] * kSceneWidth + region[0],
+        region[2], region[3], kSceneWidth);
+      unsigned char* patch = context->resized_patch.data();
+
+      for (int s = 0; s < 2; s++) {
+        int size = sizes[s];
+        resize_us[s] += MinMicroseconds([&]() {
+          cfan_->ResizeImage(face_view, patch, size, size, context);
+        });
+
+        // The mean shape scaled to the face patch, as the starting shape of both networks
+        float scale = float(size) / model.lan1_resize_size;
+        for (int i = 0; i < kPointNum * 2; i++)
+          shape[i] = (model.mean_shape[i] - 1) * scale;
+        sift_us[s] += MinMicroseconds([&]() {
+          cfan_->TtSift(patch, size, size, shape.data(), model.sift_patch_size,
+            context->sift_fea.data(), context);
+        });
+
+        if (s == 1) {
+          // One SIFT feature of the patch around the nose tip
+          cfan_->GetSubImg(patch, size, size, shape[4], shape[5], model.sift_patch_size,
+            context->sub_img.data());
+          patch_us += MinMicroseconds([&]() {
+            model.sift_extractor.CalcSIFT(context->sub_img.data(), patch_fea.data(),
+              &context->sift_workspace);
+          });
+        }
+
+        cfan_->ShapeIndexedFeature(view, region, size, size, shape.data(),
+          fea.data(), context);
+        network_us[s] += MinMicroseconds([&]() {
+          cfan_->RunNetwork(s, fea.data(), 1, shape_inc.data());
+        });
+      }
+    }
+
+    double face_num = static_cast<double>(faces.size());
+    cout << "Time per face over " << faces.size() << " faces with "
+         << (cfan_->use_int8_ ? "int8" : "float32") << " weights (us):" << endl;
+    cout << fixed << setprecision(1);
+    cout << "  FacialPointLocate      " << setw(8) << locate_us / face_num << endl;
+    for (int s = 0; s < 2; s++) {
+      cout << "  Stage " << s + 1 << " (" << sizes[s] << "x" << sizes[s] << ")" << endl;
+      cout << "    ResizeImage          " << setw(8) << resize_us[s] / face_num << endl;
+      cout << "    TtSift               " << setw(8) << sift_us[s] / face_num << endl;
+      cout << "    ForwardNetwork       " << setw(8) << network_us[s] / face_num << endl;
+    }
+    cout << "  SIFT::CalcSIFT, 1 patch" << setw(8) << patch_us / face_num << endl;
+  }
+
+ private:
+  CCFAN* cfan_;
+};
+
+static bool WriteReference(const char* path, const vector<float> & points) {
+  ofstream file(path);
+  if (!file.is_open())
+    return false;
+  file << "# fa_align_benchmark reference: the x and y of the " << kPointNum
+       << " landmarks of each synthetic face" << endl;
+  file << fixed << setprecision(4);
+  for (int n = 0; n < kFaceNum; n++) {
+    file << n;
+    for (int i = 0; i < kPointNum * 2; i++)
+      file << " " << points[n * kPointNum * 2 + i];
+    file << endl;
+  }
+  return file.good();
+}
+
+static bool ReadReference(const char* path, vector<float>* points) {
+  ifstream file(path);
+  if (!file.is_open())
+    return false;
+  points->assign(kFaceNum * kPointNum * 2, 0);
+  vector<bool> found(kFaceNum, false);
+  string line;
+  while (getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    istringstream fields(line);
+    int n;
+    if (!(fields >> n) || n < 0 || n >= kFaceNum)
+      return false;
+    for (int i = 0; i < kPointNum * 2; i++) {
+      if (!(fields >> (*points)[n * kPointNum * 2 + i]))
+        return false;
+    }
+    found[n] = true;
+  }
+  return find(found.begin(), found.end(), false) == found.end();
+}
+
+// Prints the error of the landmarks with 8-bit weights against those with float weights
+static void ReportInt8Error(const vector<float> & points, const vector<float> & int8_points) {
+  double max_error = 0;
+  double sum_error = 0;
+  double sum_relative = 0;
+  double max_relative = 0;
+  for (int n = 0; n < kFaceNum; n++) {
+    const float* ref = &points[n * kPointNum * 2];
+    double eye_distance = hypot(ref[2] - ref[0], ref[3] - ref[1]);
+    for (int i = 0; i < kPointNum; i++) {
+      int k = (n * kPointNum + i) * 2;
+      double error = hypot(int8_points[k] - points[k], int8_points[k + 1] - points[k + 1]);
+      sum_error += error;
+      max_error = max(max_error, error);
+      sum_relative += error / eye_distance;
+      max_relative = max(max_relative, error / eye_distance);
+    }
+  }
+  cout << setprecision(4) << "Landmark error of int8 against float32 weights: mean "
+       << sum_error / (kFaceNum * kPointNum) << " px, max " << max_error << " px; mean "
+       << 100 * sum_relative / (kFaceNum * kPointNum) << "%, max " << 100 * max_relative
+       << "% of the inter-ocular distance" << endl;
+}
+
+// Prints the largest distance of a landmark from its reference, and whether it is within tolerance
+static bool CheckReference(const vector<float> & points, const vector<float> & reference,
+    double tolerance) {
+  double max_error = 0;
+  int worst_face = 0;
+  int worst_point = 0;
+  for (int n = 0; n < kFaceNum; n++) {
+    for (int i = 0; i < kPointNum; i++) {
+      int k = (n * kPointNum + i) * 2;
+      double error = hypot(points[k] - reference[k], points[k + 1] - reference[k + 1]);
+      if (error > max_error) {
+        max_error = error;
+        worst_face = n;
+        worst_point = i;
+      }
+    }
+  }
+  bool passed = (max_error <= tolerance);
+  cout << setprecision(5) << "Largest deviation from the reference: " << max_error
+       << " px (face " << worst_face << ", point " << worst_point << "), tolerance "
+       << tolerance << " px: " << (passed ? "PASSED" : "FAILED") << endl;
+  return passed;
+}
+
+int main(int argc, char** argv) {
+  bool update = (argc >= 4 && string(argv[2]) == "--update");
+  if (argc < 2 || (argc >= 3 && !update && argc > 4)) {
+    cerr << "Usage: " << argv[0] << " alignment_model [reference_file [tolerance]]" << endl
+         << "       " << argv[0] << " alignment_model --update reference_file" << endl;
+    return 1;
+  }
+
+  CCFAN cfan;
+  if (!cfan.InitModel(argv[1])) {
+    cerr << "Failed to load the alignment model: " << argv[1] << endl;
+    return 1;
+  }
+
+  vector<unsigned char> image;
+  vector<seeta::FaceInfo> faces;
+  DrawScene(&image, &faces);
+
+  CCFANBenchmark benchmark(&cfan);
+  vector<float> points;
+  benchmark.Locate(image, faces, &points);
+
+  if (update) {
+    if (!WriteReference(argv[3], points)) {
+      cerr << "Failed to write the reference: " << argv[3] << endl;
+      return 1;
+    }
+    cout << "Reference landmarks written to " << argv[3] << endl;
+    return 0;
+  }
+
+  benchmark.Time(image, faces);
+
+  CCFAN int8_cfan;
+  int8_cfan.InitModel(argv[1]);
+  int8_cfan.SetInt8Weights(true);
+  CCFANBenchmark int8_benchmark(&int8_cfan);
+  vector<float> int8_points;
+  int8_benchmark.Locate(image, faces, &int8_points);
+  int8_benchmark.Time(image, faces);
+  ReportInt8Error(points, int8_points);
+
+  bool is_deterministic = benchmark.CheckDeterminism(image, faces, points);
+  is_deterministic = int8_benchmark.CheckDeterminism(image, faces, int8_points) &&
+    is_deterministic;
+  if (argc < 3)
+    return is_deterministic ? 0 : 1;
+
+  vector<float> reference;
+  if (!ReadReference(argv[2], &reference)) {
+    cerr << "Failed to read the reference: " << argv[2] << endl;
+    return 1;
+  }
+  double tolerance = (argc > 3 ? atof(argv[3]) : kDefaultTolerance);
+  return CheckReference(points, reference, tolerance) && is_deterministic ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Alignment module, containing codes implementing the
+ * facial landmarks location method described in the following paper:
+ *
+ *
+ *   Coarse-to-Fine Auto-Encoder Networks (CFAN) for Real-Time Face Alignment, 
+ *   Jie Zhang, Shiguang Shan, Meina Kan, Xilin Chen. In Proceeding of the
+ *   European Conference on Computer Vision (ECCV), 2014
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Jie Zhang (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "face_detection.h"
+#include "face_alignment.h"
+
+using namespace std;
+
+static const int kPointNum = 5;
+static const char* kPointNames[kPointNum] = {"LE", "RE", "N", "LM", "RM"};
+
+// Fast-mode errors above this fraction of the inter-ocular distance count as failures
+static const double kFailureError = 0.1;
+
+static bool LoadImageList(const char* list_path, vector<cv::Mat>* images) {
+  ifstream list(list_path);
+  if (!list.is_open())
+    return false;
+
+  string path;
+  while (getline(list, path)) {
+    if (path.empty())
+      continue;
+    cv::Mat img = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    if (img.empty()) {
+      cerr << "Failed to read image: " << path << endl;
+      continue;
+    }
+    images->push_back(img);
+  }
+  return true;
+}
+
+static seeta::ImageData ToImageData(const cv::Mat & img) {
+  seeta::ImageData img_data(img.cols, img.rows, 1);
+  img_data.data = img.data;
+  return img_data;
+}
+
+static void TimedLandmarks(seeta::FaceAlignment* aligner,
+    const seeta::ImageData & img, const vector<seeta::FaceInfo> & faces,
+    vector<seeta::FacialLandmark>* points, double* secs) {
+  points->resize(faces.size() * kPointNum);
+  int64_t t0 = cv::getTickCount();
+  for (size_t i = 0; i < faces.size(); i++)
+    aligner->PointDetectLandmarks(img, faces[i], &(*points)[i * kPointNum]);
+  int64_t t1 = cv::getTickCount();
+  *secs += (t1 - t0) / cv::getTickFrequency();
+}
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    cout << "Usage: " << argv[0]
+        << " detection_model alignment_model image_list [min_face_size]"
+        << endl;
+    return -1;
+  }
+
+  vector<cv::Mat> images;
+  if (!LoadImageList(argv[3], &images)) {
+    cerr << "Failed to open the image list." << endl;
+    return -1;
+  }
+
+  seeta::FaceDetection detector(argv[1]);
+  detector.SetMinFaceSize(argc > 4 ? atoi(argv[4]) : 40);
+  detector.SetScoreThresh(2.f);
+  detector.SetImagePyramidScaleFactor(0.8f);
+  detector.SetWindowStep(4, 4);
+
+  seeta::FaceAlignment aligner(argv[2]);
+
+  // The landmarks of the full mode are the reference, errors being normalized
+  // by their inter-ocular distance
+  double full_secs = 0;
+  double fast_secs = 0;
+  int32_t num_faces = 0;
+  int32_t num_failures = 0;
+  double sum_error[kPointNum] = {0};
+  double max_error[kPointNum] = {0};
+  double sum_face_error = 0;
+
+  for (size_t i = 0; i < images.size(); i++) {
+    seeta::ImageData img_data = ToImageData(images[i]);
+    vector<seeta::FaceInfo> faces = detector.Detect(img_data);
+
+    vector<seeta::FacialLandmark> full_points;
+    vector<seeta::FacialLandmark> fast_points;
+    aligner.SetQualityLevel(seeta::ALIGNMENT_FULL);
+    TimedLandmarks(&aligner, img_data, faces, &full_points, &full_secs);
+    aligner.SetQualityLevel(seeta::ALIGNMENT_FAST);
+    TimedLandmarks(&aligner, img_data, faces, &fast_points, &fast_secs);
+
+    for (size_t f = 0; f < faces.size(); f++) {
+      const seeta::FacialLandmark* full = &full_points[f * kPointNum];
+      const seeta::FacialLandmark* fast = &fast_points[f * kPointNum];
+      double inter_ocular = hypot(full[1].x - full[0].x, full[1].y - full[0].y);
+      if (inter_ocular <= 0)
+        continue;
+
+      double face_error = 0;
+      for (int p = 0; p < kPointNum; p++) {
+        double error = hypot(fast[p].x - full[p].x, fast[p].y - full[p].y) /
+            inter_ocular;
+        sum_error[p] += error;
+        max_error[p] = max(max_error[p], error);
+        face_error += error / kPointNum;
+      }
+      sum_face_error += face_error;
+      num_failures += (face_error > kFailureError);
+      num_faces++;
+    }
+  }
+
+  if (num_faces == 0) {
+    cerr << "No faces detected." << endl;
+    return -1;
+  }
+
+  cout << "Faces: " << num_faces << " in " << images.size() << " images" << endl;
+  cout << "Fast-mode error against full mode, relative to the inter-ocular distance:"
+      << endl;
+  for (int p = 0; p < kPointNum; p++) {
+    cout << "  " << kPointNames[p] << ": mean " << sum_error[p] / num_faces
+        << ", max " << max_error[p] << endl;
+  }
+  cout << "  All points: mean " << sum_face_error / num_faces << ", failures (> "
+      << kFailureError << ") " << num_failures << endl;
+  cout << "Time per face: full " << full_secs * 1000 / num_faces << " ms, fast "
+      << fast_secs * 1000 / num_faces << " ms" << endl;
+  return 0;
+}
@@ -32,6 +32,8 @@
 #ifndef SEETA_FD_CLASSIFIER_H_
 #define SEETA_FD_CLASSIFIER_H_
 
+#include <memory>
+
 #include "common.h"
 #include "feature_map.h"
 
@@ -53,6 +55,14 @@ class Classifier {
   
   virtual seeta::fd::ClassifierType type() = 0;
 
+  /**
+   * @brief Create a classifier sharing the (read-only) model parameters.
+   *
+   * The clone has its own working buffers, so that it can be run concurrently
+   * with the original one. Its feature map has to be set separately.
+   */
+  virtual std::shared_ptr<seeta::fd::Classifier> Clone() const = 0;
+
   DISABLE_COPY_AND_ASSIGN(Classifier);
 };
 
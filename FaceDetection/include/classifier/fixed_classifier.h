@@ -0,0 +1,240 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#ifndef SEETA_FD_CLASSIFIER_FIXED_CLASSIFIER_H_
+#define SEETA_FD_CLASSIFIER_FIXED_CLASSIFIER_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "classifier.h"
+#include "feat/lab_feature_map.h"
+#include "feat/surf_feature_map.h"
+#include "util/math_func.h"
+
+namespace seeta {
+namespace fd {
+
+/**
+ * @class FixedLABBoostedClassifier
+ * @brief LABBoostedClassifier with the sizes fixed at compile time.
+ *
+ * The parameters are read-only tables owned by the caller (usually generated
+ * by the `fust_codegen` tool), so that copies share them.
+ */
+template <int32_t kNumBaseClassifier, int32_t kNumBin, int32_t kFeatGroupSize>
+class FixedLABBoostedClassifier : public Classifier {
+  static_assert(kNumBaseClassifier % kFeatGroupSize == 0,
+    "base classifiers should form complete groups");
+
+ public:
+  FixedLABBoostedClassifier(const seeta::fd::LABFeature* feat,
+      const float (*weights)[kNumBin + 1], const float* thresh)
+      : feat_(feat), weights_(weights), thresh_(thresh), feat_map_(nullptr) {}
+
+  virtual ~FixedLABBoostedClassifier() {}
+
+  virtual bool Classify(float* score = nullptr, float* outputs = nullptr) {
+    bool isPos = true;
+    float s = 0.0f;
+
+    for (int32_t i = 0; i < kNumBaseClassifier; i += kFeatGroupSize) {
+      for (int32_t j = i; j < i + kFeatGroupSize; j++) {
+        uint8_t featVal = feat_map_->GetFeatureVal(feat_[j].x, feat_[j].y);
+        s += weights_[j][featVal];
+      }
+      if (s < thresh_[i + kFeatGroupSize - 1]) {
+        isPos = false;
+        break;
+      }
+    }
+    isPos = isPos && feat_map_->GetStdDev() > kStdDevThresh;
+
+    if (score != nullptr)
+      *score = s;
+    if (outputs != nullptr)
+      *outputs = s;
+
+    return isPos;
+  }
+
+  inline virtual void SetFeatureMap(seeta::fd::FeatureMap* feat_map) {
+    feat_map_ = dynamic_cast<seeta::fd::LABFeatureMap*>(feat_map);
+  }
+
+  inline virtual seeta::fd::ClassifierType type() {
+    return seeta::fd::ClassifierType::LAB_Boosted_Classifier;
+  }
+
+  virtual std::shared_ptr<seeta::fd::Classifier> Clone() const {
+    return std::shared_ptr<seeta::fd::Classifier>(
+      new FixedLABBoostedClassifier(feat_, weights_, thresh_));
+  }
+
+ private:
+  static constexpr float kStdDevThresh = 10.0f;
+
+  const seeta::fd::LABFeature* feat_;
+  const float (*weights_)[kNumBin + 1];
+  const float* thresh_;
+  seeta::fd::LABFeatureMap* feat_map_;
+};
+
+/**
+ * Input of the first layer of a fixed MLP, given as the feature vectors of
+ * the SURF feature map in place.
+ */
+typedef struct SegmentedInput {
+  const float* const* seg;
+  int32_t seg_len;
+} SegmentedInput;
+
+/**
+ * @brief Layers of an MLP with dimensions `kDims`, computed exactly as
+ *        `MLP::Compute()`: ReLU on the hidden layers, sigmoid on the output.
+ */
+template <int32_t... kDims>
+struct FixedMLPLayers;
+
+template <int32_t kInputDim, int32_t kOutputDim>
+struct FixedMLPLayers<kInputDim, kOutputDim> {
+  static const int32_t kOutDim = kOutputDim;
+
+  template <typename InputType>
+  static inline void Compute(const InputType & input,
+      const float* const* weights, const float* const* bias, float* output) {
+    for (int32_t i = 0; i < kOutputDim; i++) {
+      float val = InnerProduct(input, weights[0] + i * kInputDim) + bias[0][i];
+      output[i] = 1.0f / (1.0f + std::exp(-val));
+    }
+  }
+
+  static inline float InnerProduct(const float* input, const float* weights) {
+    return seeta::fd::MathFunction::VectorInnerProduct(input, weights,
+      kInputDim);
+  }
+
+  static inline float InnerProduct(const SegmentedInput & input,
+      const float* weights) {
+    return seeta::fd::MathFunction::VectorInnerProduct(input.seg,
+      input.seg_len, weights, kInputDim);
+  }
+};
+
+template <int32_t kInputDim, int32_t kHiddenDim, int32_t... kRest>
+struct FixedMLPLayers<kInputDim, kHiddenDim, kRest...> {
+  static const int32_t kOutDim = FixedMLPLayers<kHiddenDim, kRest...>::kOutDim;
+
+  template <typename InputType>
+  static inline void Compute(const InputType & input,
+      const float* const* weights, const float* const* bias, float* output) {
+    float hidden[kHiddenDim];
+    for (int32_t i = 0; i < kHiddenDim; i++) {
+      float val = FixedMLPLayers<kInputDim, kHiddenDim>::InnerProduct(input,
+        weights[0] + i * kInputDim) + bias[0][i];
+      hidden[i] = (val > 0.0f ? val : 0.0f);
+    }
+    FixedMLPLayers<kHiddenDim, kRest...>::Compute(
+      static_cast<const float*>(hidden), weights + 1, bias + 1, output);
+  }
+};
+
+/**
+ * @class FixedSURFMLP
+ * @brief SURFMLP with the feature dimension and the layer dimensions `kDims`
+ *        fixed at compile time.
+ *
+ * The feature vectors are fed to the network in place, as in `SURFMLP`. The
+ * parameters are read-only tables owned by the caller.
+ */
+template <int32_t kFeatDim, int32_t kInputDim, int32_t... kDims>
+class FixedSURFMLP : public Classifier {
+  static_assert(kFeatDim % 4 == 0 && kInputDim % kFeatDim == 0,
+    "input should consist of whole feature vectors of length divisible by 4");
+
+ public:
+  FixedSURFMLP(const int32_t* feat_id, const float* const* weights,
+      const float* const* bias, float thresh)
+      : feat_id_(feat_id), weights_(weights), bias_(bias), thresh_(thresh),
+        feat_map_(nullptr) {}
+
+  virtual ~FixedSURFMLP() {}
+
+  virtual bool Classify(float* score = nullptr, float* outputs = nullptr) {
+    const float* feat_vec[kNumFeat];
+    float output[kOutputDim];
+    SegmentedInput input;
+
+    for (int32_t i = 0; i < kNumFeat; i++)
+      feat_vec[i] = feat_map_->GetFeatureVector(feat_id_[i] - 1);
+    input.seg = feat_vec;
+    input.seg_len = kFeatDim;
+    FixedMLPLayers<kInputDim, kDims...>::Compute(input, weights_, bias_,
+      output);
+
+    if (score != nullptr)
+      *score = output[0];
+    if (outputs != nullptr)
+      std::memcpy(outputs, output, kOutputDim * sizeof(float));
+
+    return (output[0] > thresh_);
+  }
+
+  inline virtual void SetFeatureMap(seeta::fd::FeatureMap* feat_map) {
+    feat_map_ = dynamic_cast<seeta::fd::SURFFeatureMap*>(feat_map);
+  }
+
+  inline virtual seeta::fd::ClassifierType type() {
+    return seeta::fd::ClassifierType::SURF_MLP;
+  }
+
+  virtual std::shared_ptr<seeta::fd::Classifier> Clone() const {
+    return std::shared_ptr<seeta::fd::Classifier>(
+      new FixedSURFMLP(feat_id_, weights_, bias_, thresh_));
+  }
+
+ private:
+  static const int32_t kNumFeat = kInputDim / kFeatDim;
+  static const int32_t kOutputDim = FixedMLPLayers<kInputDim, kDims...>::kOutDim;
+
+  const int32_t* feat_id_;
+  const float* const* weights_;
+  const float* const* bias_;
+  float thresh_;
+  seeta::fd::SURFFeatureMap* feat_map_;
+};
+
+}  // namespace fd
+}  // namespace seeta
+
+#endif  // SEETA_FD_CLASSIFIER_FIXED_CLASSIFIER_H_
@@ -86,6 +86,8 @@ class LABBoostedClassifier : public Classifier {
     return seeta::fd::ClassifierType::LAB_Boosted_Classifier;
   }
 
+  virtual std::shared_ptr<seeta::fd::Classifier> Clone() const;
+
   void AddFeature(int32_t x, int32_t y);
   void AddBaseClassifier(const float* weights, int32_t num_bin, float thresh);
 
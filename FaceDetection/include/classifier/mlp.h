@@ -46,11 +46,54 @@ namespace fd {
 class MLPLayer {
  public:
   explicit MLPLayer(int32_t act_func_type = 1)
-      : input_dim_(0), output_dim_(0), act_func_type_(act_func_type) {}
+      : input_dim_(0), output_dim_(0), act_func_type_(act_func_type),
+        is_calibrating_(false), max_abs_input_(0.0f), input_scale_(0.0f),
+        use_quantized_(false) {}
   ~MLPLayer() {}
 
   void Compute(const float* input, float* output);
 
+  /**
+   * @brief Compute the layer on an input given as segments of length
+   *        `seg_len` (divisible by 4) lying in separate buffers.
+   */
+  void Compute(const float* const* input, int32_t seg_len, float* output);
+
+  /**
+   * @brief Compute the layer with int8 weights on an input quantized by
+   *        `QuantizeInput()`. The sigmoid is approximated by a table.
+   */
+  void ComputeQuantized(const int16_t* input, float* output) const;
+
+  void QuantizeInput(const float* input, int16_t* input_q) const;
+  void QuantizeInput(const float* const* input, int32_t seg_len,
+    int16_t* input_q) const;
+
+  /**
+   * @brief Record the range of the inputs seen by `Compute()`, from which
+   *        `Quantize()` derives the scale of the quantized inputs.
+   */
+  inline void SetCalibration(bool enable) {
+    if (enable && !is_calibrating_)
+      max_abs_input_ = 0.0f;
+    is_calibrating_ = enable;
+  }
+
+  /**
+   * @brief Quantize the weights to int8 with one scale per output, and set
+   *        the input scale from the calibrated range.
+   *
+   * Returns false if no input has been recorded.
+   */
+  bool Quantize();
+
+  inline bool is_quantized() const { return !weights_q_.empty(); }
+  inline bool use_quantized() const { return use_quantized_; }
+
+  inline void SetUseQuantized(bool enable) {
+    use_quantized_ = enable && is_quantized();
+  }
+
   inline int32_t GetInputDim() const { return input_dim_; }
   inline int32_t GetOutputDim() const { return output_dim_; }
 
@@ -79,29 +122,59 @@ class MLPLayer {
   }
 
  private:
-  inline float Sigmoid(float x) {
+  inline float Sigmoid(float x) const {
     return 1.0f / (1.0f + std::exp(x));
   }
 
-  inline float ReLU(float x) {
+  inline float ReLU(float x) const {
     return (x > 0.0f ? x : 0.0f);
   }
 
+  /**
+   * Sigmoid by linear interpolation in a table over [-16, 16], with an
+   * absolute error below 1e-4.
+   */
+  float FastSigmoid(float x) const;
+
+  void QuantizeValues(const float* input, int32_t len, int16_t* input_q) const;
+  void UpdateInputRange(float max_abs_input);
+
+  // Bound of the quantized inputs, small enough for the int32 accumulation
+  // of 512-dimensional products with int8 weights not to overflow
+  static const int32_t kMaxQuantizedInput = 16383;
+
  private:
   int32_t act_func_type_;
   int32_t input_dim_;
   int32_t output_dim_;
   std::vector<float> weights_;
   std::vector<float> bias_;
+
+  bool is_calibrating_;
+  float max_abs_input_;
+
+  std::vector<int8_t> weights_q_;
+  std::vector<float> weights_scale_;
+  float input_scale_;
+  bool use_quantized_;
 };
 
 
+/**
+ * @class MLP
+ * @brief Multi-layer perceptron.
+ *
+ * Copies share the (read-only) layers, but have their own buffers of the
+ * intermediate results, so that they can be computed concurrently. Settings
+ * of calibration and quantization apply to the shared layers.
+ */
 class MLP {
  public:
   MLP() {}
   ~MLP() {}
 
   void Compute(const float* input, float* output);
+  void Compute(const float* const* input, int32_t seg_len, float* output);
 
   inline int32_t GetInputDim() const {
     return layers_[0]->GetInputDim();
@@ -118,9 +191,18 @@ class MLP {
   void AddLayer(int32_t inputDim, int32_t outputDim, const float* weights,
       const float* bias, bool is_output = false);
 
+  void SetCalibration(bool enable);
+  bool Quantize();
+  void SetUseQuantized(bool enable);
+  bool is_quantized() const;
+
  private:
+  void ComputeHiddenLayers(float* output);
+  void ComputeLayer(int32_t idx, const float* input, float* output);
+
   std::vector<std::shared_ptr<seeta::fd::MLPLayer> > layers_;
   std::vector<float> layer_buf_[2];
+  std::vector<int16_t> input_q_buf_;
 };
 
 }  // namespace fd
@@ -57,15 +57,24 @@ class SURFMLP : public Classifier {
     return seeta::fd::ClassifierType::SURF_MLP;
   }
 
+  virtual std::shared_ptr<seeta::fd::Classifier> Clone() const;
+
   void AddFeatureByID(int32_t feat_id);
   void AddLayer(int32_t input_dim, int32_t output_dim, const float* weights,
     const float* bias, bool is_output = false);
 
   inline void SetThreshold(float thresh) { thresh_ = thresh; }
 
+  /** @brief Calibration and quantization of the network, see `MLPLayer`. */
+  inline void SetCalibration(bool enable) { model_->SetCalibration(enable); }
+  inline bool Quantize() { return model_->Quantize(); }
+  inline void SetUseQuantized(bool enable) { model_->SetUseQuantized(enable); }
+  inline bool is_quantized() const { return model_->is_quantized(); }
+
  private:
   std::vector<int32_t> feat_id_;
   std::vector<float> input_buf_;
+  std::vector<const float*> feat_vec_;
   std::vector<float> output_buf_;
 
   std::shared_ptr<seeta::fd::MLP> model_;
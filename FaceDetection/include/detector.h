@@ -42,16 +42,49 @@
 namespace seeta {
 namespace fd {
 
+/**
+ * @brief Separate regions of an image to detect faces in, e.g. the images
+ * packed into an atlas.
+ *
+ * The proposals of the first stage are kept only if they lie inside a region.
+ * The following classifiers of a window read the pixels of its region only,
+ * with zeros outside of it as outside of a single image, and the non-maximum
+ * suppression runs on each region apart.
+ */
+class WindowFilter {
+ public:
+  virtual ~WindowFilter() {}
+  virtual int32_t num_region() const = 0;
+  virtual seeta::Rect region(int32_t idx) const = 0;
+  /** Index of the region a proposal lies inside, or -1 to drop it */
+  virtual int32_t Accept(const seeta::Rect & bbox) const = 0;
+};
+
 class Detector {
  public:
   Detector() {}
   virtual ~Detector() {}
 
   virtual bool LoadModel(const std::string & model_path) = 0;
+  virtual bool AddModel(const std::string & model_path) { return false; }
   virtual std::vector<seeta::FaceInfo> Detect(seeta::fd::ImagePyramid* img_pyramid) = 0;
 
+  /**
+   * @brief Detect faces in each region of the filter, on a pyramid of the
+   *        whole image. The i-th result holds the faces of the i-th region,
+   *        in the coordinates of the image.
+   */
+  virtual std::vector<std::vector<seeta::FaceInfo> > DetectRegions(
+      seeta::fd::ImagePyramid* img_pyramid,
+      const seeta::fd::WindowFilter & filter) = 0;
+
   virtual void SetWindowSize(int32_t size) {}
   virtual void SetSlideWindowStep(int32_t step_x, int32_t step_y) {}
+  virtual void SetStreamingFeatureMap(bool enable) {}
+
+  virtual void SetMLPCalibration(bool enable) {}
+  virtual bool QuantizeMLP() { return false; }
+  virtual void SetQuantizedMLP(bool enable) {}
 
   DISABLE_COPY_AND_ASSIGN(Detector);
 };
@@ -39,6 +39,28 @@
 
 namespace seeta {
 
+/**
+ * @brief A gray-scale image prepared by `FaceDetection::Prepare()` for
+ *        repeated detection.
+ *
+ * It holds a copy of the image, together with the image pyramid levels and
+ * the feature maps of the first stage computed on them by detections run on
+ * it, so that later detections with other thresholds or face size ranges
+ * only compute the levels not seen before.
+ */
+class PreparedImage {
+ public:
+  SEETA_API PreparedImage();
+  SEETA_API ~PreparedImage();
+
+  DISABLE_COPY_AND_ASSIGN(PreparedImage);
+
+ private:
+  friend class FaceDetection;
+  class Impl;
+  Impl* impl_;
+};
+
 class FaceDetection {
  public:
   SEETA_API explicit FaceDetection(const char* model_path);
@@ -53,6 +75,50 @@ class FaceDetection {
    */
   SEETA_API std::vector<seeta::FaceInfo> Detect(const seeta::ImageData & img);
 
+  /**
+   * @brief Prepare an image for repeated detection, see `PreparedImage`.
+   *
+   * Returns false if the image is not a legal gray-scale image.
+   */
+  SEETA_API bool Prepare(const seeta::ImageData & img,
+    seeta::PreparedImage* prepared);
+
+  /**
+   * @brief Detect faces on a prepared image with the current settings.
+   *
+   * Results are the same as those of `Detect()` on the original image.
+   * Pyramid levels of the same sizes as in previous detections on the image
+   * are reused along with their feature maps, while the others are computed
+   * and kept for later calls.
+   */
+  SEETA_API std::vector<seeta::FaceInfo> Detect(seeta::PreparedImage* prepared);
+
+  /**
+   * @brief Detect faces on a batch of gray-scale images.
+   *
+   * Small images (no larger than 256 x 256) are packed into shared atlases,
+   * separated by guard borders, so that a single pyramid and first-stage pass
+   * serves many of them; larger ones, and an image left alone in an atlas,
+   * go through `Detect()`. The windows of an image never read the pixels of
+   * the others, and the detections of each image are merged by a non-maximum
+   * suppression of its own. The pyramid levels of an atlas are resized from
+   * the whole atlas, however, so that the boxes and scores of an image may
+   * differ slightly from those of `Detect()` on it: a batch of one image gets
+   * exactly the results of `Detect()`. The i-th result holds the faces of
+   * `images[i]`.
+   */
+  SEETA_API std::vector<std::vector<seeta::FaceInfo> > DetectBatch(
+    const std::vector<seeta::ImageData> & images);
+
+  /**
+   * @brief Load an additional detection model, e.g. one for another view.
+   *
+   * All loaded models are run by `Detect()` on a single image pyramid, sharing
+   * the feature maps of their first stages, and their detections are merged
+   * by one non-maximum suppression. Returns false if the model fails to load.
+   */
+  SEETA_API bool AddModel(const char* model_path);
+
   /**
    * @brief Set the minimum size of faces to detect.
    *
@@ -95,6 +161,46 @@ class FaceDetection {
    */
   SEETA_API void SetScoreThresh(float thresh);
 
+  /**
+   * @brief Enable or disable streaming evaluation of the first stage.
+   *
+   * When enabled, LAB features of each pyramid level are computed band by band
+   * just ahead of the sliding window rows being classified, with the buffers
+   * recycled in a ring, instead of materializing the whole feature map before
+   * the scan. Results are identical; the working set of the first stage then
+   * stays in cache regardless of the image size. Disabled by default.
+   */
+  SEETA_API void SetStreamingFeatureMap(bool enable);
+
+  /**
+   * @brief Switch the SURF-MLP stages to 8-bit weights and 16-bit activations.
+   *
+   * The activation range of each layer is calibrated by running `Detect()` on
+   * the given representative images, after which the weights are quantized
+   * per output neuron and the quantized path is enabled. Returns false, with
+   * the floating-point path left in use, if no calibration data is collected.
+   *
+   * Classifiers compiled for the model (`BUILD_SPECIALIZED_DETECTOR`) cannot
+   * be quantized: the SURF-MLP stages then run the generic classifiers during
+   * calibration and while the quantized path is enabled, and the compiled
+   * ones again once it is disabled.
+   *
+   * Detections may change noticeably. `fust_quantization_report` on
+   * `data/0_1_1.jpg`, calibrated on that same image, lost 2 of the 4
+   * floating-point detections at score thresholds 0.5 and 0, and moved the
+   * top score from 17.63 to 20.45. Check the agreement on your own images
+   * before enabling it.
+   */
+  SEETA_API bool CalibrateQuantizedMLP(
+    const std::vector<seeta::ImageData> & images);
+
+  /**
+   * @brief Enable or disable the quantized SURF-MLP stages.
+   *
+   * Only effective after a successful `CalibrateQuantizedMLP()`.
+   */
+  SEETA_API void SetQuantizedMLP(bool enable);
+
   DISABLE_COPY_AND_ASSIGN(FaceDetection);
 
  private:
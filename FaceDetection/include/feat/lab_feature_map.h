@@ -51,22 +51,41 @@ typedef struct LABFeature {
 
 class LABFeatureMap : public seeta::fd::FeatureMap {
  public:
-  LABFeatureMap() : rect_width_(3), rect_height_(3), num_rect_(3) {}
+  LABFeatureMap()
+      : rect_width_(3), rect_height_(3), num_rect_(3), row_mask_(-1),
+        input_(nullptr), num_int_rows_(0) {}
   virtual ~LABFeatureMap() {}
 
   virtual void Compute(const uint8_t* input, int32_t width, int32_t height);
 
+  /**
+   * In streaming mode all the maps are kept in ring buffers holding a power of
+   * two number of rows, which is larger than the window height, so that the
+   * integral image row above a window is still available for GetStdDev().
+   */
+  virtual void BeginStream(const uint8_t* input, int32_t width,
+      int32_t height, int32_t wnd_height);
+  virtual void ComputeRows(int32_t row_end);
+
   inline uint8_t GetFeatureVal(int32_t offset_x, int32_t offset_y) const {
-    return feat_map_[(roi_.y + offset_y) * width_ + roi_.x + offset_x];
+    return feat_map_[RowOffset(roi_.y + offset_y) + roi_.x + offset_x];
   }
 
   float GetStdDev() const;
 
  private:
+  /**< offset of a row in the buffers, wrapped around in streaming mode */
+  inline int32_t RowOffset(int32_t row) const {
+    return (row & row_mask_) * width_;
+  }
+
   void Reshape(int32_t width, int32_t height);
   void ComputeIntegralImages(const uint8_t* input);
+  void ComputeIntegralRow(int32_t row);
   void ComputeRectSum();
+  void ComputeRectSumRow(int32_t row);
   void ComputeFeatureMap();
+  void ComputeFeatureRow(int32_t row);
 
   template<typename Int32Type>
   inline void Integral(Int32Type* data) {
@@ -90,6 +109,10 @@ class LABFeatureMap : public seeta::fd::FeatureMap {
   const int32_t rect_height_;
   const int32_t num_rect_;
 
+  int32_t row_mask_; /**< -1 (no wrapping) if the whole map is computed */
+  const uint8_t* input_;
+  int32_t num_int_rows_;
+
   std::vector<uint8_t> feat_map_;
   std::vector<int32_t> rect_sum_;
   std::vector<int32_t> int_img_;
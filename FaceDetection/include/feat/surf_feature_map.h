@@ -32,6 +32,7 @@
 #ifndef SEETA_FD_FEAT_SURF_FEATURE_MAP_H_
 #define SEETA_FD_FEAT_SURF_FEATURE_MAP_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <vector>
@@ -106,17 +107,14 @@ class SURFFeaturePool {
 
 class SURFFeatureMap : public FeatureMap {
  public:
-  SURFFeatureMap() : buf_valid_reset_(false) { InitFeaturePool(); }
+  SURFFeatureMap() : epoch_(1) { InitFeaturePool(); }
   virtual ~SURFFeatureMap() {}
 
   virtual void Compute(const uint8_t* input, int32_t width, int32_t height);
 
   inline virtual void SetROI(const seeta::Rect & roi) {
     roi_ = roi;
-    if (buf_valid_reset_) {
-      std::memset(buf_valid_.data(), 0, buf_valid_.size() * sizeof(int32_t));
-      buf_valid_reset_ = false;
-    }
+    NextEpoch();
   }
 
   inline int32_t GetFeatureVectorDim(int32_t feat_id) const {
@@ -126,48 +124,54 @@ class SURFFeatureMap : public FeatureMap {
 
   void GetFeatureVector(int32_t featID, float* featVec);
 
+  /**
+   * @brief Get the normalized feature vector of the current ROI in place.
+   *
+   * The returned buffer is owned by the feature map and stays valid until the
+   * ROI or the input image changes.
+   */
+  const float* GetFeatureVector(int32_t feat_id);
+
  private:
+  /**
+   * Cached feature vectors are tagged by the epoch they were computed in, so
+   * that moving to a new ROI invalidates all of them by a single increment.
+   */
+  inline void NextEpoch() {
+    if (++epoch_ == 0) {
+      std::fill(buf_epoch_.begin(), buf_epoch_.end(), 0);
+      epoch_ = 1;
+    }
+  }
+
   void InitFeaturePool();
   void Reshape(int32_t width, int32_t height);
 
-  void ComputeGradientImages(const uint8_t* input);
-  void ComputeGradX(const int32_t* input);
-  void ComputeGradY(const int32_t* input);
-  void ComputeIntegralImages();
-  void Integral();
-  void MaskIntegralChannel();
-
-  inline void FillIntegralChannel(const int32_t* src, int32_t ch) {
-    int32_t* dest = int_img_.data() + ch;
-    int32_t len = width_ * height_;
-    for (int32_t i = 0; i < len; i++) {
-      *dest = *src;
-      *(dest + 2) = *src;
-      dest += kNumIntChannel;
-      src++;
-    }
-  }
+  /**
+   * @brief Compute the masked 8-channel integral image in a single pass.
+   *
+   * Gradients are produced row by row from the input and accumulated into the
+   * integral image directly, without full-size intermediate images.
+   */
+  void ComputeIntegralImages(const uint8_t* input);
+  void ComputeGradientRow(const uint8_t* src, const uint8_t* src_above,
+      const uint8_t* src_below, bool is_inner_row, int32_t* dx, int32_t* dy);
+  void FillIntegralRow(const int32_t* dx, const int32_t* dy,
+      const int32_t* prev_row, int32_t* dest);
 
   void ComputeFeatureVector(const SURFFeature & feat, int32_t* feat_vec);
   void NormalizeFeatureVectorL2(const int32_t* feat_vec, float* feat_vec_normed,
     int32_t len) const;
 
-  /**
-   * Number of channels should be divisible by 4.
-   */
-  void VectorCumAdd(int32_t* x, int32_t len, int32_t num_channel);
-
   static const int32_t kNumIntChannel = 8;
 
-  bool buf_valid_reset_;
+  uint32_t epoch_;
 
-  std::vector<int32_t> grad_x_;
-  std::vector<int32_t> grad_y_;
   std::vector<int32_t> int_img_;
-  std::vector<int32_t> img_buf_;
+  std::vector<int32_t> grad_row_buf_;
   std::vector<std::vector<int32_t> > feat_vec_buf_;
   std::vector<std::vector<float> > feat_vec_normed_buf_;
-  std::vector<int32_t> buf_valid_;
+  std::vector<uint32_t> buf_epoch_;
 
   seeta::fd::SURFFeaturePool feat_pool_;
 };
@@ -51,6 +51,25 @@ class FeatureMap {
 
   virtual void Compute(const uint8_t* input, int32_t width, int32_t height) = 0;
 
+  /**
+   * @brief Start a row-band computation of the feature map.
+   *
+   * Feature maps supporting it only prepare the computation here and produce
+   * rows on demand in `ComputeRows()`, keeping just the rows needed by windows
+   * of height `wnd_height`. Others simply compute the whole map.
+   */
+  virtual void BeginStream(const uint8_t* input, int32_t width,
+      int32_t height, int32_t wnd_height) {
+    Compute(input, width, height);
+  }
+
+  /**
+   * @brief Make the features of all windows lying above `row_end` available.
+   *
+   * Rows must be requested in non-decreasing order after `BeginStream()`.
+   */
+  virtual void ComputeRows(int32_t row_end) {}
+
   inline virtual void SetROI(const seeta::Rect & roi) {
     roi_ = roi;
   }
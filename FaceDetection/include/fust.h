@@ -47,19 +47,22 @@
 namespace seeta {
 namespace fd {
 
+class SURFMLP;
+
 class FuStDetector : public Detector {
  public:
   FuStDetector()
       : wnd_size_(40), slide_wnd_step_x_(4), slide_wnd_step_y_(4),
-        num_hierarchy_(0) {
-    wnd_data_buf_.resize(wnd_size_ * wnd_size_);
-    wnd_data_.resize(wnd_size_ * wnd_size_);
-  }
+        stream_feat_map_(false) {}
 
   ~FuStDetector() {}
 
   virtual bool LoadModel(const std::string & model_path);
+  virtual bool AddModel(const std::string & model_path);
   virtual std::vector<seeta::FaceInfo> Detect(seeta::fd::ImagePyramid* img_pyramid);
+  virtual std::vector<std::vector<seeta::FaceInfo> > DetectRegions(
+      seeta::fd::ImagePyramid* img_pyramid,
+      const seeta::fd::WindowFilter & filter);
 
   inline virtual void SetWindowSize(int32_t size) {
     if (size >= 20)
@@ -73,29 +76,115 @@ class FuStDetector : public Detector {
       slide_wnd_step_y_ = step_y;
   }
 
+  inline virtual void SetStreamingFeatureMap(bool enable) {
+    stream_feat_map_ = enable;
+  }
+
+  virtual void SetMLPCalibration(bool enable);
+  virtual bool QuantizeMLP();
+  virtual void SetQuantizedMLP(bool enable);
+
  private:
+  /**
+   * @struct Cascade
+   * @brief A funnel-structured cascade loaded from one model file.
+   *
+   * Classifiers of all hierarchies are stored in `model`, starting with those
+   * of the first hierarchy, which have one stage each. Feature maps are owned
+   * by the detector and shared among all cascades. When classifiers compiled
+   * for the model are used, `generic_model` and `specialized_model` keep both
+   * versions of each replaced classifier, and are empty otherwise.
+   */
+  typedef struct Cascade {
+    int32_t num_hierarchy;
+    std::vector<int32_t> hierarchy_size;
+    std::vector<int32_t> num_stage;
+    std::vector<std::vector<int32_t> > wnd_src_id;
+    std::vector<std::shared_ptr<seeta::fd::Classifier> > model;
+    std::vector<std::shared_ptr<seeta::fd::Classifier> > generic_model;
+    std::vector<std::shared_ptr<seeta::fd::Classifier> > specialized_model;
+  } Cascade;
+
+  /**
+   * @struct RefineWorker
+   * @brief Working state of a thread running the classifiers after the first
+   *        hierarchy, with its own feature maps and window buffers.
+   *
+   * Classifiers are indexed as in `cascades_`, and those of the first
+   * hierarchy are left empty. The first worker uses the classifiers of the
+   * detector itself.
+   */
+  typedef struct RefineWorker {
+    std::vector<std::vector<std::shared_ptr<seeta::fd::Classifier> > > model;
+    std::vector<std::shared_ptr<seeta::fd::FeatureMap> > feat_map;
+    std::vector<uint8_t> wnd_data_buf;
+    std::vector<uint8_t> wnd_data;
+    std::vector<float> mlp_predicts;
+  } RefineWorker;
+
   std::shared_ptr<seeta::fd::ModelReader> CreateModelReader(seeta::fd::ClassifierType type);
   std::shared_ptr<seeta::fd::Classifier> CreateClassifier(seeta::fd::ClassifierType type);
   std::shared_ptr<seeta::fd::FeatureMap> CreateFeatureMap(seeta::fd::ClassifierType type);
 
-  void GetWindowData(const seeta::ImageData & img, const seeta::Rect & wnd);
+  bool ReadCascade(std::istream* input, Cascade* cascade);
+  /** All SURF-MLP classifiers of the loaded cascades, generic versions */
+  std::vector<seeta::fd::SURFMLP*> GetSURFMLPs();
+  /** Replace the classifiers by those compiled for the model, if any */
+  void UseSpecializedClassifiers(uint64_t fingerprint, Cascade* cascade);
+  /**
+   * Run the SURF-MLP stages with their generic classifiers, which support
+   * calibration and quantization, or with the compiled ones if any.
+   */
+  void SelectSURFMLPs(bool use_generic);
+
+  /**
+   * @brief Run the first hierarchies of all cascades over the pyramid.
+   *
+   * `(*proposals)[c][i]` receives the windows accepted by the i-th classifier
+   * of the first hierarchy of the c-th cascade.
+   */
+  void ProposeWindows(seeta::fd::ImagePyramid* img_pyramid,
+      std::vector<std::vector<std::vector<seeta::FaceInfo> > >* proposals);
+
+  /**
+   * @brief Run the hierarchies following the first one of a cascade.
+   *
+   * Windows read the pixels of `region` of the image only, with zeros outside
+   * of it. The output windows of its last hierarchy are appended to `bboxes`,
+   * leaving the final non-maximum suppression to the caller.
+   */
+  void RunCascade(int32_t cascade_idx, const seeta::ImageData & img,
+      const seeta::Rect & region,
+      std::vector<std::vector<seeta::FaceInfo> >* proposals,
+      std::vector<seeta::FaceInfo>* bboxes);
+
+  /** Point the classifiers of the first hierarchies to the given maps */
+  void SetFirstHierarchyFeatureMaps(
+      const std::vector<std::shared_ptr<seeta::fd::FeatureMap> > & feat_map);
+
+  void CreateRefineWorkers();
+  bool RefineWindow(RefineWorker* worker, int32_t cascade_idx,
+      int32_t model_idx, int32_t feat_idx, const seeta::ImageData & img,
+      const seeta::Rect & region, const seeta::FaceInfo & wnd_info,
+      seeta::FaceInfo* result);
+
+  /** Resize a window to the classifier input, with zeros outside `region` */
+  void GetWindowData(const seeta::ImageData & img, const seeta::Rect & region,
+      const seeta::Rect & wnd, std::vector<uint8_t>* buf, uint8_t* wnd_data);
 
   int32_t wnd_size_;
   int32_t slide_wnd_step_x_;
   int32_t slide_wnd_step_y_;
+  bool stream_feat_map_;
 
-  int32_t num_hierarchy_;
-  std::vector<int32_t> hierarchy_size_;
-  std::vector<int32_t> num_stage_;
-  std::vector<std::vector<int32_t> > wnd_src_id_;
-
-  std::vector<uint8_t> wnd_data_buf_;
-  std::vector<uint8_t> wnd_data_;
-
-  std::vector<std::shared_ptr<seeta::fd::Classifier> > model_;
+  std::vector<Cascade> cascades_;
   std::vector<std::shared_ptr<seeta::fd::FeatureMap> > feat_map_;
   std::map<seeta::fd::ClassifierType, int32_t> cls2feat_idx_;
 
+  std::vector<RefineWorker> workers_;
+  std::vector<seeta::FaceInfo> refined_wnds_;
+  std::vector<uint8_t> refined_mask_;
+
   DISABLE_COPY_AND_ASSIGN(FuStDetector);
 };
 
@@ -0,0 +1,70 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#ifndef SEETA_FD_SPECIALIZED_MODEL_H_
+#define SEETA_FD_SPECIALIZED_MODEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "classifier.h"
+
+namespace seeta {
+namespace fd {
+
+/**
+ * @class SpecializedModelRegistry
+ * @brief Registry of classifiers compiled for specific model files.
+ *
+ * Translation units generated by the `fust_codegen` tool register a function
+ * creating the classifiers of a model, in the order they appear in the model
+ * file, keyed by the fingerprint of the file. When a registered model is
+ * loaded, the detector uses these classifiers in place of the generic ones.
+ * Null entries leave the generic classifiers in place.
+ */
+class SpecializedModelRegistry {
+ public:
+  typedef std::vector<std::shared_ptr<seeta::fd::Classifier> >
+    (*CreateClassifiersFunc)();
+
+  static bool Register(uint64_t fingerprint, CreateClassifiersFunc func);
+  static CreateClassifiersFunc Find(uint64_t fingerprint);
+
+  /** @brief FNV-1a hash of the model file content. */
+  static uint64_t Fingerprint(const char* data, std::size_t len);
+};
+
+}  // namespace fd
+}  // namespace seeta
+
+#endif  // SEETA_FD_SPECIALIZED_MODEL_H_
@@ -0,0 +1,133 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#ifndef SEETA_FD_UTIL_IMAGE_ATLAS_H_
+#define SEETA_FD_UTIL_IMAGE_ATLAS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+#include "detector.h"
+
+namespace seeta {
+namespace fd {
+
+/**
+ * @brief A gray-scale image packing several small images into shelves.
+ *
+ * Images are placed left to right on shelves of the atlas, separated from
+ * each other by a zero-filled guard border, so that one pyramid and cascade
+ * pass serves all of them. As a window filter, the atlas has a region for
+ * each image, and only accepts windows lying inside one image (up to the
+ * rounding of coordinates of scaled windows), as the windows scanned on
+ * single images. Detections of each region are mapped back to their image by
+ * `MapBack()`.
+ */
+class ImageAtlas : public seeta::fd::WindowFilter {
+ public:
+  ImageAtlas()
+      : width_(0), height_(0), max_height_(0), guard_(0),
+        shelf_x_(0), shelf_y_(0), shelf_height_(0) {}
+
+  ~ImageAtlas() {}
+
+  /** @brief Start an empty atlas with the given width and maximum height. */
+  void Reset(int32_t width, int32_t max_height, int32_t guard);
+
+  /**
+   * @brief Copy a gray-scale image into the atlas, tagged by `id`.
+   *
+   * Returns false if there is no room left for the image.
+   */
+  bool Add(const seeta::ImageData & img, int32_t id);
+
+  /**
+   * @brief Distribute detections of the regions among the source images.
+   *
+   * Detections of the i-th region are appended to `(*results)[id]` of the
+   * i-th image, with coordinates relative to that image.
+   */
+  void MapBack(const std::vector<std::vector<seeta::FaceInfo> > & bboxes,
+    std::vector<std::vector<seeta::FaceInfo> >* results) const;
+
+  /**
+   * @brief Index of the image a window belongs to, or -1 if there is none.
+   *
+   * A window belongs to the image containing its center, if at least
+   * `min_overlap` of its area lies inside that image.
+   */
+  int32_t Locate(const seeta::Rect & bbox, float min_overlap) const;
+
+  virtual int32_t Accept(const seeta::Rect & bbox) const;
+
+  virtual int32_t num_region() const {
+    return static_cast<int32_t>(region_.size());
+  }
+
+  virtual seeta::Rect region(int32_t idx) const {
+    return region_[idx];
+  }
+
+  inline seeta::ImageData image() {
+    seeta::ImageData img(width_, height_, 1);
+    img.data = data_.data();
+    return img;
+  }
+
+  inline int32_t num_image() const {
+    return static_cast<int32_t>(region_.size());
+  }
+
+  /** @brief Id of the i-th image, as given to `Add()`. */
+  inline int32_t id(int32_t idx) const {
+    return id_[idx];
+  }
+
+ private:
+  int32_t width_;
+  int32_t height_;
+  int32_t max_height_;
+  int32_t guard_;
+
+  int32_t shelf_x_;
+  int32_t shelf_y_;
+  int32_t shelf_height_;
+
+  std::vector<uint8_t> data_;
+  std::vector<seeta::Rect> region_;
+  std::vector<int32_t> id_;
+};
+
+}  // namespace fd
+}  // namespace seeta
+
+#endif  // SEETA_FD_UTIL_IMAGE_ATLAS_H_
@@ -33,10 +33,13 @@
 #define SEETA_FD_UTIL_IMAGE_PYRAMID_H_
 
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <cstring>
+#include <vector>
 
 #include "common.h"
+#include "feature_map.h"
 
 namespace seeta {
 namespace fd {
@@ -92,7 +95,8 @@ class ImagePyramid {
         width1x_(0), height1x_(0),
         width_scaled_(0), height_scaled_(0),
         buf_img_width_(2), buf_img_height_(2),
-        buf_scaled_width_(2), buf_scaled_height_(2) {
+        buf_scaled_width_(2), buf_scaled_height_(2),
+        keep_levels_(false), cur_level_(nullptr) {
     buf_img_ = new uint8_t[buf_img_width_ * buf_img_height_];
     buf_img_scaled_ = new uint8_t[buf_scaled_width_ * buf_scaled_height_];
   }
@@ -132,8 +136,32 @@ class ImagePyramid {
 
   void SetImage1x(const uint8_t* img_data, int32_t width, int32_t height);
 
+  /**
+   * @brief Keep the resized levels for later passes over the same image.
+   *
+   * Levels are identified by their sizes, so a pass with different scale
+   * settings reuses those of equal size and adds the others. Detectors may
+   * keep the feature maps computed on a level with it, see
+   * `GetLevelFeatureMaps()`. All levels are dropped when the image changes.
+   */
+  inline void SetKeepLevels(bool enable) {
+    keep_levels_ = enable;
+    levels_.clear();
+    cur_level_ = nullptr;
+  }
+
+  /**
+   * @brief Feature maps kept with the level last returned by
+   *        `GetNextScaleImage()`, or nullptr if levels are not kept.
+   */
+  inline std::vector<std::shared_ptr<seeta::fd::FeatureMap> >*
+      GetLevelFeatureMaps() {
+    return (cur_level_ != nullptr ? &(cur_level_->feat_maps) : nullptr);
+  }
+
   inline float min_scale() const { return min_scale_; }
   inline float max_scale() const { return max_scale_; }
+  inline float scale_step() const { return scale_step_; }
 
   inline seeta::ImageData image1x() {
     seeta::ImageData img(width1x_, height1x_, 1);
@@ -144,7 +172,14 @@ class ImagePyramid {
   const seeta::ImageData* GetNextScaleImage(float* scale_factor = nullptr);
 
  private:
+  typedef struct PyramidLevel {
+    std::vector<uint8_t> data;
+    seeta::ImageData image;
+    std::vector<std::shared_ptr<seeta::fd::FeatureMap> > feat_maps;
+  } PyramidLevel;
+
   void UpdateBufScaled();
+  const seeta::ImageData* GetLevel(int32_t width, int32_t height);
 
   float max_scale_;
   float min_scale_;
@@ -167,6 +202,10 @@ class ImagePyramid {
   int32_t buf_scaled_height_;
 
   seeta::ImageData img_scaled_;
+
+  bool keep_levels_;
+  std::vector<std::unique_ptr<PyramidLevel> > levels_;
+  PyramidLevel* cur_level_;
 };
 
 }  // namespace fd
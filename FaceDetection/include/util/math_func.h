@@ -158,6 +158,41 @@ class MathFunction {
 #else
     for (i = 0; i < len; i++)
         prod += x[i] * y[i];
+#endif
+    return prod;
+  }
+
+  /**
+   * Inner product of `y` with the concatenation of the segments `x[0]`,
+   * `x[1]`, ..., each of length `seg_len`, without gathering them. The
+   * summation order is that of `VectorInnerProduct()` on the concatenated
+   * vector, so the results are identical. `seg_len` should be divisible by 4.
+   */
+  static inline float VectorInnerProduct(const float* const* x,
+      int32_t seg_len, const float* y, int32_t len) {
+    float prod = 0;
+    int32_t i;
+#ifdef USE_SSE
+    __m128 x1;
+    __m128 y1;
+    __m128 z1 = _mm_setzero_ps();
+    float buf[4];
+
+    const float* const* seg = x;
+    for (i = 0; i < len - 4; seg++) {
+      for (int32_t j = 0; j < seg_len && i < len - 4; j += 4, i += 4) {
+        x1 = _mm_loadu_ps(*seg + j);
+        y1 = _mm_loadu_ps(y + i);
+        z1 = _mm_add_ps(z1, _mm_mul_ps(x1, y1));
+      }
+    }
+    _mm_storeu_ps(&buf[0], z1);
+    prod = buf[0] + buf[1] + buf[2] + buf[3];
+    for (; i < len; i++)
+      prod += x[i / seg_len][i % seg_len] * y[i];
+#else
+    for (i = 0; i < len; i++)
+      prod += x[i / seg_len][i % seg_len] * y[i];
 #endif
     return prod;
   }
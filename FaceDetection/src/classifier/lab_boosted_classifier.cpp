@@ -65,6 +65,14 @@ bool LABBoostedClassifier::Classify(float* score, float* outputs) {
   return isPos;
 }
 
+std::shared_ptr<seeta::fd::Classifier> LABBoostedClassifier::Clone() const {
+  std::shared_ptr<LABBoostedClassifier> classifier(new LABBoostedClassifier());
+  classifier->feat_ = feat_;
+  classifier->base_classifiers_ = base_classifiers_;
+  classifier->use_std_dev_ = use_std_dev_;
+  return classifier;
+}
+
 void LABBoostedClassifier::AddFeature(int32_t x, int32_t y) {
   LABFeature feat;
   feat.x = x;
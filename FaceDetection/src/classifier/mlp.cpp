@@ -31,12 +31,24 @@
 
 #include "classifier/mlp.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
 #include "common.h"
 
 namespace seeta {
 namespace fd {
 
 void MLPLayer::Compute(const float* input, float* output) {
+  if (is_calibrating_) {
+    float max_abs_input = 0.0f;
+    for (int32_t i = 0; i < input_dim_; i++)
+      max_abs_input = std::max(max_abs_input, std::fabs(input[i]));
+    UpdateInputRange(max_abs_input);
+  }
+
 #pragma omp parallel num_threads(SEETA_NUM_THREADS)
   {
 #pragma omp for nowait
@@ -48,16 +60,167 @@ void MLPLayer::Compute(const float* input, float* output) {
   }
 }
 
+void MLPLayer::Compute(const float* const* input, int32_t seg_len,
+    float* output) {
+  if (is_calibrating_) {
+    float max_abs_input = 0.0f;
+    for (int32_t i = 0; i < input_dim_; i++) {
+      max_abs_input = std::max(max_abs_input,
+        std::fabs(input[i / seg_len][i % seg_len]));
+    }
+    UpdateInputRange(max_abs_input);
+  }
+
+#pragma omp parallel num_threads(SEETA_NUM_THREADS)
+  {
+#pragma omp for nowait
+    for (int32_t i = 0; i < output_dim_; i++) {
+      output[i] = seeta::fd::MathFunction::VectorInnerProduct(input, seg_len,
+        weights_.data() + i * input_dim_, input_dim_) + bias_[i];
+      output[i] = (act_func_type_ == 1 ? ReLU(output[i]) : Sigmoid(-output[i]));
+    }
+  }
+}
+
+void MLPLayer::ComputeQuantized(const int16_t* input, float* output) const {
+  for (int32_t i = 0; i < output_dim_; i++) {
+    const int8_t* weights = weights_q_.data() + i * input_dim_;
+    int32_t prod = 0;
+    int32_t j = 0;
+#ifdef USE_SSE
+    __m128i sum = _mm_setzero_si128();
+    for (; j + 8 <= input_dim_; j += 8) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + j));
+      __m128i w = _mm_cvtepi8_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(weights + j)));
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(x, w));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    prod = _mm_cvtsi128_si32(sum);
+#endif
+    for (; j < input_dim_; j++)
+      prod += static_cast<int32_t>(input[j]) * weights[j];
+
+    output[i] = static_cast<float>(prod) * input_scale_ * weights_scale_[i] +
+      bias_[i];
+    output[i] = (act_func_type_ == 1 ? ReLU(output[i]) : FastSigmoid(output[i]));
+  }
+}
+
+void MLPLayer::QuantizeInput(const float* input, int16_t* input_q) const {
+  QuantizeValues(input, input_dim_, input_q);
+}
+
+void MLPLayer::QuantizeInput(const float* const* input, int32_t seg_len,
+    int16_t* input_q) const {
+  for (int32_t i = 0; i < input_dim_; i += seg_len) {
+    QuantizeValues(*(input++), std::min(seg_len, input_dim_ - i),
+      input_q + i);
+  }
+}
+
+void MLPLayer::QuantizeValues(const float* input, int32_t len,
+    int16_t* input_q) const {
+  float inv_scale = 1.0f / input_scale_;
+  for (int32_t i = 0; i < len; i++) {
+    float val = std::round(input[i] * inv_scale);
+    val = std::min(std::max(val, static_cast<float>(-kMaxQuantizedInput)),
+      static_cast<float>(kMaxQuantizedInput));
+    input_q[i] = static_cast<int16_t>(val);
+  }
+}
+
+bool MLPLayer::Quantize() {
+  if (max_abs_input_ <= 0.0f)
+    return false;
+
+  input_scale_ = max_abs_input_ / kMaxQuantizedInput;
+  weights_q_.resize(weights_.size());
+  weights_scale_.resize(output_dim_);
+  for (int32_t i = 0; i < output_dim_; i++) {
+    const float* weights = weights_.data() + i * input_dim_;
+    float max_abs_weight = 0.0f;
+    for (int32_t j = 0; j < input_dim_; j++)
+      max_abs_weight = std::max(max_abs_weight, std::fabs(weights[j]));
+    weights_scale_[i] = (max_abs_weight > 0.0f ? max_abs_weight / 127.0f : 1.0f);
+
+    int8_t* weights_q = weights_q_.data() + i * input_dim_;
+    for (int32_t j = 0; j < input_dim_; j++) {
+      weights_q[j] = static_cast<int8_t>(
+        std::round(weights[j] / weights_scale_[i]));
+    }
+  }
+  return true;
+}
+
+static std::vector<float> BuildSigmoidTable(int32_t size, float range) {
+  std::vector<float> table(size + 1);
+  for (int32_t i = 0; i <= size; i++) {
+    float val = 2 * range * i / size - range;
+    table[i] = 1.0f / (1.0f + std::exp(-val));
+  }
+  return table;
+}
+
+float MLPLayer::FastSigmoid(float x) const {
+  static const int32_t kTableSize = 1024;
+  static const float kRange = 16.0f;
+  static const std::vector<float> table =
+    BuildSigmoidTable(kTableSize, kRange);
+
+  if (x <= -kRange)
+    return table[0];
+  if (x >= kRange)
+    return table[kTableSize];
+  float pos = (x + kRange) * (kTableSize / (2 * kRange));
+  int32_t idx = static_cast<int32_t>(pos);
+  float weight = pos - idx;
+  return table[idx] + weight * (table[idx + 1] - table[idx]);
+}
+
+void MLPLayer::UpdateInputRange(float max_abs_input) {
+#pragma omp critical(seeta_fd_mlp_calibration)
+  {
+    max_abs_input_ = std::max(max_abs_input_, max_abs_input);
+  }
+}
+
 void MLP::Compute(const float* input, float* output) {
   layer_buf_[0].resize(layers_[0]->GetOutputDim());
-  layers_[0]->Compute(input, layer_buf_[0].data());
+  ComputeLayer(0, input, layer_buf_[0].data());
+  ComputeHiddenLayers(output);
+}
 
+void MLP::Compute(const float* const* input, int32_t seg_len, float* output) {
+  layer_buf_[0].resize(layers_[0]->GetOutputDim());
+  if (layers_[0]->use_quantized()) {
+    input_q_buf_.resize(layers_[0]->GetInputDim());
+    layers_[0]->QuantizeInput(input, seg_len, input_q_buf_.data());
+    layers_[0]->ComputeQuantized(input_q_buf_.data(), layer_buf_[0].data());
+  } else {
+    layers_[0]->Compute(input, seg_len, layer_buf_[0].data());
+  }
+  ComputeHiddenLayers(output);
+}
+
+void MLP::ComputeHiddenLayers(float* output) {
   size_t i; /**< layer index */
   for (i = 1; i < layers_.size() - 1; i++) {
     layer_buf_[i % 2].resize(layers_[i]->GetOutputDim());
-    layers_[i]->Compute(layer_buf_[(i + 1) % 2].data(), layer_buf_[i % 2].data());
+    ComputeLayer(i, layer_buf_[(i + 1) % 2].data(), layer_buf_[i % 2].data());
+  }
+  ComputeLayer(i, layer_buf_[(i + 1) % 2].data(), output);
+}
+
+void MLP::ComputeLayer(int32_t idx, const float* input, float* output) {
+  if (layers_[idx]->use_quantized()) {
+    input_q_buf_.resize(layers_[idx]->GetInputDim());
+    layers_[idx]->QuantizeInput(input, input_q_buf_.data());
+    layers_[idx]->ComputeQuantized(input_q_buf_.data(), output);
+  } else {
+    layers_[idx]->Compute(input, output);
   }
-  layers_.back()->Compute(layer_buf_[(i + 1) % 2].data(), output);
 }
 
 void MLP::AddLayer(int32_t inputDim, int32_t outputDim, const float* weights,
@@ -72,5 +235,30 @@ void MLP::AddLayer(int32_t inputDim, int32_t outputDim, const float* weights,
   layers_.push_back(layer);
 }
 
+void MLP::SetCalibration(bool enable) {
+  for (size_t i = 0; i < layers_.size(); i++)
+    layers_[i]->SetCalibration(enable);
+}
+
+bool MLP::Quantize() {
+  bool is_quantized = true;
+  for (size_t i = 0; i < layers_.size(); i++)
+    is_quantized = layers_[i]->Quantize() && is_quantized;
+  return is_quantized;
+}
+
+void MLP::SetUseQuantized(bool enable) {
+  for (size_t i = 0; i < layers_.size(); i++)
+    layers_[i]->SetUseQuantized(enable);
+}
+
+bool MLP::is_quantized() const {
+  for (size_t i = 0; i < layers_.size(); i++) {
+    if (layers_[i]->is_quantized())
+      return true;
+  }
+  return false;
+}
+
 }  // namespace fd
 }  // namespace seeta
@@ -37,13 +37,24 @@ namespace seeta {
 namespace fd {
 
 bool SURFMLP::Classify(float* score, float* outputs) {
-  float* dest = input_buf_.data();
-  for (size_t i = 0; i < feat_id_.size(); i++) {
-    feat_map_->GetFeatureVector(feat_id_[i] - 1, dest);
-    dest += feat_map_->GetFeatureVectorDim(feat_id_[i]);
-  }
+  int32_t feat_dim = feat_map_->GetFeatureVectorDim(feat_id_[0] - 1);
   output_buf_.resize(model_->GetOutputDim());
-  model_->Compute(input_buf_.data(), output_buf_.data());
+
+  if (feat_dim % 4 == 0 && feat_dim * static_cast<int32_t>(feat_id_.size()) ==
+      model_->GetInputDim()) {
+    // Feed the cached feature vectors to the network in place
+    feat_vec_.resize(feat_id_.size());
+    for (size_t i = 0; i < feat_id_.size(); i++)
+      feat_vec_[i] = feat_map_->GetFeatureVector(feat_id_[i] - 1);
+    model_->Compute(feat_vec_.data(), feat_dim, output_buf_.data());
+  } else {
+    float* dest = input_buf_.data();
+    for (size_t i = 0; i < feat_id_.size(); i++) {
+      feat_map_->GetFeatureVector(feat_id_[i] - 1, dest);
+      dest += feat_map_->GetFeatureVectorDim(feat_id_[i] - 1);
+    }
+    model_->Compute(input_buf_.data(), output_buf_.data());
+  }
 
   if (score != nullptr)
     *score = output_buf_[0];
@@ -55,6 +66,15 @@ bool SURFMLP::Classify(float* score, float* outputs) {
   return (output_buf_[0] > thresh_);
 }
 
+std::shared_ptr<seeta::fd::Classifier> SURFMLP::Clone() const {
+  std::shared_ptr<SURFMLP> classifier(new SURFMLP());
+  classifier->feat_id_ = feat_id_;
+  classifier->input_buf_.resize(input_buf_.size());
+  *(classifier->model_) = *model_;
+  classifier->thresh_ = thresh_;
+  return classifier;
+}
+
 void SURFMLP::AddFeatureByID(int32_t feat_id) {
   feat_id_.push_back(feat_id);
 }
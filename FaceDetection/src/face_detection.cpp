@@ -31,15 +31,36 @@
 
 #include "face_detection.h"
 
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <vector>
 
 #include "detector.h"
 #include "fust.h"
+#include "util/image_atlas.h"
 #include "util/image_pyramid.h"
 
 namespace seeta {
 
+class PreparedImage::Impl {
+ public:
+  Impl() : min_img_size_(0) {
+    img_pyramid_.SetKeepLevels(true);
+  }
+
+  int32_t min_img_size_;
+  seeta::fd::ImagePyramid img_pyramid_;
+};
+
+PreparedImage::PreparedImage()
+    : impl_(new seeta::PreparedImage::Impl()) {}
+
+PreparedImage::~PreparedImage() {
+  if (impl_ != nullptr)
+    delete impl_;
+}
+
 class FaceDetection::Impl {
  public:
   Impl()
@@ -55,8 +76,31 @@ class FaceDetection::Impl {
       image.data != nullptr);
   }
 
+  std::vector<seeta::FaceInfo> Detect(seeta::fd::ImagePyramid* img_pyramid,
+    int32_t min_img_size);
+  std::vector<std::vector<seeta::FaceInfo> > DetectRegions(
+    seeta::fd::ImagePyramid* img_pyramid, int32_t min_img_size,
+    const seeta::fd::WindowFilter & filter);
+
+  void SetUpDetector(seeta::fd::ImagePyramid* img_pyramid,
+    int32_t min_img_size);
+  void DropBelowThresh(std::vector<seeta::FaceInfo>* bboxes);
+
  public:
   static const int32_t kWndSize = 40;
+  // Images no larger than this are packed into atlases in DetectBatch()
+  static const int32_t kMaxAtlasImageSize = 256;
+  static const int32_t kMaxAtlasSize = 2048;
+  // Zero-filled border between images of an atlas. The windows accepted on
+  // an image reach up to 2 pixels past it, by the rounding of their scaled
+  // coordinates, and the bilinear taps of the pyramid 1 / scale pixels
+  // further, down to a scale of kWndSize / kMaxAtlasImageSize, so that no
+  // pixel of a neighbour is read on any level. The following classifiers read
+  // the pixels of their image only.
+  static const int32_t kAtlasGuard =
+    2 + (kMaxAtlasImageSize + kWndSize - 1) / kWndSize;
+  // Size ratio between the smallest and the largest images of an atlas
+  static constexpr float kAtlasSizeRatio = 0.8f;
 
   int32_t min_face_size_;
   int32_t max_face_size_;
@@ -67,8 +111,50 @@ class FaceDetection::Impl {
   std::vector<seeta::FaceInfo> pos_wnds_;
   std::unique_ptr<seeta::fd::Detector> detector_;
   seeta::fd::ImagePyramid img_pyramid_;
+  seeta::fd::ImageAtlas atlas_;
 };
 
+void FaceDetection::Impl::SetUpDetector(
+    seeta::fd::ImagePyramid* img_pyramid, int32_t min_img_size) {
+  min_img_size = (max_face_size_ > 0 ?
+    (min_img_size >= max_face_size_ ? max_face_size_ : min_img_size) :
+    min_img_size);
+
+  img_pyramid->SetMinScale(static_cast<float>(kWndSize) / min_img_size);
+
+  detector_->SetWindowSize(kWndSize);
+  detector_->SetSlideWindowStep(slide_wnd_step_x_, slide_wnd_step_y_);
+}
+
+void FaceDetection::Impl::DropBelowThresh(
+    std::vector<seeta::FaceInfo>* bboxes) {
+  for (int32_t i = 0; i < bboxes->size(); i++) {
+    if ((*bboxes)[i].score < cls_thresh_) {
+      bboxes->resize(i);
+      break;
+    }
+  }
+}
+
+std::vector<seeta::FaceInfo> FaceDetection::Impl::Detect(
+    seeta::fd::ImagePyramid* img_pyramid, int32_t min_img_size) {
+  SetUpDetector(img_pyramid, min_img_size);
+  pos_wnds_ = detector_->Detect(img_pyramid);
+  DropBelowThresh(&pos_wnds_);
+  return pos_wnds_;
+}
+
+std::vector<std::vector<seeta::FaceInfo> > FaceDetection::Impl::DetectRegions(
+    seeta::fd::ImagePyramid* img_pyramid, int32_t min_img_size,
+    const seeta::fd::WindowFilter & filter) {
+  SetUpDetector(img_pyramid, min_img_size);
+  std::vector<std::vector<seeta::FaceInfo> > region_wnds =
+    detector_->DetectRegions(img_pyramid, filter);
+  for (size_t i = 0; i < region_wnds.size(); i++)
+    DropBelowThresh(&(region_wnds[i]));
+  return region_wnds;
+}
+
 FaceDetection::FaceDetection(const char* model_path)
     : impl_(new seeta::FaceDetection::Impl()) {
   impl_->detector_->LoadModel(model_path);
@@ -79,33 +165,135 @@ FaceDetection::~FaceDetection() {
     delete impl_;
 }
 
+bool FaceDetection::AddModel(const char* model_path) {
+  return impl_->detector_->AddModel(model_path);
+}
+
 std::vector<seeta::FaceInfo> FaceDetection::Detect(
     const seeta::ImageData & img) {
   if (!impl_->IsLegalImage(img))
     return std::vector<seeta::FaceInfo>();
 
   int32_t min_img_size = img.height <= img.width ? img.height : img.width;
-  min_img_size = (impl_->max_face_size_ > 0 ?
-    (min_img_size >= impl_->max_face_size_ ? impl_->max_face_size_ : min_img_size) :
-    min_img_size);
-
   impl_->img_pyramid_.SetImage1x(img.data, img.width, img.height);
-  impl_->img_pyramid_.SetMinScale(static_cast<float>(impl_->kWndSize) / min_img_size);
+  return impl_->Detect(&(impl_->img_pyramid_), min_img_size);
+}
 
-  impl_->detector_->SetWindowSize(impl_->kWndSize);
-  impl_->detector_->SetSlideWindowStep(impl_->slide_wnd_step_x_,
-    impl_->slide_wnd_step_y_);
+bool FaceDetection::Prepare(const seeta::ImageData & img,
+    seeta::PreparedImage* prepared) {
+  if (prepared == nullptr || !impl_->IsLegalImage(img))
+    return false;
 
-  impl_->pos_wnds_ = impl_->detector_->Detect(&(impl_->img_pyramid_));
+  prepared->impl_->min_img_size_ = std::min(img.width, img.height);
+  prepared->impl_->img_pyramid_.SetImage1x(img.data, img.width, img.height);
+  return true;
+}
 
-  for (int32_t i = 0; i < impl_->pos_wnds_.size(); i++) {
-    if (impl_->pos_wnds_[i].score < impl_->cls_thresh_) {
-      impl_->pos_wnds_.resize(i);
-      break;
+std::vector<seeta::FaceInfo> FaceDetection::Detect(
+    seeta::PreparedImage* prepared) {
+  if (prepared == nullptr || prepared->impl_->min_img_size_ <= 0)
+    return std::vector<seeta::FaceInfo>();
+
+  // Scale settings of the detector apply to the prepared pyramid as well
+  seeta::fd::ImagePyramid* img_pyramid = &(prepared->impl_->img_pyramid_);
+  img_pyramid->SetScaleStep(impl_->img_pyramid_.scale_step());
+  img_pyramid->SetMaxScale(impl_->img_pyramid_.max_scale());
+  return impl_->Detect(img_pyramid, prepared->impl_->min_img_size_);
+}
+
+std::vector<std::vector<seeta::FaceInfo> > FaceDetection::DetectBatch(
+    const std::vector<seeta::ImageData> & images) {
+  int32_t num_img = static_cast<int32_t>(images.size());
+  std::vector<std::vector<seeta::FaceInfo> > results(num_img);
+  std::vector<int32_t> atlas_img_idx;
+  const int32_t guard = impl_->kAtlasGuard;
+
+  for (int32_t i = 0; i < num_img; i++) {
+    const seeta::ImageData & img = images[i];
+    if (!impl_->IsLegalImage(img))
+      continue;
+    if (img.width <= impl_->kMaxAtlasImageSize &&
+        img.height <= impl_->kMaxAtlasImageSize)
+      atlas_img_idx.push_back(i);
+    else
+      results[i] = Detect(img);
+  }
+
+  // Images of similar sizes share atlases, so that the pyramid of an atlas,
+  // bounded by its largest image, does not go far below the scales needed by
+  // the others.
+  std::stable_sort(atlas_img_idx.begin(), atlas_img_idx.end(),
+    [&images](int32_t a, int32_t b) {
+      return std::min(images[a].width, images[a].height) >
+        std::min(images[b].width, images[b].height);
+    });
+
+  size_t group_begin = 0;
+  while (group_begin < atlas_img_idx.size()) {
+    const seeta::ImageData & first = images[atlas_img_idx[group_begin]];
+    int32_t min_img_size = std::min(first.width, first.height);
+    int64_t area = 0;
+    size_t group_end = group_begin;
+    while (group_end < atlas_img_idx.size()) {
+      const seeta::ImageData & img = images[atlas_img_idx[group_end]];
+      if (std::min(img.width, img.height) < min_img_size * impl_->kAtlasSizeRatio)
+        break;
+      area += static_cast<int64_t>(img.width + guard) * (img.height + guard);
+      group_end++;
     }
+
+    // Pack the images of a group tallest first on the shelves
+    std::stable_sort(atlas_img_idx.begin() + group_begin,
+      atlas_img_idx.begin() + group_end, [&images](int32_t a, int32_t b) {
+        return images[a].height > images[b].height;
+      });
+    int32_t atlas_width = static_cast<int32_t>(std::sqrt(static_cast<double>(area)));
+    atlas_width = std::max(atlas_width, impl_->kMaxAtlasImageSize);
+    atlas_width = std::min(atlas_width, impl_->kMaxAtlasSize);
+
+    size_t next = group_begin;
+    while (next < group_end) {
+      impl_->atlas_.Reset(atlas_width, impl_->kMaxAtlasSize, guard);
+      while (next < group_end &&
+          impl_->atlas_.Add(images[atlas_img_idx[next]], atlas_img_idx[next]))
+        next++;
+
+      // A single image gains nothing from an atlas, whose pyramid would be
+      // resized from a wider image than its own
+      if (impl_->atlas_.num_image() == 1) {
+        int32_t img_idx = impl_->atlas_.id(0);
+        results[img_idx] = Detect(images[img_idx]);
+        continue;
+      }
+
+      seeta::ImageData atlas = impl_->atlas_.image();
+      impl_->img_pyramid_.SetImage1x(atlas.data, atlas.width, atlas.height);
+      impl_->atlas_.MapBack(impl_->DetectRegions(&(impl_->img_pyramid_),
+        min_img_size, impl_->atlas_), &results);
+    }
+
+    group_begin = group_end;
   }
 
-  return impl_->pos_wnds_;
+  return results;
+}
+
+bool FaceDetection::CalibrateQuantizedMLP(
+    const std::vector<seeta::ImageData> & images) {
+  impl_->detector_->SetQuantizedMLP(false);
+  impl_->detector_->SetMLPCalibration(true);
+  for (size_t i = 0; i < images.size(); i++)
+    Detect(images[i]);
+  impl_->detector_->SetMLPCalibration(false);
+
+  if (!impl_->detector_->QuantizeMLP())
+    return false;
+  impl_->detector_->SetQuantizedMLP(true);
+  return true;
+}
+
+void FaceDetection::SetQuantizedMLP(bool enable) {
+  impl_->detector_->SetQuantizedMLP(enable);
 }
 
 void FaceDetection::SetMinFaceSize(int32_t size) {
@@ -137,4 +325,8 @@ void FaceDetection::SetScoreThresh(float thresh) {
     impl_->cls_thresh_ = thresh;
 }
 
+void FaceDetection::SetStreamingFeatureMap(bool enable) {
+  impl_->detector_->SetStreamingFeatureMap(enable);
+}
+
 }  // namespace seeta
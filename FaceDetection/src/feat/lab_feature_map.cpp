@@ -44,12 +44,56 @@ void LABFeatureMap::Compute(const uint8_t* input, int32_t width,
     return;  // @todo handle the errors!!!
   }
 
+  row_mask_ = -1;
+  input_ = nullptr;
   Reshape(width, height);
   ComputeIntegralImages(input);
   ComputeRectSum();
   ComputeFeatureMap();
 }
 
+void LABFeatureMap::BeginStream(const uint8_t* input, int32_t width,
+    int32_t height, int32_t wnd_height) {
+  if (input == nullptr || width <= 0 || height <= 0) {
+    return;  // @todo handle the errors!!!
+  }
+
+  int32_t num_ring_rows = 1;
+  while (num_ring_rows <= wnd_height)
+    num_ring_rows <<= 1;
+
+  row_mask_ = num_ring_rows - 1;
+  input_ = input;
+  num_int_rows_ = 0;
+  Reshape(width, num_ring_rows);
+  height_ = height;
+}
+
+void LABFeatureMap::ComputeRows(int32_t row_end) {
+  if (input_ == nullptr)
+    return;
+  if (row_end > height_)
+    row_end = height_;
+  if (row_end <= num_int_rows_)
+    return;
+
+  // Each rectangle sum row depends on the integral image rows up to
+  // `rect_offset` rows below it, and each feature map row on rectangle sums up
+  // to `feat_offset - rect_offset` rows below it. The rows are produced in an
+  // interleaved order so that no input row has been recycled when it is read.
+  int32_t rect_offset = rect_height_ - 1;
+  int32_t feat_offset = rect_offset + rect_height_ * (num_rect_ - 1);
+
+  for (int32_t r = num_int_rows_; r < row_end; r++) {
+    ComputeIntegralRow(r);
+    if (r >= rect_offset)
+      ComputeRectSumRow(r - rect_offset);
+    if (r >= feat_offset)
+      ComputeFeatureRow(r - feat_offset);
+  }
+  num_int_rows_ = row_end;
+}
+
 float LABFeatureMap::GetStdDev() const {
   double mean;
   double m2;
@@ -59,12 +103,13 @@ float LABFeatureMap::GetStdDev() const {
   int32_t top_right;
   int32_t bottom_left;
   int32_t bottom_right;
+  int32_t bottom = RowOffset(roi_.y + roi_.height - 1);
 
   if (roi_.x != 0) {
     if (roi_.y != 0) {
-      top_left = (roi_.y - 1) * width_ + roi_.x - 1;
+      top_left = RowOffset(roi_.y - 1) + roi_.x - 1;
       top_right = top_left + roi_.width;
-      bottom_left = top_left + roi_.height * width_;
+      bottom_left = bottom + roi_.x - 1;
       bottom_right = bottom_left + roi_.width;
 
       mean = (int_img_[bottom_right] - int_img_[bottom_left] +
@@ -72,7 +117,7 @@ float LABFeatureMap::GetStdDev() const {
       m2 = (square_int_img_[bottom_right] - square_int_img_[bottom_left] +
         square_int_img_[top_left] - square_int_img_[top_right]) / area;
     } else {
-      bottom_left = (roi_.height - 1) * width_ + roi_.x - 1;
+      bottom_left = bottom + roi_.x - 1;
       bottom_right = bottom_left + roi_.width;
 
       mean = (int_img_[bottom_right] - int_img_[bottom_left]) / area;
@@ -80,13 +125,13 @@ float LABFeatureMap::GetStdDev() const {
     }
   } else {
     if (roi_.y != 0) {
-      top_right = (roi_.y - 1) * width_ + roi_.width - 1;
-      bottom_right = top_right + roi_.height * width_;
+      top_right = RowOffset(roi_.y - 1) + roi_.width - 1;
+      bottom_right = bottom + roi_.width - 1;
 
       mean = (int_img_[bottom_right] - int_img_[top_right]) / area;
       m2 = (square_int_img_[bottom_right] - square_int_img_[top_right]) / area;
     } else {
-      bottom_right = (roi_.height - 1) * width_ + roi_.width - 1;
+      bottom_right = bottom + roi_.width - 1;
       mean = int_img_[bottom_right] / area;
       m2 = square_int_img_[bottom_right] / area;
     }
@@ -115,67 +160,100 @@ void LABFeatureMap::ComputeIntegralImages(const uint8_t* input) {
   Integral(square_int_img_.data());
 }
 
+void LABFeatureMap::ComputeIntegralRow(int32_t row) {
+  const uint8_t* src = input_ + row * width_;
+  int32_t* dest = int_img_.data() + RowOffset(row);
+  uint32_t* dest_square = square_int_img_.data() + RowOffset(row);
+  int32_t s = 0;
+  uint32_t s_square = 0;
+
+  if (row == 0) {
+    for (int32_t c = 0; c < width_; c++) {
+      s += src[c];
+      s_square += static_cast<uint32_t>(src[c]) * src[c];
+      dest[c] = s;
+      dest_square[c] = s_square;
+    }
+  } else {
+    const int32_t* dest_above = int_img_.data() + RowOffset(row - 1);
+    const uint32_t* dest_square_above =
+      square_int_img_.data() + RowOffset(row - 1);
+    for (int32_t c = 0; c < width_; c++) {
+      s += src[c];
+      s_square += static_cast<uint32_t>(src[c]) * src[c];
+      dest[c] = dest_above[c] + s;
+      dest_square[c] = dest_square_above[c] + s_square;
+    }
+  }
+}
+
 void LABFeatureMap::ComputeRectSum() {
-  int32_t width = width_ - rect_width_;
   int32_t height = height_ - rect_height_;
-  const int32_t* int_img = int_img_.data();
-  int32_t* rect_sum = rect_sum_.data();
 
-  *rect_sum = *(int_img + (rect_height_ - 1) * width_ + rect_width_ - 1);
-  seeta::fd::MathFunction::VectorSub(int_img + (rect_height_ - 1) * width_ +
-    rect_width_, int_img + (rect_height_ - 1) * width_, rect_sum + 1, width);
+  ComputeRectSumRow(0);
 
 #pragma omp parallel num_threads(SEETA_NUM_THREADS)
   {
 #pragma omp for nowait
-    for (int32_t i = 1; i <= height; i++) {
-      const int32_t* top_left = int_img + (i - 1) * width_;
-      const int32_t* top_right = top_left + rect_width_ - 1;
-      const int32_t* bottom_left = top_left + rect_height_ * width_;
-      const int32_t* bottom_right = bottom_left + rect_width_ - 1;
-      int32_t* dest = rect_sum + i * width_;
-
-      *(dest++) = (*bottom_right) - (*top_right);
-      seeta::fd::MathFunction::VectorSub(bottom_right + 1, top_right + 1, dest, width);
-      seeta::fd::MathFunction::VectorSub(dest, bottom_left, dest, width);
-      seeta::fd::MathFunction::VectorAdd(dest, top_left, dest, width);
-    }
+    for (int32_t i = 1; i <= height; i++)
+      ComputeRectSumRow(i);
+  }
+}
+
+void LABFeatureMap::ComputeRectSumRow(int32_t row) {
+  int32_t width = width_ - rect_width_;
+  const int32_t* int_img = int_img_.data();
+  const int32_t* bottom_left = int_img + RowOffset(row + rect_height_ - 1);
+  const int32_t* bottom_right = bottom_left + rect_width_ - 1;
+  int32_t* dest = rect_sum_.data() + RowOffset(row);
+
+  if (row == 0) {
+    *dest = *bottom_right;
+    seeta::fd::MathFunction::VectorSub(bottom_right + 1, bottom_left, dest + 1,
+      width);
+  } else {
+    const int32_t* top_left = int_img + RowOffset(row - 1);
+    const int32_t* top_right = top_left + rect_width_ - 1;
+
+    *(dest++) = (*bottom_right) - (*top_right);
+    seeta::fd::MathFunction::VectorSub(bottom_right + 1, top_right + 1, dest, width);
+    seeta::fd::MathFunction::VectorSub(dest, bottom_left, dest, width);
+    seeta::fd::MathFunction::VectorAdd(dest, top_left, dest, width);
   }
 }
 
 void LABFeatureMap::ComputeFeatureMap() {
-  int32_t width = width_ - rect_width_ * num_rect_;
   int32_t height = height_ - rect_height_ * num_rect_;
-  int32_t offset = width_ * rect_height_;
-  uint8_t* feat_map = feat_map_.data();
 
 #pragma omp parallel num_threads(SEETA_NUM_THREADS)
   {
 #pragma omp for nowait
-    for (int32_t r = 0; r <= height; r++) {
-      for (int32_t c = 0; c <= width; c++) {
-        uint8_t* dest = feat_map + r * width_ + c;
-        *dest = 0;
-
-        int32_t white_rect_sum = rect_sum_[(r + rect_height_) * width_ + c + rect_width_];
-        int32_t black_rect_idx = r * width_ + c;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x80 : 0x0);
-        black_rect_idx += rect_width_;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x40 : 0x0);
-        black_rect_idx += rect_width_;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x20 : 0x0);
-        black_rect_idx += offset;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x08 : 0x0);
-        black_rect_idx += offset;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x01 : 0x0);
-        black_rect_idx -= rect_width_;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x02 : 0x0);
-        black_rect_idx -= rect_width_;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x04 : 0x0);
-        black_rect_idx -= offset;
-        *dest |= (white_rect_sum >= rect_sum_[black_rect_idx] ? 0x10 : 0x0);
-      }
-    }
+    for (int32_t r = 0; r <= height; r++)
+      ComputeFeatureRow(r);
+  }
+}
+
+void LABFeatureMap::ComputeFeatureRow(int32_t row) {
+  int32_t width = width_ - rect_width_ * num_rect_;
+  const int32_t* rect_sum = rect_sum_.data();
+  const int32_t* top = rect_sum + RowOffset(row);
+  const int32_t* middle = rect_sum + RowOffset(row + rect_height_);
+  const int32_t* bottom = rect_sum + RowOffset(row + rect_height_ * 2);
+  uint8_t* dest = feat_map_.data() + RowOffset(row);
+
+  for (int32_t c = 0; c <= width; c++) {
+    int32_t white_rect_sum = middle[c + rect_width_];
+    uint8_t val = 0;
+
+    val |= (white_rect_sum >= top[c] ? 0x80 : 0x0);
+    val |= (white_rect_sum >= top[c + rect_width_] ? 0x40 : 0x0);
+    val |= (white_rect_sum >= top[c + rect_width_ * 2] ? 0x20 : 0x0);
+    val |= (white_rect_sum >= middle[c + rect_width_ * 2] ? 0x08 : 0x0);
+    val |= (white_rect_sum >= bottom[c + rect_width_ * 2] ? 0x01 : 0x0);
+    val |= (white_rect_sum >= bottom[c + rect_width_] ? 0x02 : 0x0);
+    val |= (white_rect_sum >= bottom[c] ? 0x04 : 0x0);
+    val |= (white_rect_sum >= middle[c] ? 0x10 : 0x0);
+    dest[c] = val;
   }
 }
 
@@ -29,9 +29,11 @@
  *
  */
 
-#include <cmath>
 #include "feat/surf_feature_map.h"
 
+#include <cmath>
+#include <cstdlib>
+
 namespace seeta {
 namespace fd {
 
@@ -111,22 +113,25 @@ void SURFFeatureMap::Compute(const uint8_t* input, int32_t width,
     return;  // @todo handle the error!
   }
   Reshape(width, height);
-  ComputeGradientImages(input);
-  ComputeIntegralImages();
+  ComputeIntegralImages(input);
+  NextEpoch();
 }
 
 void SURFFeatureMap::GetFeatureVector(int32_t feat_id, float* feat_vec) {
-  if (buf_valid_[feat_id] == 0) {
+  std::memcpy(feat_vec, GetFeatureVector(feat_id),
+    feat_vec_normed_buf_[feat_id].size() * sizeof(float));
+}
+
+const float* SURFFeatureMap::GetFeatureVector(int32_t feat_id) {
+  if (buf_epoch_[feat_id] != epoch_) {
     ComputeFeatureVector(feat_pool_[feat_id], feat_vec_buf_[feat_id].data());
     NormalizeFeatureVectorL2(feat_vec_buf_[feat_id].data(),
       feat_vec_normed_buf_[feat_id].data(),
       static_cast<int32_t>(feat_vec_normed_buf_[feat_id].size()));
-    buf_valid_[feat_id] = 1;
-    buf_valid_reset_ = true;
+    buf_epoch_[feat_id] = epoch_;
   }
 
-  std::memcpy(feat_vec, feat_vec_normed_buf_[feat_id].data(),
-    feat_vec_normed_buf_[feat_id].size() * sizeof(float));
+  return feat_vec_normed_buf_[feat_id].data();
 }
 
 void SURFFeatureMap::InitFeaturePool() {
@@ -145,184 +150,104 @@ void SURFFeatureMap::InitFeaturePool() {
     feat_vec_buf_[i].resize(dim);
     feat_vec_normed_buf_[i].resize(dim);
   }
-  buf_valid_.resize(feat_pool_size, 0);
+  buf_epoch_.resize(feat_pool_size, 0);
 }
 
 void SURFFeatureMap::Reshape(int32_t width, int32_t height) {
   width_ = width;
   height_ = height;
 
-  int32_t len = width_ * height_;
-  grad_x_.resize(len);
-  grad_y_.resize(len);
-  int_img_.resize(len * kNumIntChannel);
-  img_buf_.resize(len);
-}
-
-void SURFFeatureMap::ComputeGradientImages(const uint8_t* input) {
-  int32_t len = width_ * height_;
-  seeta::fd::MathFunction::UInt8ToInt32(input, img_buf_.data(), len);
-  ComputeGradX(img_buf_.data());
-  ComputeGradY(img_buf_.data());
-}
-
-void SURFFeatureMap::ComputeGradX(const int32_t* input) {
-  int32_t* dx = grad_x_.data();
-  int32_t len = width_ - 2;
-
-#pragma omp parallel num_threads(SEETA_NUM_THREADS)
-  {
-#pragma omp for nowait
-    for (int32_t r = 0; r < height_; r++) {
-      const int32_t* src = input + r * width_;
-      int32_t* dest = dx + r * width_;
-      *dest = ((*(src + 1)) - (*src)) << 1;
-      seeta::fd::MathFunction::VectorSub(src + 2, src, dest + 1, len);
-      dest += (width_ - 1);
-      src += (width_ - 1);
-      *dest = ((*src) - (*(src - 1))) << 1;
-    }
-  }
+  int_img_.resize(width_ * height_ * kNumIntChannel);
+  grad_row_buf_.resize(width_ << 1);
 }
 
-void SURFFeatureMap::ComputeGradY(const int32_t* input) {
-  int32_t* dy = grad_y_.data();
-  int32_t len = width_;
-  seeta::fd::MathFunction::VectorSub(input + width_, input, dy, len);
-  seeta::fd::MathFunction::VectorAdd(dy, dy, dy, len);
-
-#pragma omp parallel num_threads(SEETA_NUM_THREADS)
-  {
-#pragma omp for nowait
-    for (int32_t r = 1; r < height_ - 1; r++) {
-      const int32_t* src = input + (r - 1) * width_;
-      int32_t* dest = dy + r * width_;
-      seeta::fd::MathFunction::VectorSub(src + (width_ << 1), src, dest, len);
-    }
+void SURFFeatureMap::ComputeIntegralImages(const uint8_t* input) {
+  int32_t row_width = width_ * kNumIntChannel;
+  int32_t* dx = grad_row_buf_.data();
+  int32_t* dy = dx + width_;
+
+  for (int32_t r = 0; r < height_; r++) {
+    const uint8_t* src = input + r * width_;
+    int32_t* dest = int_img_.data() + r * row_width;
+    ComputeGradientRow(src, (r > 0 ? src - width_ : src),
+      (r < height_ - 1 ? src + width_ : src), (r > 0 && r < height_ - 1),
+      dx, dy);
+    FillIntegralRow(dx, dy, (r > 0 ? dest - row_width : nullptr), dest);
   }
-  int32_t offset = (height_ - 1) * width_;
-  dy += offset;
-  seeta::fd::MathFunction::VectorSub(input + offset, input + offset - width_,
-    dy, len);
-  seeta::fd::MathFunction::VectorAdd(dy, dy, dy, len);
 }
 
-void SURFFeatureMap::ComputeIntegralImages() {
-  FillIntegralChannel(grad_x_.data(), 0);
-  FillIntegralChannel(grad_y_.data(), 4);
-
-  int32_t len = width_ * height_;
-  seeta::fd::MathFunction::VectorAbs(grad_x_.data(), img_buf_.data(), len);
-  FillIntegralChannel(img_buf_.data(), 1);
-  seeta::fd::MathFunction::VectorAbs(grad_y_.data(), img_buf_.data(), len);
-  FillIntegralChannel(img_buf_.data(), 5);
-  MaskIntegralChannel();
-  Integral();
+void SURFFeatureMap::ComputeGradientRow(const uint8_t* src,
+    const uint8_t* src_above, const uint8_t* src_below, bool is_inner_row,
+    int32_t* dx, int32_t* dy) {
+  // Gradients at the borders are twice the one-sided differences
+  dx[0] = (static_cast<int32_t>(src[1]) - src[0]) << 1;
+  for (int32_t c = 1; c < width_ - 1; c++)
+    dx[c] = static_cast<int32_t>(src[c + 1]) - src[c - 1];
+  dx[width_ - 1] = (static_cast<int32_t>(src[width_ - 1]) - src[width_ - 2]) << 1;
+
+  int32_t shift = (is_inner_row ? 0 : 1);
+  for (int32_t c = 0; c < width_; c++)
+    dy[c] = (static_cast<int32_t>(src_below[c]) - src_above[c]) << shift;
 }
 
-void SURFFeatureMap::MaskIntegralChannel() {
-  const int32_t* grad_x = grad_x_.data();
-  const int32_t* grad_y = grad_y_.data();
-  int32_t len = width_ * height_;
+void SURFFeatureMap::FillIntegralRow(const int32_t* dx, const int32_t* dy,
+    const int32_t* prev_row, int32_t* dest) {
+  // Channels of each pixel: dx and |dx| for dy >= 0, then dx and |dx| for
+  // dy < 0, followed by dy and |dy| split likewise by the sign of dx. Rows
+  // are summed up along the way, and the integral of the previous row added.
 #ifdef USE_SSE
-  __m128i dx;
-  __m128i dy;
-  __m128i dx_mask;
-  __m128i dy_mask;
-  __m128i zero = _mm_set1_epi32(0);
+  __m128i zero = _mm_setzero_si128();
   __m128i xor_bits = _mm_set_epi32(0x0, 0x0, 0xffffffff, 0xffffffff);
-  __m128i data;
-  __m128i result;
-  __m128i* src = reinterpret_cast<__m128i*>(int_img_.data());
-
-  for (int32_t i = 0; i < len; i++) {
-    dx = _mm_set1_epi32(*(grad_x++));
-    dy = _mm_set1_epi32(*(grad_y++));
-    dx_mask = _mm_xor_si128(_mm_cmplt_epi32(dx, zero), xor_bits);
-    dy_mask = _mm_xor_si128(_mm_cmplt_epi32(dy, zero), xor_bits);
-
-    data = _mm_loadu_si128(src);
-    result = _mm_and_si128(data, dy_mask);
-    _mm_storeu_si128(src++, result);
-    data = _mm_loadu_si128(src);
-    result = _mm_and_si128(data, dx_mask);
-    _mm_storeu_si128(src++, result);
-  }
-#else
-  int32_t dx, dy, dx_mask, dy_mask, cmp;
-  int32_t xor_bits[] = {-1, -1, 0, 0};
-
-  int32_t* src = int_img_.data();
-  for (int32_t i = 0; i < len; i++) {
-      dy = *(grad_y++);
-      dx = *(grad_x++);
-      
-      cmp = dy < 0 ? 0xffffffff : 0x0;
-      for (int32_t j = 0; j < 4; j++) {
-          // cmp xor xor_bits
-          dy_mask = cmp ^ xor_bits[j];
-          *(src) = (*src) & dy_mask;
-          src++;
-      }
-      
-      cmp = dx < 0 ? 0xffffffff : 0x0;
-      for (int32_t j = 0; j < 4; j++) {
-          // cmp xor xor_bits
-          dx_mask = cmp ^ xor_bits[j];
-          *(src) = (*src) & dx_mask;
-          src++;
-      }
-  }
-#endif
-}
-
-void SURFFeatureMap::Integral() {
-  int32_t* data = int_img_.data();
-  int32_t len = kNumIntChannel * width_;
-
-  // Cummulative sum by row
-  for (int32_t r = 0; r < height_ - 1; r++) {
-    int32_t* row1 = data + r * len;
-    int32_t* row2 = row1 + len;
-    seeta::fd::MathFunction::VectorAdd(row1, row2, row2, len);
-  }
-  // Cummulative sum by column
-  for (int32_t r = 0; r < height_; r++)
-    VectorCumAdd(data + r * len, len, kNumIntChannel);
-}
-
-void SURFFeatureMap::VectorCumAdd(int32_t* x, int32_t len,
-    int32_t num_channel) {
-#ifdef USE_SSE
-  __m128i x1;
-  __m128i y1;
-  __m128i z1;
-  __m128i* x2 = reinterpret_cast<__m128i*>(x);
-  __m128i* y2 = reinterpret_cast<__m128i*>(x + num_channel);
-  __m128i* z2 = y2;
-
-  len = len / num_channel - 1;
-  for (int32_t i = 0; i < len; i++) {
-    // first 4 channels
-    x1 = _mm_loadu_si128(x2++);
-    y1 = _mm_loadu_si128(y2++);
-    z1 = _mm_add_epi32(x1, y1);
-    _mm_storeu_si128(z2, z1);
-    z2 = y2;
-
-    // second 4 channels
-    x1 = _mm_loadu_si128(x2++);
-    y1 = _mm_loadu_si128(y2++);
-    z1 = _mm_add_epi32(x1, y1);
-    _mm_storeu_si128(z2, z1);
-    z2 = y2;
+  __m128i sum_x = zero;
+  __m128i sum_y = zero;
+  __m128i* dest_ptr = reinterpret_cast<__m128i*>(dest);
+  const __m128i* prev_ptr = reinterpret_cast<const __m128i*>(prev_row);
+
+  for (int32_t c = 0; c < width_; c++) {
+    __m128i grad_x = _mm_set1_epi32(dx[c]);
+    __m128i grad_y = _mm_set1_epi32(dy[c]);
+    __m128i dx_mask = _mm_xor_si128(_mm_cmplt_epi32(grad_x, zero), xor_bits);
+    __m128i dy_mask = _mm_xor_si128(_mm_cmplt_epi32(grad_y, zero), xor_bits);
+    grad_x = _mm_unpacklo_epi32(grad_x, _mm_abs_epi32(grad_x));
+    grad_y = _mm_unpacklo_epi32(grad_y, _mm_abs_epi32(grad_y));
+
+    sum_x = _mm_add_epi32(sum_x, _mm_and_si128(grad_x, dy_mask));
+    sum_y = _mm_add_epi32(sum_y, _mm_and_si128(grad_y, dx_mask));
+    if (prev_ptr != nullptr) {
+      _mm_storeu_si128(dest_ptr++,
+        _mm_add_epi32(sum_x, _mm_loadu_si128(prev_ptr++)));
+      _mm_storeu_si128(dest_ptr++,
+        _mm_add_epi32(sum_y, _mm_loadu_si128(prev_ptr++)));
+    } else {
+      _mm_storeu_si128(dest_ptr++, sum_x);
+      _mm_storeu_si128(dest_ptr++, sum_y);
+    }
   }
 #else
-  int32_t cols = len / num_channel - 1;
-  for (int32_t i = 0; i < cols; i++) {
-    int32_t* col1 = x + i * num_channel;
-    int32_t* col2 = col1 + num_channel;
-    seeta::fd::MathFunction::VectorAdd(col1, col2, col2, num_channel);
+  int32_t sum[kNumIntChannel] = {0};
+  int32_t val[kNumIntChannel];
+
+  for (int32_t c = 0; c < width_; c++) {
+    int32_t grad_x = dx[c];
+    int32_t grad_y = dy[c];
+    int32_t abs_grad_x = std::abs(grad_x);
+    int32_t abs_grad_y = std::abs(grad_y);
+    bool is_dx_neg = (grad_x < 0);
+    bool is_dy_neg = (grad_y < 0);
+
+    val[0] = (is_dy_neg ? 0 : grad_x);
+    val[1] = (is_dy_neg ? 0 : abs_grad_x);
+    val[2] = (is_dy_neg ? grad_x : 0);
+    val[3] = (is_dy_neg ? abs_grad_x : 0);
+    val[4] = (is_dx_neg ? 0 : grad_y);
+    val[5] = (is_dx_neg ? 0 : abs_grad_y);
+    val[6] = (is_dx_neg ? grad_y : 0);
+    val[7] = (is_dx_neg ? abs_grad_y : 0);
+
+    for (int32_t i = 0; i < kNumIntChannel; i++) {
+      sum[i] += val[i];
+      *(dest++) = sum[i] + (prev_row != nullptr ? *(prev_row++) : 0);
+    }
   }
 #endif
 }
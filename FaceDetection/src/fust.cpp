@@ -31,8 +31,11 @@
 
 #include "fust.h"
 
+#include <algorithm>
+#include <iterator>
 #include <map>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -42,101 +45,314 @@
 #include "feat/surf_feature_map.h"
 #include "io/lab_boost_model_reader.h"
 #include "io/surf_mlp_model_reader.h"
+#include "specialized_model.h"
 #include "util/nms.h"
 
 namespace seeta {
 namespace fd {
 
 bool FuStDetector::LoadModel(const std::string & model_path) {
+  cascades_.clear();
+  feat_map_.clear();
+  cls2feat_idx_.clear();
+  workers_.clear();
+
+  return AddModel(model_path);
+}
+
+bool FuStDetector::AddModel(const std::string & model_path) {
   std::ifstream model_file(model_path, std::ifstream::binary);
   bool is_loaded = true;
 
   if (!model_file.is_open()) {
     is_loaded = false;
   } else {
-    hierarchy_size_.clear();
-    num_stage_.clear();
-    wnd_src_id_.clear();
-
-    int32_t hierarchy_size;
-    int32_t num_stage;
-    int32_t num_wnd_src;
-    int32_t type_id;
-    int32_t feat_map_index = 0;
-    std::shared_ptr<seeta::fd::ModelReader> reader;
-    std::shared_ptr<seeta::fd::Classifier> classifier;
-    seeta::fd::ClassifierType classifier_type;
-
-    model_file.read(reinterpret_cast<char*>(&num_hierarchy_), sizeof(int32_t));
-    for (int32_t i = 0; is_loaded && i < num_hierarchy_; i++) {
-      model_file.read(reinterpret_cast<char*>(&hierarchy_size),
-        sizeof(int32_t));
-      hierarchy_size_.push_back(hierarchy_size);
-
-      for (int32_t j = 0; is_loaded && j < hierarchy_size; j++) {
-        model_file.read(reinterpret_cast<char*>(&num_stage), sizeof(int32_t));
-        num_stage_.push_back(num_stage);
-
-        for (int32_t k = 0; is_loaded && k < num_stage; k++) {
-          model_file.read(reinterpret_cast<char*>(&type_id), sizeof(int32_t));
-          classifier_type = static_cast<seeta::fd::ClassifierType>(type_id);
-          reader = CreateModelReader(classifier_type);
-          classifier = CreateClassifier(classifier_type);
-
-          is_loaded = !model_file.fail() &&
-            reader->Read(&model_file, classifier.get());
-          if (is_loaded) {
-            model_.push_back(classifier);
-            std::shared_ptr<seeta::fd::FeatureMap> feat_map;
-            if (cls2feat_idx_.count(classifier_type) == 0) {
-              feat_map_.push_back(CreateFeatureMap(classifier_type));
-              cls2feat_idx_.insert(
-                std::map<seeta::fd::ClassifierType, int32_t>::value_type(
-                classifier_type, feat_map_index++));
-            }
-            feat_map = feat_map_[cls2feat_idx_.at(classifier_type)];
-            model_.back()->SetFeatureMap(feat_map.get());
+    std::string model_data((std::istreambuf_iterator<char>(model_file)),
+      std::istreambuf_iterator<char>());
+    std::istringstream input(model_data);
+    model_file.close();
+
+    Cascade cascade;
+    is_loaded = ReadCascade(&input, &cascade) && cascade.num_hierarchy > 0;
+
+    if (is_loaded) {
+      UseSpecializedClassifiers(seeta::fd::SpecializedModelRegistry::Fingerprint(
+        model_data.data(), model_data.size()), &cascade);
+      cascades_.push_back(cascade);
+      CreateRefineWorkers();
+    }
+  }
+
+  return is_loaded;
+}
+
+void FuStDetector::UseSpecializedClassifiers(uint64_t fingerprint,
+    Cascade* cascade) {
+  seeta::fd::SpecializedModelRegistry::CreateClassifiersFunc create =
+    seeta::fd::SpecializedModelRegistry::Find(fingerprint);
+  if (create == nullptr)
+    return;
+
+  std::vector<std::shared_ptr<seeta::fd::Classifier> > model = create();
+  if (model.size() != cascade->model.size())
+    return;  // @todo handle the errors!!!
+
+  cascade->generic_model.resize(model.size());
+  cascade->specialized_model.resize(model.size());
+  for (size_t i = 0; i < model.size(); i++) {
+    if (model[i] == nullptr || model[i]->type() != cascade->model[i]->type())
+      continue;
+    model[i]->SetFeatureMap(feat_map_[cls2feat_idx_.at(model[i]->type())].get());
+    cascade->generic_model[i] = cascade->model[i];
+    cascade->specialized_model[i] = model[i];
+    cascade->model[i] = model[i];
+  }
+}
+
+void FuStDetector::SelectSURFMLPs(bool use_generic) {
+  for (size_t c = 0; c < cascades_.size(); c++) {
+    Cascade & cascade = cascades_[c];
+    for (size_t i = 0; i < cascade.specialized_model.size(); i++) {
+      if (cascade.specialized_model[i] == nullptr ||
+          cascade.specialized_model[i]->type() !=
+          seeta::fd::ClassifierType::SURF_MLP)
+        continue;
+      cascade.model[i] = (use_generic ? cascade.generic_model[i] :
+        cascade.specialized_model[i]);
+    }
+  }
+  CreateRefineWorkers();
+}
+
+void FuStDetector::SetMLPCalibration(bool enable) {
+  std::vector<seeta::fd::SURFMLP*> classifiers = GetSURFMLPs();
+  for (size_t i = 0; i < classifiers.size(); i++)
+    classifiers[i]->SetCalibration(enable);
+  // The compiled classifiers collect no activation ranges
+  if (enable)
+    SelectSURFMLPs(true);
+}
+
+bool FuStDetector::QuantizeMLP() {
+  std::vector<seeta::fd::SURFMLP*> classifiers = GetSURFMLPs();
+  bool is_quantized = !classifiers.empty();
+  for (size_t i = 0; i < classifiers.size(); i++)
+    is_quantized = classifiers[i]->Quantize() && is_quantized;
+  return is_quantized;
+}
+
+void FuStDetector::SetQuantizedMLP(bool enable) {
+  std::vector<seeta::fd::SURFMLP*> classifiers = GetSURFMLPs();
+  bool is_quantized = !classifiers.empty();
+  for (size_t i = 0; i < classifiers.size(); i++) {
+    classifiers[i]->SetUseQuantized(enable);
+    is_quantized = classifiers[i]->is_quantized() && is_quantized;
+  }
+  // Also refreshes the copies of the classifiers held by the workers
+  SelectSURFMLPs(enable && is_quantized);
+}
+
+std::vector<seeta::fd::SURFMLP*> FuStDetector::GetSURFMLPs() {
+  std::vector<seeta::fd::SURFMLP*> classifiers;
+  for (size_t c = 0; c < cascades_.size(); c++) {
+    const Cascade & cascade = cascades_[c];
+    for (size_t i = 0; i < cascade.model.size(); i++) {
+      const std::shared_ptr<seeta::fd::Classifier> & model =
+        (i < cascade.generic_model.size() && cascade.generic_model[i] != nullptr ?
+        cascade.generic_model[i] : cascade.model[i]);
+      seeta::fd::SURFMLP* classifier =
+        dynamic_cast<seeta::fd::SURFMLP*>(model.get());
+      if (classifier != nullptr)
+        classifiers.push_back(classifier);
+    }
+  }
+  return classifiers;
+}
+
+bool FuStDetector::ReadCascade(std::istream* input, Cascade* cascade) {
+  bool is_loaded = true;
+  int32_t hierarchy_size;
+  int32_t num_stage;
+  int32_t num_wnd_src;
+  int32_t type_id;
+  std::shared_ptr<seeta::fd::ModelReader> reader;
+  std::shared_ptr<seeta::fd::Classifier> classifier;
+  seeta::fd::ClassifierType classifier_type;
+
+  cascade->num_hierarchy = 0;
+  input->read(reinterpret_cast<char*>(&(cascade->num_hierarchy)),
+    sizeof(int32_t));
+  for (int32_t i = 0; is_loaded && i < cascade->num_hierarchy; i++) {
+    input->read(reinterpret_cast<char*>(&hierarchy_size), sizeof(int32_t));
+    cascade->hierarchy_size.push_back(hierarchy_size);
+
+    for (int32_t j = 0; is_loaded && j < hierarchy_size; j++) {
+      input->read(reinterpret_cast<char*>(&num_stage), sizeof(int32_t));
+      cascade->num_stage.push_back(num_stage);
+
+      for (int32_t k = 0; is_loaded && k < num_stage; k++) {
+        input->read(reinterpret_cast<char*>(&type_id), sizeof(int32_t));
+        classifier_type = static_cast<seeta::fd::ClassifierType>(type_id);
+        reader = CreateModelReader(classifier_type);
+        classifier = CreateClassifier(classifier_type);
+
+        is_loaded = !input->fail() && reader != nullptr &&
+          reader->Read(input, classifier.get());
+        if (is_loaded) {
+          cascade->model.push_back(classifier);
+          if (cls2feat_idx_.count(classifier_type) == 0) {
+            cls2feat_idx_.insert(
+              std::map<seeta::fd::ClassifierType, int32_t>::value_type(
+              classifier_type, static_cast<int32_t>(feat_map_.size())));
+            feat_map_.push_back(CreateFeatureMap(classifier_type));
           }
+          classifier->SetFeatureMap(
+            feat_map_[cls2feat_idx_.at(classifier_type)].get());
         }
+      }
 
-        wnd_src_id_.push_back(std::vector<int32_t>());
-        model_file.read(reinterpret_cast<char*>(&num_wnd_src), sizeof(int32_t));
-        if (num_wnd_src > 0) {
-          wnd_src_id_.back().resize(num_wnd_src);
-          for (int32_t k = 0; k < num_wnd_src; k++) {
-            model_file.read(reinterpret_cast<char*>(&(wnd_src_id_.back()[k])),
-              sizeof(int32_t));
-          }
+      cascade->wnd_src_id.push_back(std::vector<int32_t>());
+      input->read(reinterpret_cast<char*>(&num_wnd_src), sizeof(int32_t));
+      if (num_wnd_src > 0) {
+        cascade->wnd_src_id.back().resize(num_wnd_src);
+        for (int32_t k = 0; k < num_wnd_src; k++) {
+          input->read(reinterpret_cast<char*>(&(cascade->wnd_src_id.back()[k])),
+            sizeof(int32_t));
         }
       }
     }
-
-    model_file.close();
   }
 
-  return is_loaded;
+  return is_loaded && !input->fail();
 }
 
 std::vector<seeta::FaceInfo> FuStDetector::Detect(
     seeta::fd::ImagePyramid* img_pyramid) {
+  std::vector<std::vector<std::vector<seeta::FaceInfo> > > proposals;
+  ProposeWindows(img_pyramid, &proposals);
+
+  // Following classifiers, with the detections of all cascades merged by a
+  // single non-maximum suppression
+
+  seeta::ImageData img = img_pyramid->image1x();
+  seeta::Rect region;
+  region.x = region.y = 0;
+  region.width = img.width;
+  region.height = img.height;
+  std::vector<seeta::FaceInfo> bboxes;
+  std::vector<seeta::FaceInfo> bboxes_nms;
+
+  int32_t num_cascade = static_cast<int32_t>(cascades_.size());
+  for (int32_t c = 0; c < num_cascade; c++)
+    RunCascade(c, img, region, &(proposals[c]), &bboxes);
+  seeta::fd::NonMaximumSuppression(&bboxes, &bboxes_nms, 0.3f);
+
+  return bboxes_nms;
+}
+
+std::vector<std::vector<seeta::FaceInfo> > FuStDetector::DetectRegions(
+    seeta::fd::ImagePyramid* img_pyramid,
+    const seeta::fd::WindowFilter & filter) {
+  std::vector<std::vector<std::vector<seeta::FaceInfo> > > proposals;
+  ProposeWindows(img_pyramid, &proposals);
+
+  // The proposals of each region go through the following classifiers and the
+  // non-maximum suppression apart from those of the other regions
+
+  seeta::ImageData img = img_pyramid->image1x();
+  int32_t num_cascade = static_cast<int32_t>(cascades_.size());
+  int32_t num_region = filter.num_region();
+  std::vector<std::vector<std::vector<seeta::FaceInfo> > > region_proposals(
+    num_cascade);
+  std::vector<seeta::FaceInfo> bboxes;
+  std::vector<std::vector<seeta::FaceInfo> > bboxes_nms(num_region);
+
+  for (int32_t r = 0; r < num_region; r++) {
+    bboxes.clear();
+    for (int32_t c = 0; c < num_cascade; c++) {
+      region_proposals[c].resize(proposals[c].size());
+      for (size_t i = 0; i < proposals[c].size(); i++) {
+        const std::vector<seeta::FaceInfo> & wnds = proposals[c][i];
+        std::vector<seeta::FaceInfo> & region_wnds = region_proposals[c][i];
+        region_wnds.clear();
+        for (size_t j = 0; j < wnds.size(); j++) {
+          if (filter.Accept(wnds[j].bbox) == r)
+            region_wnds.push_back(wnds[j]);
+        }
+      }
+      RunCascade(c, img, filter.region(r), &(region_proposals[c]), &bboxes);
+    }
+    seeta::fd::NonMaximumSuppression(&bboxes, &(bboxes_nms[r]), 0.3f);
+  }
+
+  return bboxes_nms;
+}
+
+void FuStDetector::ProposeWindows(seeta::fd::ImagePyramid* img_pyramid,
+    std::vector<std::vector<std::vector<seeta::FaceInfo> > >* proposals_out) {
   float score;
   seeta::FaceInfo wnd_info;
   seeta::Rect wnd;
   float scale_factor = 0.0;
   const seeta::ImageData* img_scaled =
     img_pyramid->GetNextScaleImage(&scale_factor);
+  int32_t num_cascade = static_cast<int32_t>(cascades_.size());
 
   wnd.height = wnd.width = wnd_size_;
 
-  // Sliding window
-
-  std::vector<std::vector<seeta::FaceInfo> > proposals(hierarchy_size_[0]);
-  std::shared_ptr<seeta::fd::FeatureMap> & feat_map_1 =
-    feat_map_[cls2feat_idx_[model_[0]->type()]];
+  // Sliding window, where the first hierarchies of all cascades share the
+  // feature maps of each pyramid level
+
+  std::vector<std::vector<std::vector<seeta::FaceInfo> > > & proposals =
+    *proposals_out;
+  proposals.assign(num_cascade, std::vector<std::vector<seeta::FaceInfo> >());
+  std::vector<int32_t> feat_idx_1;
+  std::vector<seeta::fd::ClassifierType> feat_type_1;
+  for (int32_t c = 0; c < num_cascade; c++) {
+    proposals[c].resize(cascades_[c].hierarchy_size[0]);
+    seeta::fd::ClassifierType type = cascades_[c].model[0]->type();
+    int32_t feat_idx = cls2feat_idx_[type];
+    if (std::find(feat_idx_1.begin(), feat_idx_1.end(), feat_idx) ==
+        feat_idx_1.end()) {
+      feat_idx_1.push_back(feat_idx);
+      feat_type_1.push_back(type);
+    }
+  }
+  int32_t num_feat_map_1 = static_cast<int32_t>(feat_idx_1.size());
+  std::vector<seeta::fd::FeatureMap*> feat_map_1(num_feat_map_1);
+  bool use_level_feat_map = false;
 
   while (img_scaled != nullptr) {
-    feat_map_1->Compute(img_scaled->data, img_scaled->width,
-      img_scaled->height);
+    // Feature maps kept with the pyramid level are computed on its first pass
+    // and reused afterwards, in place of those of the detector
+    std::vector<std::shared_ptr<seeta::fd::FeatureMap> >* level_feat_map =
+      img_pyramid->GetLevelFeatureMaps();
+    if (level_feat_map != nullptr) {
+      level_feat_map->resize(feat_map_.size());
+      for (int32_t f = 0; f < num_feat_map_1; f++) {
+        std::shared_ptr<seeta::fd::FeatureMap> & feat_map =
+          (*level_feat_map)[feat_idx_1[f]];
+        if (feat_map == nullptr) {
+          feat_map = CreateFeatureMap(feat_type_1[f]);
+          feat_map->Compute(img_scaled->data, img_scaled->width,
+            img_scaled->height);
+        }
+        feat_map_1[f] = feat_map.get();
+      }
+      SetFirstHierarchyFeatureMaps(*level_feat_map);
+      use_level_feat_map = true;
+    } else {
+      for (int32_t f = 0; f < num_feat_map_1; f++) {
+        feat_map_1[f] = feat_map_[feat_idx_1[f]].get();
+        if (stream_feat_map_) {
+          feat_map_1[f]->BeginStream(img_scaled->data, img_scaled->width,
+            img_scaled->height, wnd_size_);
+        } else {
+          feat_map_1[f]->Compute(img_scaled->data, img_scaled->width,
+            img_scaled->height);
+        }
+      }
+    }
 
     wnd_info.bbox.width = static_cast<int32_t>(wnd_size_ / scale_factor + 0.5);
     wnd_info.bbox.height = wnd_info.bbox.width;
@@ -145,17 +361,23 @@ std::vector<seeta::FaceInfo> FuStDetector::Detect(
     int32_t max_y = img_scaled->height - wnd_size_;
     for (int32_t y = 0; y <= max_y; y += slide_wnd_step_y_) {
       wnd.y = y;
+      for (int32_t f = 0; f < num_feat_map_1; f++)
+        feat_map_1[f]->ComputeRows(y + wnd_size_);
       for (int32_t x = 0; x <= max_x; x += slide_wnd_step_x_) {
         wnd.x = x;
-        feat_map_1->SetROI(wnd);
+        for (int32_t f = 0; f < num_feat_map_1; f++)
+          feat_map_1[f]->SetROI(wnd);
 
         wnd_info.bbox.x = static_cast<int32_t>(x / scale_factor + 0.5);
         wnd_info.bbox.y = static_cast<int32_t>(y / scale_factor + 0.5);
 
-        for (int32_t i = 0; i < hierarchy_size_[0]; i++) {
-          if (model_[i]->Classify(&score)) {
-            wnd_info.score = static_cast<double>(score);
-            proposals[i].push_back(wnd_info);
+        for (int32_t c = 0; c < num_cascade; c++) {
+          const Cascade & cascade = cascades_[c];
+          for (int32_t i = 0; i < cascade.hierarchy_size[0]; i++) {
+            if (cascade.model[i]->Classify(&score)) {
+              wnd_info.score = static_cast<double>(score);
+              proposals[c][i].push_back(wnd_info);
+            }
           }
         }
       }
@@ -163,84 +385,90 @@ std::vector<seeta::FaceInfo> FuStDetector::Detect(
 
     img_scaled = img_pyramid->GetNextScaleImage(&scale_factor);
   }
+  if (use_level_feat_map)
+    SetFirstHierarchyFeatureMaps(feat_map_);
+}
 
-  std::vector<std::vector<seeta::FaceInfo> > proposals_nms(hierarchy_size_[0]);
-  for (int32_t i = 0; i < hierarchy_size_[0]; i++) {
-    seeta::fd::NonMaximumSuppression(&(proposals[i]),
-      &(proposals_nms[i]), 0.8f);
-    proposals[i].clear();
+void FuStDetector::SetFirstHierarchyFeatureMaps(
+    const std::vector<std::shared_ptr<seeta::fd::FeatureMap> > & feat_map) {
+  for (size_t c = 0; c < cascades_.size(); c++) {
+    Cascade & cascade = cascades_[c];
+    for (int32_t i = 0; i < cascade.hierarchy_size[0]; i++) {
+      cascade.model[i]->SetFeatureMap(
+        feat_map[cls2feat_idx_[cascade.model[i]->type()]].get());
+    }
   }
+}
 
-  // Following classifiers
-
-  seeta::ImageData img = img_pyramid->image1x();
-  seeta::Rect roi;
-  std::vector<float> mlp_predicts(4);  // @todo no hard-coded number!
-  roi.x = roi.y = 0;
-  roi.width = roi.height = wnd_size_;
+void FuStDetector::RunCascade(int32_t cascade_idx, const seeta::ImageData & img,
+    const seeta::Rect & region,
+    std::vector<std::vector<seeta::FaceInfo> >* proposals,
+    std::vector<seeta::FaceInfo>* bboxes_out) {
+  const Cascade & cascade = cascades_[cascade_idx];
+  int32_t num_hierarchy = cascade.num_hierarchy;
+  const std::vector<int32_t> & hierarchy_size = cascade.hierarchy_size;
+  const std::vector<int32_t> & num_stage = cascade.num_stage;
+
+  std::vector<std::vector<seeta::FaceInfo> > proposals_nms(hierarchy_size[0]);
+  for (int32_t i = 0; i < hierarchy_size[0]; i++) {
+    seeta::fd::NonMaximumSuppression(&((*proposals)[i]),
+      &(proposals_nms[i]), 0.8f);
+    (*proposals)[i].clear();
+  }
 
-  int32_t cls_idx = hierarchy_size_[0];
-  int32_t model_idx = hierarchy_size_[0];
+  int32_t cls_idx = hierarchy_size[0];
+  int32_t model_idx = hierarchy_size[0];
+  int32_t num_worker = static_cast<int32_t>(workers_.size());
   std::vector<int32_t> buf_idx;
 
-  for (int32_t i = 1; i < num_hierarchy_; i++) {
-    buf_idx.resize(hierarchy_size_[i]);
-    for (int32_t j = 0; j < hierarchy_size_[i]; j++) {
-      int32_t num_wnd_src = static_cast<int32_t>(wnd_src_id_[cls_idx].size());
-      std::vector<int32_t> & wnd_src = wnd_src_id_[cls_idx];
+  for (int32_t i = 1; i < num_hierarchy; i++) {
+    buf_idx.resize(hierarchy_size[i]);
+    for (int32_t j = 0; j < hierarchy_size[i]; j++) {
+      int32_t num_wnd_src = static_cast<int32_t>(cascade.wnd_src_id[cls_idx].size());
+      const std::vector<int32_t> & wnd_src = cascade.wnd_src_id[cls_idx];
+      std::vector<seeta::FaceInfo> & bboxes = (*proposals)[wnd_src[0]];
       buf_idx[j] = wnd_src[0];
-      proposals[buf_idx[j]].clear();
+      bboxes.clear();
       for (int32_t k = 0; k < num_wnd_src; k++) {
-        proposals[buf_idx[j]].insert(proposals[buf_idx[j]].end(),
-          proposals_nms[wnd_src[k]].begin(), proposals_nms[wnd_src[k]].end());
+        bboxes.insert(bboxes.end(), proposals_nms[wnd_src[k]].begin(),
+          proposals_nms[wnd_src[k]].end());
       }
 
-      std::shared_ptr<seeta::fd::FeatureMap> & feat_map =
-        feat_map_[cls2feat_idx_[model_[model_idx]->type()]];
-      for (int32_t k = 0; k < num_stage_[cls_idx]; k++) {
-        int32_t num_wnd = static_cast<int32_t>(proposals[buf_idx[j]].size());
-        std::vector<seeta::FaceInfo> & bboxes = proposals[buf_idx[j]];
-        int32_t bbox_idx = 0;
+      for (int32_t k = 0; k < num_stage[cls_idx]; k++) {
+        int32_t num_wnd = static_cast<int32_t>(bboxes.size());
+        int32_t feat_idx = cls2feat_idx_[cascade.model[model_idx]->type()];
+
+        refined_wnds_.resize(num_wnd);
+        refined_mask_.resize(num_wnd);
+
+        // Windows are distributed among the workers, and the survivors are
+        // collected afterwards in the original order, so that the results do
+        // not depend on the number of threads.
+#pragma omp parallel num_threads(num_worker) if (num_wnd > 1)
+        {
+          RefineWorker* worker = &(workers_[0]);
+#ifdef USE_OPENMP
+          worker = &(workers_[omp_get_thread_num()]);
+#endif
+
+#pragma omp for schedule(dynamic) nowait
+          for (int32_t m = 0; m < num_wnd; m++) {
+            refined_mask_[m] = RefineWindow(worker, cascade_idx, model_idx,
+              feat_idx, img, region, bboxes[m], &(refined_wnds_[m])) ? 1 : 0;
+          }
+        }
 
+        int32_t bbox_idx = 0;
         for (int32_t m = 0; m < num_wnd; m++) {
-          if (bboxes[m].bbox.x + bboxes[m].bbox.width <= 0 ||
-              bboxes[m].bbox.y + bboxes[m].bbox.height <= 0)
-            continue;
-          GetWindowData(img, bboxes[m].bbox);
-          feat_map->Compute(wnd_data_.data(), wnd_size_, wnd_size_);
-          feat_map->SetROI(roi);
-
-          if (model_[model_idx]->Classify(&score, mlp_predicts.data())) {
-            float x = static_cast<float>(bboxes[m].bbox.x);
-            float y = static_cast<float>(bboxes[m].bbox.y);
-            float w = static_cast<float>(bboxes[m].bbox.width);
-            float h = static_cast<float>(bboxes[m].bbox.height);
-
-            bboxes[bbox_idx].bbox.width =
-              static_cast<int32_t>((mlp_predicts[3] * 2 - 1) * w + w + 0.5);
-            bboxes[bbox_idx].bbox.height = bboxes[bbox_idx].bbox.width;
-            bboxes[bbox_idx].bbox.x =
-              static_cast<int32_t>((mlp_predicts[1] * 2 - 1) * w + x +
-              (w - bboxes[bbox_idx].bbox.width) * 0.5 + 0.5);
-            bboxes[bbox_idx].bbox.y =
-              static_cast<int32_t>((mlp_predicts[2] * 2 - 1) * h + y +
-              (h - bboxes[bbox_idx].bbox.height) * 0.5 + 0.5);
-            bboxes[bbox_idx].score = score;
-            bbox_idx++;
-          }
+          if (refined_mask_[m] != 0)
+            bboxes[bbox_idx++] = refined_wnds_[m];
         }
-        proposals[buf_idx[j]].resize(bbox_idx);
+        bboxes.resize(bbox_idx);
 
-        if (k < num_stage_[cls_idx] - 1) {
-          seeta::fd::NonMaximumSuppression(&(proposals[buf_idx[j]]),
+        if (k < num_stage[cls_idx] - 1) {
+          seeta::fd::NonMaximumSuppression(&bboxes,
             &(proposals_nms[buf_idx[j]]), 0.8f);
-          proposals[buf_idx[j]] = proposals_nms[buf_idx[j]];
-        } else {
-          if (i == num_hierarchy_ - 1) {
-            seeta::fd::NonMaximumSuppression(&(proposals[buf_idx[j]]),
-              &(proposals_nms[buf_idx[j]]), 0.3f);
-            proposals[buf_idx[j]] = proposals_nms[buf_idx[j]];
-          }
+          bboxes = proposals_nms[buf_idx[j]];
         }
         model_idx++;
       }
@@ -248,11 +476,94 @@ std::vector<seeta::FaceInfo> FuStDetector::Detect(
       cls_idx++;
     }
 
-    for (int32_t j = 0; j < hierarchy_size_[i]; j++)
-      proposals_nms[j] = proposals[buf_idx[j]];
+    for (int32_t j = 0; j < hierarchy_size[i]; j++)
+      proposals_nms[j] = (*proposals)[buf_idx[j]];
   }
 
-  return proposals_nms[0];
+  bboxes_out->insert(bboxes_out->end(), proposals_nms[0].begin(),
+    proposals_nms[0].end());
+}
+
+void FuStDetector::CreateRefineWorkers() {
+#ifdef USE_OPENMP
+  int32_t num_worker = SEETA_NUM_THREADS;
+#else
+  int32_t num_worker = 1;
+#endif
+  int32_t num_cascade = static_cast<int32_t>(cascades_.size());
+
+  workers_.clear();
+  workers_.resize(num_worker);
+  for (int32_t t = 0; t < num_worker; t++) {
+    RefineWorker & worker = workers_[t];
+
+    worker.feat_map.resize(feat_map_.size());
+    std::map<seeta::fd::ClassifierType, int32_t>::const_iterator iter;
+    for (iter = cls2feat_idx_.begin(); iter != cls2feat_idx_.end(); ++iter) {
+      worker.feat_map[iter->second] = (t == 0 ? feat_map_[iter->second] :
+        CreateFeatureMap(iter->first));
+    }
+
+    worker.model.resize(num_cascade);
+    for (int32_t c = 0; c < num_cascade; c++) {
+      const Cascade & cascade = cascades_[c];
+      worker.model[c].resize(cascade.model.size());
+      for (size_t i = cascade.hierarchy_size[0]; i < cascade.model.size(); i++) {
+        if (t == 0) {
+          worker.model[c][i] = cascade.model[i];
+        } else {
+          worker.model[c][i] = cascade.model[i]->Clone();
+          worker.model[c][i]->SetFeatureMap(
+            worker.feat_map[cls2feat_idx_.at(cascade.model[i]->type())].get());
+        }
+      }
+    }
+
+    worker.mlp_predicts.resize(4);  // @todo no hard-coded number!
+  }
+}
+
+bool FuStDetector::RefineWindow(RefineWorker* worker, int32_t cascade_idx,
+    int32_t model_idx, int32_t feat_idx, const seeta::ImageData & img,
+    const seeta::Rect & region, const seeta::FaceInfo & wnd_info,
+    seeta::FaceInfo* result) {
+  const seeta::Rect & bbox = wnd_info.bbox;
+  if (bbox.x + bbox.width <= region.x || bbox.y + bbox.height <= region.y)
+    return false;
+
+  seeta::fd::FeatureMap* feat_map = worker->feat_map[feat_idx].get();
+  float* mlp_predicts = worker->mlp_predicts.data();
+  float score;
+  seeta::Rect roi;
+  roi.x = roi.y = 0;
+  roi.width = roi.height = wnd_size_;
+
+  worker->wnd_data.resize(wnd_size_ * wnd_size_);
+  GetWindowData(img, region, bbox, &(worker->wnd_data_buf),
+    worker->wnd_data.data());
+  feat_map->Compute(worker->wnd_data.data(), wnd_size_, wnd_size_);
+  feat_map->SetROI(roi);
+
+  if (!worker->model[cascade_idx][model_idx]->Classify(&score, mlp_predicts))
+    return false;
+
+  float x = static_cast<float>(bbox.x);
+  float y = static_cast<float>(bbox.y);
+  float w = static_cast<float>(bbox.width);
+  float h = static_cast<float>(bbox.height);
+
+  *result = wnd_info;
+  result->bbox.width =
+    static_cast<int32_t>((mlp_predicts[3] * 2 - 1) * w + w + 0.5);
+  result->bbox.height = result->bbox.width;
+  result->bbox.x =
+    static_cast<int32_t>((mlp_predicts[1] * 2 - 1) * w + x +
+    (w - result->bbox.width) * 0.5 + 0.5);
+  result->bbox.y =
+    static_cast<int32_t>((mlp_predicts[2] * 2 - 1) * h + y +
+    (h - result->bbox.height) * 0.5 + 0.5);
+  result->score = score;
+  return true;
 }
 
 std::shared_ptr<seeta::fd::ModelReader>
@@ -304,7 +615,8 @@ FuStDetector::CreateFeatureMap(seeta::fd::ClassifierType type) {
 }
 
 void FuStDetector::GetWindowData(const seeta::ImageData & img,
-    const seeta::Rect & wnd) {
+    const seeta::Rect & region, const seeta::Rect & wnd,
+    std::vector<uint8_t>* buf, uint8_t* wnd_data) {
   int32_t pad_left;
   int32_t pad_right;
   int32_t pad_top;
@@ -312,22 +624,22 @@ void FuStDetector::GetWindowData(const seeta::ImageData & img,
   seeta::Rect roi = wnd;
 
   pad_left = pad_right = pad_top = pad_bottom = 0;
-  if (roi.x + roi.width > img.width)
-    pad_right = roi.x + roi.width - img.width;
-  if (roi.x < 0) {
-    pad_left = -roi.x;
-    roi.x = 0;
+  if (roi.x + roi.width > region.x + region.width)
+    pad_right = roi.x + roi.width - (region.x + region.width);
+  if (roi.x < region.x) {
+    pad_left = region.x - roi.x;
+    roi.x = region.x;
   }
-  if (roi.y + roi.height > img.height)
-    pad_bottom = roi.y + roi.height - img.height;
-  if (roi.y < 0) {
-    pad_top = -roi.y;
-    roi.y = 0;
+  if (roi.y + roi.height > region.y + region.height)
+    pad_bottom = roi.y + roi.height - (region.y + region.height);
+  if (roi.y < region.y) {
+    pad_top = region.y - roi.y;
+    roi.y = region.y;
   }
 
-  wnd_data_buf_.resize(roi.width * roi.height);
+  buf->resize(roi.width * roi.height);
   const uint8_t* src = img.data + roi.y * img.width + roi.x;
-  uint8_t* dest = wnd_data_buf_.data();
+  uint8_t* dest = buf->data();
   int32_t len = sizeof(uint8_t) * roi.width;
   int32_t len2 = sizeof(uint8_t) * (roi.width - pad_left - pad_right);
 
@@ -373,8 +685,8 @@ void FuStDetector::GetWindowData(const seeta::ImageData & img,
 
   seeta::ImageData src_img(roi.width, roi.height);
   seeta::ImageData dest_img(wnd_size_, wnd_size_);
-  src_img.data = wnd_data_buf_.data();
-  dest_img.data = wnd_data_.data();
+  src_img.data = buf->data();
+  dest_img.data = wnd_data;
   seeta::fd::ResizeImage(src_img, &dest_img);
 }
 
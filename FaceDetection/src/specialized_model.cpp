@@ -0,0 +1,69 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include "specialized_model.h"
+
+#include <map>
+
+namespace seeta {
+namespace fd {
+
+static std::map<uint64_t, SpecializedModelRegistry::CreateClassifiersFunc> &
+    Registry() {
+  static std::map<uint64_t, SpecializedModelRegistry::CreateClassifiersFunc>
+    registry;
+  return registry;
+}
+
+bool SpecializedModelRegistry::Register(uint64_t fingerprint,
+    CreateClassifiersFunc func) {
+  return Registry().insert(std::make_pair(fingerprint, func)).second;
+}
+
+SpecializedModelRegistry::CreateClassifiersFunc SpecializedModelRegistry::Find(
+    uint64_t fingerprint) {
+  std::map<uint64_t, CreateClassifiersFunc>::const_iterator iter =
+    Registry().find(fingerprint);
+  return (iter != Registry().end() ? iter->second : nullptr);
+}
+
+uint64_t SpecializedModelRegistry::Fingerprint(const char* data,
+    std::size_t len) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (std::size_t i = 0; i < len; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+}  // namespace fd
+}  // namespace seeta
@@ -0,0 +1,120 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is an example of how to use SeetaFace engine for face detection, the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "face_detection.h"
+
+using namespace std;
+
+static seeta::ImageData ToImageData(const cv::Mat & img) {
+  seeta::ImageData img_data(img.cols, img.rows, 1);
+  img_data.data = img.data;
+  return img_data;
+}
+
+static bool IsSame(const vector<seeta::FaceInfo> & a,
+    const vector<seeta::FaceInfo> & b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].bbox.x != b[i].bbox.x || a[i].bbox.y != b[i].bbox.y ||
+        a[i].bbox.width != b[i].bbox.width ||
+        a[i].bbox.height != b[i].bbox.height || a[i].score != b[i].score)
+      return false;
+  }
+  return true;
+}
+
+// Checks that a batch of one image gets the results of Detect() on it, for
+// crops of the test image small enough to go through an atlas, and that an
+// image too large for the atlases gets them in a batch with small ones.
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    cout << "Usage: " << argv[0] << " image_path model_path" << endl;
+    return -1;
+  }
+
+  cv::Mat img_gray = cv::imread(argv[1], cv::IMREAD_GRAYSCALE);
+  if (img_gray.empty()) {
+    cerr << "Failed to read image: " << argv[1] << endl;
+    return -1;
+  }
+
+  seeta::FaceDetection detector(argv[2]);
+  detector.SetMinFaceSize(40);
+  detector.SetScoreThresh(2.f);
+  detector.SetImagePyramidScaleFactor(0.8f);
+  detector.SetWindowStep(4, 4);
+
+  const int32_t crop_sizes[] = {120, 160, 200, 256};
+  vector<cv::Mat> crops;
+  for (size_t s = 0; s < sizeof(crop_sizes) / sizeof(crop_sizes[0]); s++) {
+    int32_t size = crop_sizes[s];
+    for (int32_t y = 0; y + size <= img_gray.rows; y += size) {
+      for (int32_t x = 0; x + size <= img_gray.cols; x += size)
+        crops.push_back(img_gray(cv::Rect(x, y, size, size)).clone());
+    }
+  }
+
+  int32_t num_fail = 0;
+  int32_t num_face = 0;
+  for (size_t i = 0; i < crops.size(); i++) {
+    seeta::ImageData crop = ToImageData(crops[i]);
+    vector<seeta::FaceInfo> faces = detector.Detect(crop);
+    vector<vector<seeta::FaceInfo> > batch_faces =
+      detector.DetectBatch(vector<seeta::ImageData>(1, crop));
+    num_face += static_cast<int32_t>(faces.size());
+    if (!IsSame(batch_faces[0], faces)) {
+      cerr << "Crop " << i << " (" << crops[i].cols << "x" << crops[i].rows
+          << "): " << batch_faces[0].size() << " faces in a batch, "
+          << faces.size() << " by Detect()" << endl;
+      num_fail++;
+    }
+  }
+
+  vector<seeta::ImageData> mixed(1, ToImageData(img_gray));
+  for (size_t i = 0; i < crops.size() && i < 8; i++)
+    mixed.push_back(ToImageData(crops[i]));
+  if (!IsSame(detector.DetectBatch(mixed)[0], detector.Detect(mixed[0]))) {
+    cerr << "The large image of a mixed batch differs from Detect()" << endl;
+    num_fail++;
+  }
+
+  cout << crops.size() << " crops, " << num_face << " faces, " << num_fail
+      << " mismatches" << endl;
+  return (num_fail == 0 ? 0 : 1);
+}
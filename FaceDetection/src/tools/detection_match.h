@@ -0,0 +1,133 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#ifndef SEETA_FD_TOOLS_DETECTION_MATCH_H_
+#define SEETA_FD_TOOLS_DETECTION_MATCH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "common.h"
+
+namespace seeta {
+namespace fd {
+
+// Minimum IoU for a box to match a reference one
+static const float kMatchIoU = 0.5f;
+
+inline float IoU(const seeta::Rect & a, const seeta::Rect & b) {
+  int32_t x1 = std::max(a.x, b.x);
+  int32_t y1 = std::max(a.y, b.y);
+  int32_t x2 = std::min(a.x + a.width, b.x + b.width);
+  int32_t y2 = std::min(a.y + a.height, b.y + b.height);
+  if (x2 <= x1 || y2 <= y1)
+    return 0.0f;
+  float inter = static_cast<float>(x2 - x1) * (y2 - y1);
+  return inter / (a.width * a.height + b.width * b.height - inter);
+}
+
+/**
+ * @brief Greedily match each box, in the given order, to its best unmatched
+ *        reference box with an IoU of at least `kMatchIoU`.
+ *
+ * `(*matches)[i]` receives the index of the reference box matched to the i-th
+ * box, or -1. Returns the number of matches.
+ */
+inline int32_t MatchBoxes(const std::vector<seeta::Rect> & boxes,
+    const std::vector<seeta::Rect> & ref_boxes, std::vector<int32_t>* matches) {
+  std::vector<bool> is_matched(ref_boxes.size(), false);
+  int32_t num_match = 0;
+  matches->assign(boxes.size(), -1);
+  for (size_t i = 0; i < boxes.size(); i++) {
+    int32_t best = -1;
+    float best_iou = kMatchIoU;
+    for (size_t j = 0; j < ref_boxes.size(); j++) {
+      float iou = IoU(boxes[i], ref_boxes[j]);
+      if (!is_matched[j] && iou >= best_iou) {
+        best = static_cast<int32_t>(j);
+        best_iou = iou;
+      }
+    }
+    if (best >= 0) {
+      is_matched[best] = true;
+      (*matches)[i] = best;
+      num_match++;
+    }
+  }
+  return num_match;
+}
+
+inline std::vector<seeta::Rect> GetBoxes(
+    const std::vector<seeta::FaceInfo> & faces) {
+  std::vector<seeta::Rect> boxes(faces.size());
+  for (size_t i = 0; i < faces.size(); i++)
+    boxes[i] = faces[i].bbox;
+  return boxes;
+}
+
+inline seeta::ImageData ToImageData(const cv::Mat & img) {
+  seeta::ImageData img_data(img.cols, img.rows, 1);
+  img_data.data = img.data;
+  return img_data;
+}
+
+/** Read the gray images listed in a text file, one path per line */
+inline bool LoadImageList(const std::string & list_path,
+    std::vector<cv::Mat>* images) {
+  std::ifstream list(list_path.c_str());
+  if (!list.is_open())
+    return false;
+
+  std::string path;
+  while (std::getline(list, path)) {
+    if (path.empty())
+      continue;
+    cv::Mat img = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    if (img.empty()) {
+      std::cerr << "Failed to read image: " << path << std::endl;
+      continue;
+    }
+    images->push_back(img);
+  }
+  return true;
+}
+
+}  // namespace fd
+}  // namespace seeta
+
+#endif  // SEETA_FD_TOOLS_DETECTION_MATCH_H_
@@ -0,0 +1,336 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "face_detection.h"
+#include "detection_match.h"
+
+using namespace std;
+using seeta::fd::ToImageData;
+
+typedef struct Sample {
+  string path;
+  cv::Mat img;
+  vector<seeta::Rect> faces;
+} Sample;
+
+typedef struct Setting {
+  int32_t wnd_step;
+  float scale_factor;
+  int32_t min_face_size;
+  float thresh;
+  string mode;
+} Setting;
+
+static void PrintUsage(const char* name) {
+  cout << "Usage: " << name << " model_path annotation_list [options]" << endl
+      << "       " << name << " model_path image_directory [options]" << endl
+      << endl
+      << "annotation_list is a text file with one image per line," << endl
+      << "  image_path num_faces x y width height [x y width height ...]" << endl
+      << "image_directory holds images, each annotated by a text file of the"
+      << endl
+      << "same name with the extension replaced by .txt and one" << endl
+      << "'x y width height' per line; images without it are skipped." << endl
+      << endl
+      << "Options, each taking a comma-separated list of values:" << endl
+      << "  --step        sliding window steps (default: 4)" << endl
+      << "  --scale       image pyramid scale factors (default: 0.8)" << endl
+      << "  --min-size    minimum face sizes (default: 40)" << endl
+      << "  --thresh      score thresholds (default: 2.0)" << endl
+      << "  --mode        any of default, streaming, quantized (default: default)"
+      << endl
+      << endl
+      << "Other options:" << endl
+      << "  --calib       list file of the images calibrating the quantized mode,"
+      << endl
+      << "                one path per line (default: the evaluated images)"
+      << endl;
+}
+
+static vector<string> Split(const string & str) {
+  vector<string> items;
+  stringstream ss(str);
+  string item;
+  while (getline(ss, item, ','))
+    if (!item.empty())
+      items.push_back(item);
+  return items;
+}
+
+static bool ReadFaces(istream* input, int32_t num_face,
+    vector<seeta::Rect>* faces) {
+  for (int32_t i = 0; i < num_face; i++) {
+    seeta::Rect face;
+    if (!(*input >> face.x >> face.y >> face.width >> face.height))
+      return false;
+    faces->push_back(face);
+  }
+  return true;
+}
+
+static bool LoadImage(Sample* sample) {
+  sample->img = cv::imread(sample->path, cv::IMREAD_GRAYSCALE);
+  if (sample->img.empty()) {
+    cerr << "Failed to read image: " << sample->path << endl;
+    return false;
+  }
+  return true;
+}
+
+static bool IsDirectory(const string & path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static bool LoadList(const string & list_path, vector<Sample>* samples) {
+  ifstream list(list_path.c_str());
+  if (!list.is_open())
+    return false;
+
+  string line;
+  while (getline(list, line)) {
+    istringstream input(line);
+    Sample sample;
+    int32_t num_face = 0;
+    if (!(input >> sample.path >> num_face))
+      continue;
+    if (!ReadFaces(&input, num_face, &(sample.faces))) {
+      cerr << "Invalid annotation: " << line << endl;
+      continue;
+    }
+    if (LoadImage(&sample))
+      samples->push_back(sample);
+  }
+  return true;
+}
+
+static void LoadDirectory(const string & dir_path, vector<Sample>* samples) {
+  vector<cv::String> files;
+  cv::glob(dir_path, files, false);
+  for (size_t i = 0; i < files.size(); i++) {
+    string path = files[i];
+    size_t ext_pos = path.find_last_of('.');
+    if (ext_pos == string::npos || path.substr(ext_pos) == ".txt")
+      continue;
+
+    ifstream annotation((path.substr(0, ext_pos) + ".txt").c_str());
+    if (!annotation.is_open())
+      continue;
+
+    Sample sample;
+    sample.path = path;
+    seeta::Rect face;
+    while (annotation >> face.x >> face.y >> face.width >> face.height)
+      sample.faces.push_back(face);
+    if (LoadImage(&sample))
+      samples->push_back(sample);
+  }
+}
+
+/** Number of detections matched to annotated faces, in order of score */
+static int32_t CountMatches(vector<seeta::FaceInfo> faces,
+    const vector<seeta::Rect> & gt_faces) {
+  sort(faces.begin(), faces.end(),
+    [](const seeta::FaceInfo & a, const seeta::FaceInfo & b) {
+      return a.score > b.score;
+    });
+
+  vector<int32_t> matches;
+  return seeta::fd::MatchBoxes(seeta::fd::GetBoxes(faces), gt_faces, &matches);
+}
+
+static double Percentile(vector<double> values, double p) {
+  if (values.empty())
+    return 0;
+  sort(values.begin(), values.end());
+  size_t idx = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+  return values[idx];
+}
+
+static void RunSetting(const char* model_path, const Setting & setting,
+    const vector<Sample> & samples, const vector<cv::Mat> & calib_images) {
+  seeta::FaceDetection detector(model_path);
+  detector.SetWindowStep(setting.wnd_step, setting.wnd_step);
+  detector.SetImagePyramidScaleFactor(setting.scale_factor);
+  detector.SetMinFaceSize(setting.min_face_size);
+  detector.SetScoreThresh(setting.thresh);
+
+  if (setting.mode == "streaming") {
+    detector.SetStreamingFeatureMap(true);
+  } else if (setting.mode == "quantized") {
+    // Calibrated on the evaluated images themselves without --calib
+    vector<seeta::ImageData> calib_data;
+    if (calib_images.empty()) {
+      for (size_t i = 0; i < samples.size(); i++)
+        calib_data.push_back(ToImageData(samples[i].img));
+    } else {
+      for (size_t i = 0; i < calib_images.size(); i++)
+        calib_data.push_back(ToImageData(calib_images[i]));
+    }
+    if (!detector.CalibrateQuantizedMLP(calib_data))
+      cerr << "Calibration failed, running the float model." << endl;
+  }
+
+  // Warm up caches and buffers before timing
+  detector.Detect(ToImageData(samples[0].img));
+
+  int64_t num_gt = 0;
+  int64_t num_det = 0;
+  int64_t num_match = 0;
+  double total_secs = 0;
+  vector<double> latency_ms;
+
+  for (size_t i = 0; i < samples.size(); i++) {
+    int64_t t0 = cv::getTickCount();
+    vector<seeta::FaceInfo> faces = detector.Detect(ToImageData(samples[i].img));
+    int64_t t1 = cv::getTickCount();
+    double secs = (t1 - t0) / cv::getTickFrequency();
+    total_secs += secs;
+    latency_ms.push_back(secs * 1000);
+
+    num_gt += samples[i].faces.size();
+    num_det += faces.size();
+    num_match += CountMatches(faces, samples[i].faces);
+  }
+
+  cout << setting.wnd_step << "\t" << setting.scale_factor << "\t"
+      << setting.min_face_size << "\t" << setting.thresh << "\t"
+      << setting.mode << "\t"
+      << (num_gt > 0 ? static_cast<double>(num_match) / num_gt : 0) << "\t"
+      << (num_det > 0 ? static_cast<double>(num_match) / num_det : 0) << "\t"
+      << (total_secs > 0 ? samples.size() / total_secs : 0) << "\t"
+      << Percentile(latency_ms, 0.5) << "\t"
+      << Percentile(latency_ms, 0.9) << "\t"
+      << Percentile(latency_ms, 0.99) << endl;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3 || (argc - 3) % 2 != 0) {
+    PrintUsage(argv[0]);
+    return -1;
+  }
+
+  vector<string> steps(1, "4");
+  vector<string> scales(1, "0.8");
+  vector<string> min_sizes(1, "40");
+  vector<string> threshs(1, "2.0");
+  vector<string> modes(1, "default");
+  string calib_path;
+  for (int i = 3; i < argc; i += 2) {
+    string option = argv[i];
+    vector<string> values = Split(argv[i + 1]);
+    if (option == "--calib") {
+      calib_path = argv[i + 1];
+    } else if (option == "--step") {
+      steps = values;
+    } else if (option == "--scale") {
+      scales = values;
+    } else if (option == "--min-size") {
+      min_sizes = values;
+    } else if (option == "--thresh") {
+      threshs = values;
+    } else if (option == "--mode") {
+      modes = values;
+    } else {
+      PrintUsage(argv[0]);
+      return -1;
+    }
+  }
+
+  vector<Sample> samples;
+  // An ifstream opens a directory too, reading nothing from it
+  if (IsDirectory(argv[2]))
+    LoadDirectory(argv[2], &samples);
+  else
+    LoadList(argv[2], &samples);
+  if (samples.empty()) {
+    cerr << "No annotated images found in " << argv[2] << endl;
+    return -1;
+  }
+
+  vector<cv::Mat> calib_images;
+  if (!calib_path.empty() &&
+      (!seeta::fd::LoadImageList(calib_path, &calib_images) ||
+      calib_images.empty())) {
+    cerr << "No calibration images found in " << calib_path << endl;
+    return -1;
+  }
+
+  cout << "# " << samples.size() << " images" << endl;
+  if (find(modes.begin(), modes.end(), "quantized") != modes.end()) {
+    if (calib_images.empty()) {
+      cout << "# warning: quantized mode calibrated on the evaluated images,"
+          << " use --calib for a separate list" << endl;
+    } else {
+      cout << "# quantized mode calibrated on " << calib_images.size()
+          << " images of " << calib_path << endl;
+    }
+  }
+  cout << "# step\tscale\tmin_size\tthresh\tmode\trecall\tprecision"
+      << "\timages/s\tp50_ms\tp90_ms\tp99_ms" << endl;
+  cout << setprecision(4);
+
+  for (size_t i = 0; i < steps.size(); i++) {
+    for (size_t j = 0; j < scales.size(); j++) {
+      for (size_t k = 0; k < min_sizes.size(); k++) {
+        for (size_t l = 0; l < threshs.size(); l++) {
+          for (size_t m = 0; m < modes.size(); m++) {
+            Setting setting;
+            setting.wnd_step = atoi(steps[i].c_str());
+            setting.scale_factor = static_cast<float>(atof(scales[j].c_str()));
+            setting.min_face_size = atoi(min_sizes[k].c_str());
+            setting.thresh = static_cast<float>(atof(threshs[l].c_str()));
+            setting.mode = modes[m];
+            RunSetting(argv[1], setting, samples, calib_images);
+          }
+        }
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is a tool of the SeetaFace Detection module, which turns a model file of
+ * the face detection method described in the following paper into a C++ translation
+ * unit of classifiers with the model sizes fixed at compile time:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "classifier.h"
+#include "specialized_model.h"
+
+using namespace std;
+
+// Group size of base classifiers in LABBoostedClassifier
+static const int32_t kLABFeatGroupSize = 10;
+
+static int32_t ReadInt(istream* input) {
+  int32_t val = 0;
+  input->read(reinterpret_cast<char*>(&val), sizeof(int32_t));
+  return val;
+}
+
+static vector<float> ReadFloats(istream* input, int32_t len) {
+  vector<float> val(len > 0 ? len : 0);
+  input->read(reinterpret_cast<char*>(val.data()), sizeof(float) * val.size());
+  return val;
+}
+
+static string FloatLiteral(float val) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.9gf", val);
+  string str(buf);
+  if (str.find_first_of(".en") == string::npos)
+    str.insert(str.size() - 1, ".0");
+  return str;
+}
+
+static bool WriteFloatArray(ostream* output, const string & name,
+    const vector<float> & val) {
+  *output << "const float " << name << "[" << val.size() << "] = {";
+  for (size_t i = 0; i < val.size(); i++) {
+    if (!std::isfinite(val[i]))
+      return false;
+    *output << (i % 8 == 0 ? "\n  " : " ") << FloatLiteral(val[i]) << ",";
+  }
+  *output << "\n};\n\n";
+  return true;
+}
+
+// Write the tables of a LAB boosted classifier, and its construction code
+static bool GenerateLABBoostedClassifier(istream* input, int32_t idx,
+    ostream* tables, ostream* factory) {
+  int32_t num_base_classifier = ReadInt(input);
+  int32_t num_bin = ReadInt(input);
+  if (input->fail() || num_base_classifier <= 0 || num_bin <= 0)
+    return false;
+
+  string prefix = "kClassifier" + to_string(idx);
+  *tables << "const seeta::fd::LABFeature " << prefix << "Feat["
+    << num_base_classifier << "] = {";
+  for (int32_t i = 0; i < num_base_classifier; i++) {
+    int32_t x = ReadInt(input);
+    int32_t y = ReadInt(input);
+    *tables << (i % 8 == 0 ? "\n  " : " ") << "{" << x << ", " << y << "},";
+  }
+  *tables << "\n};\n\n";
+
+  vector<float> thresh = ReadFloats(input, num_base_classifier);
+  if (!WriteFloatArray(tables, prefix + "Thresh", thresh))
+    return false;
+
+  *tables << "const float " << prefix << "Weights[" << num_base_classifier
+    << "][" << num_bin + 1 << "] = {\n";
+  for (int32_t i = 0; i < num_base_classifier; i++) {
+    vector<float> weights = ReadFloats(input, num_bin + 1);
+    *tables << "  {";
+    for (int32_t j = 0; j <= num_bin; j++) {
+      if (!std::isfinite(weights[j]))
+        return false;
+      *tables << (j % 8 == 0 ? "\n    " : " ") << FloatLiteral(weights[j]) << ",";
+    }
+    *tables << "\n  },\n";
+  }
+  *tables << "};\n\n";
+
+  if (num_base_classifier % kLABFeatGroupSize != 0) {
+    *factory << "  model.push_back(nullptr);\n";
+  } else {
+    *factory << "  model.push_back(std::shared_ptr<seeta::fd::Classifier>(\n"
+      << "    new seeta::fd::FixedLABBoostedClassifier<" << num_base_classifier
+      << ", " << num_bin << ", " << kLABFeatGroupSize << ">(\n"
+      << "    " << prefix << "Feat, " << prefix << "Weights, " << prefix
+      << "Thresh)));\n";
+  }
+  return !input->fail();
+}
+
+// Write the tables of a SURF-MLP classifier, and its construction code
+static bool GenerateSURFMLP(istream* input, int32_t idx, ostream* tables,
+    ostream* factory) {
+  int32_t num_layer = ReadInt(input);
+  int32_t num_feat = ReadInt(input);
+  if (input->fail() || num_layer <= 1 || num_feat <= 0)
+    return false;
+
+  string prefix = "kClassifier" + to_string(idx);
+  *tables << "const int32_t " << prefix << "FeatID[" << num_feat << "] = {\n ";
+  for (int32_t i = 0; i < num_feat; i++)
+    *tables << " " << ReadInt(input) << ",";
+  *tables << "\n};\n\n";
+
+  float thresh = ReadFloats(input, 1)[0];
+  vector<int32_t> dims(1, ReadInt(input));
+  if (input->fail() || dims[0] <= 0)
+    return false;
+
+  for (int32_t i = 1; i < num_layer; i++) {
+    dims.push_back(ReadInt(input));
+    if (input->fail() || dims[i] <= 0)
+      return false;
+    string layer = prefix + "Layer" + to_string(i - 1);
+    if (!WriteFloatArray(tables, layer + "Weights",
+        ReadFloats(input, dims[i - 1] * dims[i])) ||
+        !WriteFloatArray(tables, layer + "Bias", ReadFloats(input, dims[i])))
+      return false;
+  }
+
+  for (const char* param : {"Weights", "Bias"}) {
+    *tables << "const float* const " << prefix << param << "[" << num_layer - 1
+      << "] = {\n ";
+    for (int32_t i = 0; i < num_layer - 1; i++)
+      *tables << " " << prefix << "Layer" << i << param << ",";
+    *tables << "\n};\n\n";
+  }
+
+  int32_t feat_dim = dims[0] / num_feat;
+  if (feat_dim * num_feat != dims[0] || feat_dim % 4 != 0) {
+    *factory << "  model.push_back(nullptr);\n";
+  } else {
+    *factory << "  model.push_back(std::shared_ptr<seeta::fd::Classifier>(\n"
+      << "    new seeta::fd::FixedSURFMLP<" << feat_dim;
+    for (size_t i = 0; i < dims.size(); i++)
+      *factory << ", " << dims[i];
+    *factory << ">(\n    " << prefix << "FeatID, " << prefix << "Weights, "
+      << prefix << "Bias, " << FloatLiteral(thresh) << ")));\n";
+  }
+  return !input->fail();
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    cout << "Usage: " << argv[0]
+      << " model_path output_path"
+      << endl;
+    return -1;
+  }
+
+  ifstream model_file(argv[1], ifstream::binary);
+  if (!model_file.is_open()) {
+    cerr << "Failed to open " << argv[1] << endl;
+    return -1;
+  }
+  string model_data((istreambuf_iterator<char>(model_file)),
+    istreambuf_iterator<char>());
+  istringstream input(model_data);
+
+  ostringstream tables;
+  ostringstream factory;
+  int32_t num_classifier = 0;
+  bool is_ok = true;
+
+  int32_t num_hierarchy = ReadInt(&input);
+  is_ok = !input.fail() && num_hierarchy > 0;
+  for (int32_t i = 0; is_ok && i < num_hierarchy; i++) {
+    int32_t hierarchy_size = ReadInt(&input);
+    for (int32_t j = 0; is_ok && j < hierarchy_size; j++) {
+      int32_t num_stage = ReadInt(&input);
+      for (int32_t k = 0; is_ok && k < num_stage; k++) {
+        switch (static_cast<seeta::fd::ClassifierType>(ReadInt(&input))) {
+        case seeta::fd::ClassifierType::LAB_Boosted_Classifier:
+          is_ok = GenerateLABBoostedClassifier(&input, num_classifier,
+            &tables, &factory);
+          break;
+        case seeta::fd::ClassifierType::SURF_MLP:
+          is_ok = GenerateSURFMLP(&input, num_classifier, &tables, &factory);
+          break;
+        default:
+          is_ok = false;
+          break;
+        }
+        num_classifier++;
+      }
+
+      int32_t num_wnd_src = ReadInt(&input);
+      for (int32_t k = 0; k < num_wnd_src; k++)
+        ReadInt(&input);
+      is_ok = is_ok && !input.fail();
+    }
+  }
+
+  if (!is_ok) {
+    cerr << "Invalid model file " << argv[1] << endl;
+    return -1;
+  }
+
+  ofstream output(argv[2]);
+  output << "// Generated by fust_codegen from " << argv[1] << ".\n"
+    << "// Do not edit; rerun the tool when the model changes.\n\n"
+    << "#include <cstdint>\n#include <memory>\n#include <vector>\n\n"
+    << "#include \"classifier/fixed_classifier.h\"\n"
+    << "#include \"specialized_model.h\"\n\n"
+    << "namespace {\n\n" << tables.str()
+    << "std::vector<std::shared_ptr<seeta::fd::Classifier> > "
+    << "CreateClassifiers() {\n"
+    << "  std::vector<std::shared_ptr<seeta::fd::Classifier> > model;\n"
+    << factory.str() << "  return model;\n}\n\n"
+    << "const bool kRegistered = seeta::fd::SpecializedModelRegistry::Register(\n"
+    << "  " << seeta::fd::SpecializedModelRegistry::Fingerprint(
+      model_data.data(), model_data.size()) << "ULL, CreateClassifiers);\n\n"
+    << "}  // namespace\n";
+  output.close();
+
+  if (output.fail()) {
+    cerr << "Failed to write " << argv[2] << endl;
+    return -1;
+  }
+  return 0;
+}
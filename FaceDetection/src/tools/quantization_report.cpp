@@ -0,0 +1,151 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "face_detection.h"
+#include "detection_match.h"
+
+using namespace std;
+using seeta::fd::IoU;
+using seeta::fd::ToImageData;
+
+static vector<seeta::FaceInfo> TimedDetect(seeta::FaceDetection* detector,
+    const seeta::ImageData & img, double* secs) {
+  int64_t t0 = cv::getTickCount();
+  vector<seeta::FaceInfo> faces = detector->Detect(img);
+  int64_t t1 = cv::getTickCount();
+  *secs += (t1 - t0) / cv::getTickFrequency();
+  return faces;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    cout << "Usage: " << argv[0]
+        << " model_path calibration_image_list test_image_list [min_face_size]"
+        << endl;
+    return -1;
+  }
+
+  vector<cv::Mat> calib_images;
+  vector<cv::Mat> test_images;
+  if (!seeta::fd::LoadImageList(argv[2], &calib_images) ||
+      !seeta::fd::LoadImageList(argv[3], &test_images)) {
+    cerr << "Failed to open the image lists." << endl;
+    return -1;
+  }
+
+  seeta::FaceDetection detector(argv[1]);
+  detector.SetMinFaceSize(argc > 4 ? atoi(argv[4]) : 40);
+  detector.SetScoreThresh(2.f);
+  detector.SetImagePyramidScaleFactor(0.8f);
+  detector.SetWindowStep(4, 4);
+
+  // Floating-point reference detections
+  double float_secs = 0;
+  vector<vector<seeta::FaceInfo> > float_faces;
+  for (size_t i = 0; i < test_images.size(); i++) {
+    float_faces.push_back(
+      TimedDetect(&detector, ToImageData(test_images[i]), &float_secs));
+  }
+
+  vector<seeta::ImageData> calib_data;
+  for (size_t i = 0; i < calib_images.size(); i++)
+    calib_data.push_back(ToImageData(calib_images[i]));
+  if (!detector.CalibrateQuantizedMLP(calib_data)) {
+    cerr << "Calibration failed: no face candidates reached the SURF-MLP stages."
+        << endl;
+    return -1;
+  }
+
+  double quant_secs = 0;
+  int32_t num_float = 0;
+  int32_t num_quant = 0;
+  int32_t num_match = 0;
+  double sum_score_diff = 0;
+  double max_score_diff = 0;
+  double sum_iou = 0;
+
+  for (size_t i = 0; i < test_images.size(); i++) {
+    vector<seeta::FaceInfo> quant_faces =
+      TimedDetect(&detector, ToImageData(test_images[i]), &quant_secs);
+    const vector<seeta::FaceInfo> & ref_faces = float_faces[i];
+
+    // Greedily match each reference detection to its best unmatched one
+    vector<int32_t> matches;
+    int32_t img_match = seeta::fd::MatchBoxes(seeta::fd::GetBoxes(ref_faces),
+      seeta::fd::GetBoxes(quant_faces), &matches);
+    for (size_t j = 0; j < ref_faces.size(); j++) {
+      if (matches[j] < 0)
+        continue;
+      const seeta::FaceInfo & quant_face = quant_faces[matches[j]];
+      double score_diff = fabs(ref_faces[j].score - quant_face.score);
+      sum_score_diff += score_diff;
+      max_score_diff = max(max_score_diff, score_diff);
+      sum_iou += IoU(ref_faces[j].bbox, quant_face.bbox);
+    }
+
+    num_float += static_cast<int32_t>(ref_faces.size());
+    num_quant += static_cast<int32_t>(quant_faces.size());
+    num_match += img_match;
+    cout << "Image " << i << ": " << ref_faces.size() << " float, "
+        << quant_faces.size() << " quantized, " << img_match << " matched"
+        << endl;
+  }
+
+  cout << endl << "Images: " << test_images.size()
+      << " (calibrated on " << calib_images.size() << ")" << endl;
+  cout << "Detections (float / quantized / matched): " << num_float << " / "
+      << num_quant << " / " << num_match << endl;
+  if (num_float > 0)
+    cout << "Recall w.r.t. float: " << static_cast<double>(num_match) / num_float
+        << endl;
+  if (num_quant > 0)
+    cout << "Precision w.r.t. float: "
+        << static_cast<double>(num_match) / num_quant << endl;
+  if (num_match > 0) {
+    cout << "Mean IoU of matches: " << sum_iou / num_match << endl;
+    cout << "Score difference (mean / max): " << sum_score_diff / num_match
+        << " / " << max_score_diff << endl;
+  }
+  cout << "Detection time (float / quantized): " << float_secs << "s / "
+      << quant_secs << "s" << endl;
+
+  return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ *
+ * This file is part of the open-source SeetaFace engine, which includes three modules:
+ * SeetaFace Detection, SeetaFace Alignment, and SeetaFace Identification.
+ *
+ * This file is part of the SeetaFace Detection module, containing codes implementing the
+ * face detection method described in the following paper:
+ *
+ *
+ *   Funnel-structured cascade for multi-view face detection with alignment awareness,
+ *   Shuzhe Wu, Meina Kan, Zhenliang He, Shiguang Shan, Xilin Chen.
+ *   In Neurocomputing (under review)
+ *
+ *
+ * Copyright (C) 2016, Visual Information Processing and Learning (VIPL) group,
+ * Institute of Computing Technology, Chinese Academy of Sciences, Beijing, China.
+ *
+ * The codes are mainly developed by Shuzhe Wu (a Ph.D supervised by Prof. Shiguang Shan)
+ *
+ * As an open-source face recognition engine: you can redistribute SeetaFace source codes
+ * and/or modify it under the terms of the BSD 2-Clause License.
+ *
+ * You should have received a copy of the BSD 2-Clause License along with the software.
+ * If not, see < https://opensource.org/licenses/BSD-2-Clause>.
+ *
+ * Contact Info: you can send an email to SeetaFace@vipl.ict.ac.cn for any problems.
+ *
+ * Note: the above information must be kept whenever or wherever the codes are used.
+ *
+ */
+
+#include "util/image_atlas.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace seeta {
+namespace fd {
+
+void ImageAtlas::Reset(int32_t width, int32_t max_height, int32_t guard) {
+  width_ = width;
+  height_ = 0;
+  max_height_ = max_height;
+  guard_ = guard;
+
+  shelf_x_ = 0;
+  shelf_y_ = 0;
+  shelf_height_ = 0;
+
+  data_.clear();
+  region_.clear();
+  id_.clear();
+}
+
+bool ImageAtlas::Add(const seeta::ImageData & img, int32_t id) {
+  if (img.width > width_)
+    return false;
+
+  // Open a new shelf when the current one is full
+  if (shelf_x_ > 0 && shelf_x_ + img.width > width_) {
+    shelf_y_ += shelf_height_ + guard_;
+    shelf_x_ = 0;
+    shelf_height_ = 0;
+  }
+  if (shelf_y_ + img.height > max_height_)
+    return false;
+
+  if (shelf_y_ + img.height > height_) {
+    height_ = shelf_y_ + img.height;
+    data_.resize(width_ * height_, 0);
+  }
+
+  seeta::Rect region;
+  region.x = shelf_x_;
+  region.y = shelf_y_;
+  region.width = img.width;
+  region.height = img.height;
+
+  const uint8_t* src = img.data;
+  uint8_t* dest = data_.data() + region.y * width_ + region.x;
+  for (int32_t r = 0; r < img.height; r++) {
+    std::memcpy(dest, src, img.width * sizeof(uint8_t));
+    src += img.width;
+    dest += width_;
+  }
+
+  region_.push_back(region);
+  id_.push_back(id);
+
+  shelf_x_ += img.width + guard_;
+  shelf_height_ = std::max(shelf_height_, img.height);
+  return true;
+}
+
+void ImageAtlas::MapBack(const std::vector<std::vector<seeta::FaceInfo> > & bboxes,
+    std::vector<std::vector<seeta::FaceInfo> >* results) const {
+  int32_t num_img = std::min(static_cast<int32_t>(bboxes.size()), num_image());
+
+  for (int32_t i = 0; i < num_img; i++) {
+    for (size_t j = 0; j < bboxes[i].size(); j++) {
+      seeta::FaceInfo face = bboxes[i][j];
+      face.bbox.x -= region_[i].x;
+      face.bbox.y -= region_[i].y;
+      (*results)[id_[i]].push_back(face);
+    }
+  }
+}
+
+int32_t ImageAtlas::Locate(const seeta::Rect & bbox, float min_overlap) const {
+  int32_t center_x = bbox.x + bbox.width / 2;
+  int32_t center_y = bbox.y + bbox.height / 2;
+  int32_t num_img = static_cast<int32_t>(region_.size());
+
+  for (int32_t i = 0; i < num_img; i++) {
+    const seeta::Rect & region = region_[i];
+    if (center_x < region.x || center_x >= region.x + region.width ||
+        center_y < region.y || center_y >= region.y + region.height)
+      continue;
+
+    int32_t x1 = std::max(bbox.x, region.x);
+    int32_t y1 = std::max(bbox.y, region.y);
+    int32_t x2 = std::min(bbox.x + bbox.width, region.x + region.width);
+    int32_t y2 = std::min(bbox.y + bbox.height, region.y + region.height);
+    float area = static_cast<float>(bbox.width * bbox.height);
+    float area_inside = static_cast<float>((x2 - x1) * (y2 - y1));
+
+    return (area_inside >= min_overlap * area ? i : -1);
+  }
+
+  return -1;
+}
+
+int32_t ImageAtlas::Accept(const seeta::Rect & bbox) const {
+  int32_t img_idx = Locate(bbox, 0.0f);
+  if (img_idx < 0)
+    return -1;
+
+  // Allow one pixel for the rounding of window coordinates on the pyramid
+  const seeta::Rect & region = region_[img_idx];
+  bool is_inside = (bbox.x >= region.x - 1 && bbox.y >= region.y - 1 &&
+    bbox.x + bbox.width <= region.x + region.width + 1 &&
+    bbox.y + bbox.height <= region.y + region.height + 1);
+  return (is_inside ? img_idx : -1);
+}
+
+}  // namespace fd
+}  // namespace seeta
@@ -41,6 +41,10 @@ const seeta::ImageData* ImagePyramid::GetNextScaleImage(float* scale_factor) {
 
     width_scaled_ = static_cast<int32_t>(width1x_ * scale_factor_);
     height_scaled_ = static_cast<int32_t>(height1x_ * scale_factor_);
+    if (keep_levels_) {
+      scale_factor_ *= scale_step_;
+      return GetLevel(width_scaled_, height_scaled_);
+    }
 
     seeta::ImageData src_img(width1x_, height1x_);
     seeta::ImageData dest_img(width_scaled_, height_scaled_);
@@ -54,10 +58,36 @@ const seeta::ImageData* ImagePyramid::GetNextScaleImage(float* scale_factor) {
     img_scaled_.height = height_scaled_;
     return &img_scaled_;
   } else {
+    cur_level_ = nullptr;
     return nullptr;
   }
 }
 
+const seeta::ImageData* ImagePyramid::GetLevel(int32_t width,
+    int32_t height) {
+  for (size_t i = 0; i < levels_.size(); i++) {
+    if (levels_[i]->image.width == width && levels_[i]->image.height == height) {
+      cur_level_ = levels_[i].get();
+      return &(cur_level_->image);
+    }
+  }
+
+  std::unique_ptr<PyramidLevel> level(new PyramidLevel());
+  level->data.resize(width * height);
+  level->image.data = level->data.data();
+  level->image.width = width;
+  level->image.height = height;
+  level->image.num_channels = 1;
+
+  seeta::ImageData src_img(width1x_, height1x_);
+  src_img.data = buf_img_;
+  seeta::fd::ResizeImage(src_img, &(level->image));
+
+  cur_level_ = level.get();
+  levels_.push_back(std::move(level));
+  return &(cur_level_->image);
+}
+
 void ImagePyramid::SetImage1x(const uint8_t* img_data, int32_t width,
     int32_t height) {
   if (width > buf_img_width_ || height > buf_img_height_) {
@@ -73,6 +103,9 @@ void ImagePyramid::SetImage1x(const uint8_t* img_data, int32_t width,
   std::memcpy(buf_img_, img_data, width * height * sizeof(uint8_t));
   scale_factor_ = max_scale_;
   UpdateBufScaled();
+
+  levels_.clear();
+  cur_level_ = nullptr;
 }
 
 void ImagePyramid::UpdateBufScaled() {
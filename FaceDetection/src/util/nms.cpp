@@ -52,6 +52,47 @@ void NonMaximumSuppression(std::vector<seeta::FaceInfo>* bboxes,
   std::vector<int32_t> mask_merged(num_bbox, 0);
   bool all_merged = false;
 
+  // Boxes are bucketed in a grid by their top-left corners, with cells as
+  // large as the largest box, so that only those in the cells around the
+  // selected one need to be checked.
+  int32_t min_x = 0;
+  int32_t min_y = 0;
+  int32_t cell_size = 1;
+  int32_t num_cell_x = 1;
+  int32_t num_cell_y = 1;
+  if (num_bbox > 0) {
+    int32_t max_x = min_x = (*bboxes)[0].bbox.x;
+    int32_t max_y = min_y = (*bboxes)[0].bbox.y;
+    for (int32_t i = 0; i < num_bbox; i++) {
+      const seeta::Rect & bbox = (*bboxes)[i].bbox;
+      min_x = std::min(min_x, bbox.x);
+      min_y = std::min(min_y, bbox.y);
+      max_x = std::max(max_x, bbox.x);
+      max_y = std::max(max_y, bbox.y);
+      cell_size = std::max(cell_size, std::max(bbox.width, bbox.height));
+    }
+    num_cell_x = (max_x - min_x) / cell_size + 1;
+    num_cell_y = (max_y - min_y) / cell_size + 1;
+  }
+
+  std::vector<int32_t> cell_start(num_cell_x * num_cell_y + 1, 0);
+  std::vector<int32_t> cell_bbox(num_bbox);
+  for (int32_t i = 0; i < num_bbox; i++) {
+    const seeta::Rect & bbox = (*bboxes)[i].bbox;
+    cell_start[((bbox.y - min_y) / cell_size) * num_cell_x +
+      (bbox.x - min_x) / cell_size + 1]++;
+  }
+  for (size_t i = 1; i < cell_start.size(); i++)
+    cell_start[i] += cell_start[i - 1];
+  std::vector<int32_t> cell_pos(cell_start.begin(), cell_start.end() - 1);
+  for (int32_t i = 0; i < num_bbox; i++) {
+    const seeta::Rect & bbox = (*bboxes)[i].bbox;
+    cell_bbox[cell_pos[((bbox.y - min_y) / cell_size) * num_cell_x +
+      (bbox.x - min_x) / cell_size]++] = i;
+  }
+
+  std::vector<int32_t> merged;
+
   while (!all_merged) {
     while (select_idx < num_bbox && mask_merged[select_idx] == 1)
       select_idx++;
@@ -70,27 +111,46 @@ void NonMaximumSuppression(std::vector<seeta::FaceInfo>* bboxes,
     float x2 = static_cast<float>(select_bbox.x + select_bbox.width - 1);
     float y2 = static_cast<float>(select_bbox.y + select_bbox.height - 1);
 
+    int32_t cell_x1 = std::max(select_bbox.x - min_x - cell_size + 1, 0) / cell_size;
+    int32_t cell_y1 = std::max(select_bbox.y - min_y - cell_size + 1, 0) / cell_size;
+    int32_t cell_x2 = std::min((select_bbox.x + select_bbox.width - 1 - min_x) /
+      cell_size, num_cell_x - 1);
+    int32_t cell_y2 = std::min((select_bbox.y + select_bbox.height - 1 - min_y) /
+      cell_size, num_cell_y - 1);
+
     select_idx++;
-    for (int32_t i = select_idx; i < num_bbox; i++) {
-      if (mask_merged[i] == 1)
-        continue;
-
-      seeta::Rect & bbox_i = (*bboxes)[i].bbox;
-      float x = std::max<float>(x1, static_cast<float>(bbox_i.x));
-      float y = std::max<float>(y1, static_cast<float>(bbox_i.y));
-      float w = std::min<float>(x2, static_cast<float>(bbox_i.x + bbox_i.width - 1)) - x + 1;
-      float h = std::min<float>(y2, static_cast<float>(bbox_i.y + bbox_i.height - 1)) - y + 1;
-      if (w <= 0 || h <= 0)
-        continue;
-
-      float area2 = static_cast<float>(bbox_i.width * bbox_i.height);
-      float area_intersect = w * h;
-      float area_union = area1 + area2 - area_intersect;
-      if (static_cast<float>(area_intersect) / area_union > iou_thresh) {
-        mask_merged[i] = 1;
-        bboxes_nms->back().score += (*bboxes)[i].score;
+    merged.clear();
+    for (int32_t cy = cell_y1; cy <= cell_y2; cy++) {
+      for (int32_t cx = cell_x1; cx <= cell_x2; cx++) {
+        int32_t cell = cy * num_cell_x + cx;
+        for (int32_t k = cell_start[cell]; k < cell_start[cell + 1]; k++) {
+          int32_t i = cell_bbox[k];
+          if (i < select_idx || mask_merged[i] == 1)
+            continue;
+
+          seeta::Rect & bbox_i = (*bboxes)[i].bbox;
+          float x = std::max<float>(x1, static_cast<float>(bbox_i.x));
+          float y = std::max<float>(y1, static_cast<float>(bbox_i.y));
+          float w = std::min<float>(x2, static_cast<float>(bbox_i.x + bbox_i.width - 1)) - x + 1;
+          float h = std::min<float>(y2, static_cast<float>(bbox_i.y + bbox_i.height - 1)) - y + 1;
+          if (w <= 0 || h <= 0)
+            continue;
+
+          float area2 = static_cast<float>(bbox_i.width * bbox_i.height);
+          float area_intersect = w * h;
+          float area_union = area1 + area2 - area_intersect;
+          if (static_cast<float>(area_intersect) / area_union > iou_thresh) {
+            mask_merged[i] = 1;
+            merged.push_back(i);
+          }
+        }
       }
     }
+
+    // Accumulate the scores in the order of decreasing scores
+    std::sort(merged.begin(), merged.end());
+    for (size_t k = 0; k < merged.size(); k++)
+      bboxes_nms->back().score += (*bboxes)[merged[k]].score;
   }
 }
 